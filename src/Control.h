@@ -70,6 +70,16 @@ namespace mj
       static_cast<void>(screenY);
     }
 
+    /// <summary>
+    /// A typed character (WM_CHAR). There is no keyboard focus, so it goes to the control under the mouse cursor.
+    /// </summary>
+    virtual void OnChar(int16_t x, int16_t y, wchar_t c)
+    {
+      static_cast<void>(x);
+      static_cast<void>(y);
+      static_cast<void>(c);
+    }
+
     /// <summary>
     /// Position and dimensions should be adjusted by parent control before calling this function.
     /// </summary>
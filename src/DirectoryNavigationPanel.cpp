@@ -8,6 +8,9 @@
 #include <shellapi.h>
 #include "../3rdparty/tracy/Tracy.hpp"
 #include "Threadpool.h"
+#include "mj_directory.h"
+#include "mj_parallel.h"
+#include "mj_coroutine.h"
 #include "../vs/resource.h"
 #define STRICT_TYPED_ITEMIDS
 #include <Shlobj.h>
@@ -17,44 +20,17 @@ static float ConvertPointSizeToDIP(float points)
   return ((points / 72.0f) * 96.0f);
 }
 
-struct InvalidateRectTask : public mj::Task
+/// <summary>
+/// Call from the main thread. Invalidating only grows the update region,
+/// so any number of calls in a row result in a single WM_PAINT.
+/// </summary>
+static void RequestRepaint()
 {
-  void Execute() override
+  HWND hWnd = svc::MainWindowHandle();
+  if (hWnd)
   {
-    ZoneScoped;
-    MJ_ERR_ZERO(::InvalidateRect(svc::MainWindowHandle(), nullptr, FALSE));
+    MJ_ERR_ZERO(::InvalidateRect(hWnd, nullptr, FALSE));
   }
-};
-
-void mj::DirectoryNavigationPanel::Breadcrumb::Init(AllocatorBase* pAllocator)
-{
-  this->breadcrumb.Init(pAllocator);
-}
-
-void mj::DirectoryNavigationPanel::Breadcrumb::Destroy()
-{
-  this->breadcrumb.Destroy();
-}
-
-bool mj::DirectoryNavigationPanel::Breadcrumb::Add(const wchar_t* pStringLiteral)
-{
-  return this->breadcrumb.Add(pStringLiteral);
-}
-
-bool mj::DirectoryNavigationPanel::Breadcrumb::Add(const StringView& string)
-{
-  return this->breadcrumb.Add(string);
-}
-
-mj::StringView* mj::DirectoryNavigationPanel::Breadcrumb::Last()
-{
-  size_t size = this->breadcrumb.Size();
-  if (size > 0)
-  {
-    return this->breadcrumb[size - 1];
-  }
-
-  return nullptr;
 }
 
 ID2D1Bitmap* mj::DirectoryNavigationPanel::ConvertIcon(HICON hIcon)
@@ -120,106 +96,174 @@ void mj::DirectoryNavigationPanel::OnIconBitmapAvailable(ID2D1Bitmap* pIconBitma
 {
   if (resource == IDB_FOLDER)
   {
-    for (auto& entry : this->entries)
+    for (Entry* pEntry : this->folderEntries)
     {
-      if (entry.type == EEntryType::Directory)
-      {
-        entry.pIcon = pIconBitmap;
-        pIconBitmap->AddRef();
-      }
+      pEntry->pIcon = pIconBitmap;
+      pIconBitmap->AddRef();
     }
-    mj::ThreadpoolSubmitTask(mj::ThreadpoolCreateTask<InvalidateRectTask>());
+    ::RequestRepaint();
   }
   else if (resource == IDB_DOCUMENT)
   {
-    for (auto& entry : this->entries)
+    for (Entry* pEntry : this->fileEntries)
     {
-      if (entry.type == EEntryType::File)
-      {
-        entry.pIcon = pIconBitmap;
-        pIconBitmap->AddRef();
-      }
+      pEntry->pIcon = pIconBitmap;
+      pIconBitmap->AddRef();
     }
-    mj::ThreadpoolSubmitTask(mj::ThreadpoolCreateTask<InvalidateRectTask>());
+    ::RequestRepaint();
   }
 }
 
-bool mj::detail::ListFolderContentsTask::Add(mj::ArrayList<size_t>& list, size_t index)
+/// <summary>
+/// A chunk is sent when it has this many entries, or when it is this old, whichever comes first.
+/// </summary>
+static constexpr size_t LISTING_CHUNK_SIZE   = 1024;
+static constexpr LONGLONG LISTING_CHUNK_MS   = 8;
+static constexpr size_t LISTING_CLOCK_PERIOD = 64; // Entries between clock reads
+
+/// <summary>
+/// Rows shown while typing. The rest would be scrolled to rather than filtered further.
+/// </summary>
+static constexpr uint32_t FUZZY_MAX_ROWS = 1000;
+
+/// <summary>
+/// Cached listings with this many files are filtered on all threads, in subranges of at least FILTER_GRAIN files.
+/// </summary>
+static constexpr size_t FILTER_PARALLEL_MIN_FILES = 16 * 1024;
+static constexpr size_t FILTER_GRAIN              = 1024;
+
+bool mj::detail::ListFolderContentsTask::StartChunk()
 {
-  size_t* pItem = list.Emplace(1);
+  this->pChunk = mj::ThreadpoolCreateTask<mj::detail::ListFolderChunkTask>();
+  if (!this->pChunk)
+  {
+    return false;
+  }
+
+  this->pChunk->pParent         = this->pParent;
+  this->pChunk->token           = this->token;
+  this->pChunk->priority        = ETaskPriority::Interactive;
+  this->pChunk->runOnMainThread = true;
 
-  if (!pItem)
+  // The chunk owns its results, and frees them when it ends
+  AllocatorBase* pAllocator = mj::ThreadpoolGetOutputAllocator(this->pChunk);
+  if (!pAllocator)
   {
-    this->files.Destroy();
-    this->folders.Destroy();
-    this->stringCache.Destroy();
+    // Nothing to free, send it empty
+    mj::ThreadpoolSubmitTask(this->pChunk);
+    this->pChunk = nullptr;
     return false;
   }
 
-  *pItem = index;
+  this->pChunk->folders.Init(pAllocator);
+  this->pChunk->files.Init(pAllocator);
+  this->pChunk->stringCache.Init(pAllocator);
+
+  MJ_UNINITIALIZED LARGE_INTEGER frequency;
+  static_cast<void>(::QueryPerformanceFrequency(&frequency));
+  static_cast<void>(::QueryPerformanceCounter(&this->chunkDeadline));
+  this->chunkDeadline.QuadPart += frequency.QuadPart * LISTING_CHUNK_MS / 1000;
 
   return true;
 }
 
+void mj::detail::ListFolderContentsTask::SendChunk()
+{
+  ZoneScoped;
+
+  // Completions end in the order they were sent, so chunks arrive in order, and before this task ends
+  mj::ThreadpoolSubmitTask(this->pChunk);
+  this->pChunk = nullptr;
+}
+
 void mj::detail::ListFolderContentsTask::Execute()
 {
   ZoneScoped;
 
-  this->allocator.Init();
-  this->files.Init(&this->allocator);
-  this->folders.Init(&this->allocator);
-  this->stringCache.Init(&this->allocator);
   this->status = 0;
+  this->pChunk = nullptr;
+
+  // Changes made while we list are seen as well. Filtered listings are not cached.
+  if (this->fileFilter.len == 0)
+  {
+    this->watch = mj::ListingCacheWatch(this->directory);
+  }
+
+  // The panel's own filter may change while we run.
+  // A pattern that does not compile leaves it empty, which matches everything, same as in the panel.
+  mj::Glob fileFilter;
+  fileFilter.Init(mj::ThreadpoolGetScratchAllocator());
+  MJ_DEFER(fileFilter.Destroy());
+  if (this->fileFilter.len > 0)
+  {
+    static_cast<void>(fileFilter.Compile(this->fileFilter));
+  }
 
-  MJ_UNINITIALIZED WIN32_FIND_DATA findData;
-  HANDLE hFind = ::FindFirstFileW(this->directory.ptr, &findData);
-  if (hFind == INVALID_HANDLE_VALUE)
+  mj::DirectoryIterator it;
+  MJ_DEFER(it.Close());
+
+  // TODO: Handle the error.
+  // Example: 0x00000005 --> Access is denied.
+  this->status = it.Open(this->directory, mj::ThreadpoolGetScratchAllocator());
+  if (this->status != 0)
   {
-    // TODO: Handle ::GetLastError().
-    // Example: 0x00000005 --> Access is denied.
-    this->status = ::GetLastError();
     return;
   }
 
-  do
+  MJ_UNINITIALIZED mj::DirectoryEntry entry;
+  while (it.Next(&entry))
   {
-    if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_SYSTEM))
+    // The user may have navigated elsewhere already
+    if (this->IsCancelled())
     {
-      MJ_UNINITIALIZED StringView string;
-      string.Init(findData.cFileName);
+      break;
+    }
+
+    if (!(entry.flags & mj::EDirectoryEntryFlags::System))
+    {
+      const bool isDirectory = (entry.flags & mj::EDirectoryEntryFlags::Directory) != 0;
 
-      // Ignore "." and ".."
-      if (string.Equals(L".") || string.Equals(L".."))
+      // Filter before copying, so rejected names never reach the string cache
+      if (!isDirectory && !fileFilter.Matches(entry.name))
       {
         continue;
       }
 
-      if (!this->stringCache.Add(string))
+      if (!this->pChunk && !this->StartChunk())
       {
-        this->files.Destroy();
-        this->folders.Destroy();
-        this->stringCache.Destroy();
+        this->status = ERROR_NOT_ENOUGH_MEMORY;
         break;
       }
 
-      if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+      mj::ArrayList<size_t>& list = isDirectory ? this->pChunk->folders : this->pChunk->files;
+      if (!this->pChunk->stringCache.Add(entry.name) || !list.Add(this->pChunk->stringCache.Size() - 1))
       {
-        if (!this->Add(this->folders, this->stringCache.Size() - 1))
-        {
-          break;
-        }
+        // Keep what we have so far
+        this->status = ERROR_NOT_ENOUGH_MEMORY;
+        break;
+      }
+
+      const size_t numEntries = this->pChunk->stringCache.Size();
+      if (numEntries >= LISTING_CHUNK_SIZE)
+      {
+        this->SendChunk();
       }
-      else
+      else if (numEntries % LISTING_CLOCK_PERIOD == 0)
       {
-        if (!this->Add(this->files, this->stringCache.Size() - 1))
+        MJ_UNINITIALIZED LARGE_INTEGER now;
+        static_cast<void>(::QueryPerformanceCounter(&now));
+        if (now.QuadPart >= this->chunkDeadline.QuadPart)
         {
-          break;
+          this->SendChunk();
         }
       }
     }
-  } while (::FindNextFileW(hFind, &findData) != 0);
+  }
 
-  ::FindClose(hFind);
+  if (this->pChunk)
+  {
+    this->SendChunk();
+  }
 }
 
 void mj::detail::ListFolderContentsTask::OnDone()
@@ -229,6 +273,23 @@ void mj::detail::ListFolderContentsTask::OnDone()
 }
 
 void mj::detail::ListFolderContentsTask::Destroy()
+{
+  // Also when cancelled, so the folder is not watched for nothing
+  mj::ListingCacheUnwatch(this->watch);
+}
+
+void mj::detail::ListFolderChunkTask::Execute()
+{
+  // Runs on the main thread, right before OnDone
+}
+
+void mj::detail::ListFolderChunkTask::OnDone()
+{
+  ZoneScoped;
+  this->pParent->OnListFolderContentsChunk(this);
+}
+
+void mj::detail::ListFolderChunkTask::Destroy()
 {
   ZoneScoped;
   this->files.Destroy();
@@ -236,32 +297,69 @@ void mj::detail::ListFolderContentsTask::Destroy()
   this->stringCache.Destroy();
 }
 
-void mj::DirectoryNavigationPanel::OpenSubFolder(const wchar_t* pFolder)
+void mj::DirectoryNavigationPanel::OpenSubFolder(const StringView& folder)
 {
-  StringView* pLast = this->breadcrumb.Last();
-  if (pLast)
+  if (this->pendingFolder.Copy(this->breadcrumb) && this->pendingFolder.Append(folder))
   {
-    this->sbOpenFolder.Clear();
-    this->sbOpenFolder.Append(*pLast);
-    this->sbOpenFolder.Append(L"\\");
-    this->sbOpenFolder.Append(pFolder);
+    this->OpenFolder();
   }
-
-  this->OpenFolder();
 }
 
 void mj::DirectoryNavigationPanel::OpenFolder()
 {
-  if (this->pListFolderContentsTask)
+  // Also drops chunks of the previous listing that have not arrived yet
+  this->listingCancellation.Cancel();
+  this->listingHasChunks = false;
+  static_cast<void>(::QueryPerformanceCounter(&this->listingStartTime));
+
+  this->sbOpenFolder.Clear();
+  this->pendingFolder.ToOsPath(this->sbOpenFolder);
+  const StringView directory = this->sbOpenFolder.ToStringClosed();
+
+  // Cached listings are filtered here, which is cheaper than listing the folder again
+  ListingSnapshot* pCachedSnapshot = mj::ListingCacheLookup(directory);
+  if (pCachedSnapshot)
+  {
+    this->pListFolderContentsTask = nullptr;
+    this->ShowSnapshot(pCachedSnapshot);
+    return;
+  }
+
+  this->pListFolderContentsTask           = mj::ThreadpoolCreateTask<mj::detail::ListFolderContentsTask>();
+  this->pListFolderContentsTask->pParent  = this;
+  this->pListFolderContentsTask->watch    = {};
+  this->pListFolderContentsTask->token    = this->listingCancellation.Token();
+  this->pListFolderContentsTask->priority = ETaskPriority::Interactive;
+  this->pListFolderContentsTask->kind     = ETaskKind::Io; // Slow on network drives
+  this->pListFolderContentsTask->fileFilter.Init(L"", 0);
+
+  // The task keeps its own copies, freed when it ends. sbOpenFolder is reused by the next OpenFolder,
+  // while a cancelled task may still be running.
+  AllocatorBase* pAllocator = mj::ThreadpoolGetOutputAllocator(this->pListFolderContentsTask);
+  wchar_t* pDirectory =
+      pAllocator ? static_cast<wchar_t*>(pAllocator->Allocate((directory.len + 1) * sizeof(wchar_t))) : nullptr;
+  if (!pDirectory)
+  {
+    // Out of memory, the current folder stays
+    mj::ThreadpoolCancelTask(this->pListFolderContentsTask);
+    mj::ThreadpoolTaskEnd(this->pListFolderContentsTask);
+    this->pListFolderContentsTask = nullptr;
+    return;
+  }
+  static_cast<void>(::memcpy(pDirectory, directory.ptr, directory.len * sizeof(wchar_t)));
+  pDirectory[directory.len] = L'\0';
+  this->pListFolderContentsTask->directory.Init(pDirectory, directory.len);
+
+  // Without a filter, the task lists everything
+  const size_t filterLength = this->filterText.Size();
+  wchar_t* pFilter =
+      filterLength > 0 ? static_cast<wchar_t*>(pAllocator->Allocate(filterLength * sizeof(wchar_t))) : nullptr;
+  if (pFilter)
   {
-    this->pListFolderContentsTask->cancelled = true;
+    static_cast<void>(::memcpy(pFilter, this->filterText.Get(), filterLength * sizeof(wchar_t)));
+    this->pListFolderContentsTask->fileFilter.Init(pFilter, filterLength);
   }
 
-  // Note: The StringBuilder should already contain the folder here.
-  this->sbOpenFolder.Append(L"\\*");
-  this->pListFolderContentsTask            = mj::ThreadpoolCreateTask<mj::detail::ListFolderContentsTask>();
-  this->pListFolderContentsTask->pParent   = this;
-  this->pListFolderContentsTask->directory = sbOpenFolder.ToStringClosed();
   mj::ThreadpoolSubmitTask(this->pListFolderContentsTask);
 }
 
@@ -277,22 +375,32 @@ void mj::DirectoryNavigationPanel::Init(mj::AllocatorBase* pAllocator)
   this->resultsBuffer = this->pAllocator->Allocation(1 * 1024 * 1024);
   MJ_EXIT_NULL(this->searchBuffer.pAddress);
   MJ_EXIT_NULL(this->resultsBuffer.pAddress);
-  this->entries.Init(this->pAllocator);
+  this->pEntryArena = mj::ArenaAllocator::Create();
+  MJ_EXIT_NULL(this->pEntryArena);
+  this->folderEntries.Init(this->pAllocator);
+  this->fileEntries.Init(this->pAllocator);
 
-  this->listFolderContentsTaskResult.files.Init(this->pAllocator);
-  this->listFolderContentsTaskResult.folders.Init(this->pAllocator);
-  this->listFolderContentsTaskResult.stringCache.Init(this->pAllocator);
-
-  // FIXME: When opening a folder, add all parent folders to the breadcrumb
   this->breadcrumb.Init(pAllocator);
-  this->breadcrumb.Add(L"C:");
+  this->pendingFolder.Init(pAllocator);
   this->alOpenFolder.Init(pAllocator);
   this->sbOpenFolder.SetArrayList(&this->alOpenFolder);
+  this->typedText.Init(pAllocator);
+  this->filterText.Init(pAllocator);
+  this->fileFilter.Init(pAllocator);
+  this->fuzzyFilter.Init(pAllocator, this);
+  this->fuzzyNames.Init(pAllocator);
+  this->fuzzyEntries.Init(pAllocator);
+  this->textLayoutCancellation.Init();
+  this->listingCancellation.Init();
+  this->contextMenuCancellation.Init();
 
   // Start tasks
-  this->sbOpenFolder.Clear();
-  this->sbOpenFolder.Append(*this->breadcrumb.Last());
-  this->OpenFolder();
+  MJ_UNINITIALIZED StringView root;
+  root.Init(L"C:");
+  if (this->pendingFolder.Assign(root))
+  {
+    this->OpenFolder();
+  }
 
 #if 0
   {
@@ -300,6 +408,7 @@ void mj::DirectoryNavigationPanel::Init(mj::AllocatorBase* pAllocator)
     pTask->pParent                = this;
     pTask->directory              = mj::StringView(LR"(C:\*)");
     pTask->searchBuffer           = this->searchBuffer;
+    pTask->kind                   = mj::ETaskKind::Io; // Everything_QueryW blocks
     this->queryDone               = false;
     mj::ThreadpoolSubmitTask(pTask);
   }
@@ -316,12 +425,16 @@ void mj::DirectoryNavigationPanel::CheckEverythingQueryPrerequisites()
     DWORD numResults = Everything_GetNumResults();
 
     this->ClearEntries();
-    Entry* pEntries = this->entries.Emplace(numResults);
 
     wchar_t fullPathName[MAX_PATH];
     for (DWORD i = 0; i < numResults; i++)
     {
-      auto& entry = pEntries[i];
+      Entry* pEntry = this->AddEntry(Everything_IsFolderResult(i) ? EEntryType::Directory : EEntryType::File, nullptr);
+      if (!pEntry)
+      {
+        break;
+      }
+      auto& entry = *pEntry;
 
       MJ_UNINITIALIZED StringView string;
       string.Init(Everything_GetResultFileNameW(i));
@@ -350,7 +463,7 @@ void mj::DirectoryNavigationPanel::CheckEverythingQueryPrerequisites()
       }
     }
   }
-  mj::ThreadpoolSubmitTask(mj::ThreadpoolCreateTask<InvalidateRectTask>());
+  ::RequestRepaint();
 }
 
 void mj::DirectoryNavigationPanel::Paint(ID2D1RenderTarget* pRenderTarget)
@@ -363,8 +476,10 @@ void mj::DirectoryNavigationPanel::Paint(ID2D1RenderTarget* pRenderTarget)
   }
   point.y += this->entryHeight;
 
-  for (const auto& entry : this->entries)
+  const size_t numEntries = this->NumEntries();
+  for (size_t i = 0; i < numEntries; i++)
   {
+    const Entry& entry = *this->GetEntry(i);
     if (entry.pTextLayout)
     {
       pRenderTarget->DrawTextLayout(point, entry.pTextLayout, res::d2d1::BlackBrush());
@@ -395,9 +510,9 @@ void mj::DirectoryNavigationPanel::Paint(ID2D1RenderTarget* pRenderTarget)
   }
 
   // Draw scrollbar
-  if (this->height > 0 && this->entries.Size() > 0)
+  if (this->height > 0 && numEntries > 0)
   {
-    FLOAT pixelHeight = static_cast<FLOAT>(this->entries.Size()) * this->entryHeight;
+    FLOAT pixelHeight = static_cast<FLOAT>(numEntries) * this->entryHeight;
     FLOAT viewHeight  = this->height;
     if (pixelHeight > viewHeight)
     {
@@ -427,23 +542,31 @@ void mj::DirectoryNavigationPanel::Destroy()
   ZoneScoped;
 
   this->breadcrumb.Destroy();
+  this->pendingFolder.Destroy();
   this->alOpenFolder.Destroy();
+  this->typedText.Destroy();
+  this->filterText.Destroy();
+  this->fileFilter.Destroy();
 
   this->pAllocator->Free(this->searchBuffer.pAddress);
   this->pAllocator->Free(this->resultsBuffer.pAddress);
 
+  this->listingCancellation.Cancel();
+  this->contextMenuCancellation.Cancel();
+  this->pListFolderContentsTask = nullptr;
   this->ClearEntries();
-  this->entries.Destroy();
-
-  this->listFolderContentsTaskResult.files.Destroy();
-  this->listFolderContentsTaskResult.folders.Destroy();
-  this->listFolderContentsTaskResult.stringCache.Destroy();
-
-  if (this->pListFolderContentsTask)
+  this->folderEntries.Destroy();
+  this->fileEntries.Destroy();
+  this->fuzzyEntries.Destroy();
+  this->fuzzyFilter.Destroy();
+  this->fuzzyNames.Destroy();
+  if (this->pFuzzySnapshot)
   {
-    this->pListFolderContentsTask->cancelled = true;
-    this->pListFolderContentsTask            = nullptr;
+    mj::ListingSnapshotRelease(this->pFuzzySnapshot);
+    this->pFuzzySnapshot = nullptr;
   }
+  this->pEntryArena->Destroy();
+  this->pEntryArena = nullptr;
 
   svc::RemoveIDWriteFactoryObserver(this);
   res::d2d1::RemoveBitmapObserver(this);
@@ -452,9 +575,9 @@ void mj::DirectoryNavigationPanel::Destroy()
 mj::Entry* mj::DirectoryNavigationPanel::TestMouseEntry(int16_t x, int16_t y, RECT* pRect)
 {
   auto point = D2D1::Point2F(16.0f, static_cast<FLOAT>(this->scrollOffset));
-  for (auto i = 0; i < this->entries.Size(); i++)
+  for (size_t i = 0; i < this->NumEntries(); i++)
   {
-    auto& entry = this->entries[i];
+    auto& entry = *this->GetEntry(i);
     if (entry.pTextLayout)
     {
       MJ_UNINITIALIZED DWRITE_TEXT_METRICS metrics;
@@ -506,7 +629,7 @@ void mj::DirectoryNavigationPanel::OnMouseMove(MouseMoveEvent* pMouseMoveEvent)
 
   if (pHoveredPrev != this->pHoveredEntry)
   {
-    mj::ThreadpoolSubmitTask(mj::ThreadpoolCreateTask<InvalidateRectTask>());
+    ::RequestRepaint();
   }
 }
 
@@ -519,9 +642,202 @@ void mj::DirectoryNavigationPanel::OnDoubleClick(int16_t x, int16_t y, uint16_t
   {
     if (pEntry->type == EEntryType::Directory)
     {
-      this->OpenSubFolder(pEntry->pName->ptr);
+      this->OpenSubFolder(*pEntry->pName);
+    }
+  }
+}
+
+/// <summary>
+/// Text with wildcards is a set of file patterns, see Glob. Anything else is a fuzzy query.
+/// </summary>
+static bool IsFilePattern(const mj::ArrayList<wchar_t>& text)
+{
+  for (wchar_t c : text)
+  {
+    if (c == L'*' || c == L'?' || c == L'[' || c == L';')
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/// <summary>
+/// Type to narrow the rows down to the best fuzzy matches, and press Enter to open the first one if it is a folder.
+/// Type a set of file patterns (see Glob), and press Enter to filter the files.
+/// Nothing is listed again while typing, half a pattern would hide most files anyway.
+/// Backspace removes the last character. Escape clears the text, or the filter if there is no text.
+/// </summary>
+void mj::DirectoryNavigationPanel::OnChar(int16_t x, int16_t y, wchar_t c)
+{
+  static_cast<void>(x);
+  static_cast<void>(y);
+
+  if (c == VK_RETURN)
+  {
+    if (!IsFilePattern(this->typedText))
+    {
+      Entry* pEntry = this->fuzzyActive && this->NumEntries() > 0 ? this->GetEntry(0) : nullptr;
+      if (pEntry && pEntry->type == EEntryType::Directory && pEntry->pName)
+      {
+        this->OpenSubFolder(*pEntry->pName);
+      }
+    }
+    else if (this->filterText.Copy(this->typedText))
+    {
+      this->typedText.Clear();
+      this->ApplyFileFilter();
+    }
+  }
+  else if (c == VK_ESCAPE)
+  {
+    if (this->typedText.Size() > 0)
+    {
+      this->typedText.Clear();
+    }
+    else if (this->filterText.Size() > 0)
+    {
+      this->filterText.Clear();
+      this->ApplyFileFilter();
+    }
+  }
+  else if (c == VK_BACK && this->typedText.Size() > 0)
+  {
+    this->typedText.Truncate(this->typedText.Size() - 1);
+  }
+  else if (c >= L' ')
+  {
+    // Dropped if we are out of memory
+    static_cast<void>(this->typedText.Add(c));
+  }
+
+  this->UpdateFuzzyQuery();
+}
+
+/// <summary>
+/// Starts narrowing the rows down to typedText, or shows all of them again.
+/// Typing at the end only scans the entries that matched before.
+/// </summary>
+void mj::DirectoryNavigationPanel::UpdateFuzzyQuery()
+{
+  const bool wasActive = this->fuzzyActive;
+  this->fuzzyActive    = this->typedText.Size() > 0 && !IsFilePattern(this->typedText);
+
+  if (!this->fuzzyActive)
+  {
+    this->fuzzyEntries.Clear();
+    if (!this->fuzzyFilter.IsBusy() && this->pFuzzySnapshot)
+    {
+      mj::ListingSnapshotRelease(this->pFuzzySnapshot);
+      this->pFuzzySnapshot  = nullptr;
+      this->fuzzyNamesStale = true;
+    }
+    if (wasActive)
+    {
+      this->mouseWheelAccumulator = 0;
+      this->scrollOffset          = 0;
+      this->pHoveredEntry         = nullptr;
+      this->BoostVisibleTextLayouts();
+      ::RequestRepaint();
+    }
+    return;
+  }
+
+  // New names must wait until the filter is done with the old ones, see OnFuzzyFilterDone
+  if (this->fuzzyNamesStale)
+  {
+    if (this->fuzzyFilter.IsBusy())
+    {
+      return;
+    }
+    this->SetFuzzyNames();
+  }
+
+  MJ_UNINITIALIZED StringView query;
+  query.Init(this->typedText.Get(), this->typedText.Size());
+  this->fuzzyFilter.SetQuery(query, FUZZY_MAX_ROWS);
+}
+
+/// <summary>
+/// Hands the names of all entries to the fuzzy filter. Call this while the filter is not busy.
+/// </summary>
+void mj::DirectoryNavigationPanel::SetFuzzyNames()
+{
+  ZoneScoped;
+
+  MJ_UNINITIALIZED StringView empty;
+  empty.Init(L"", 0);
+
+  this->fuzzyNames.Clear();
+  const size_t numEntries = this->NumListedEntries();
+  for (size_t i = 0; i < numEntries; i++)
+  {
+    const Entry* pEntry = this->GetListedEntry(i);
+    if (!this->fuzzyNames.Add(pEntry->pName ? *pEntry->pName : empty))
+    {
+      // Out of memory, the last entries cannot be found
+      break;
+    }
+  }
+
+  if (this->pFuzzySnapshot)
+  {
+    mj::ListingSnapshotRelease(this->pFuzzySnapshot);
+  }
+  this->pFuzzySnapshot = this->pSnapshot;
+  if (this->pFuzzySnapshot)
+  {
+    mj::ListingSnapshotAddRef(this->pFuzzySnapshot);
+  }
+
+  this->fuzzyFilter.SetNames(ArrayListView<const StringView>(this->fuzzyNames.Get(), this->fuzzyNames.Size()));
+  this->fuzzyNamesStale = false;
+}
+
+void mj::DirectoryNavigationPanel::OnFuzzyFilterDone(FuzzyFilter* pFilter)
+{
+  ZoneScoped;
+
+  // The results are for entries that are gone, or for a query that was cleared in the meantime
+  if (this->fuzzyNamesStale || !this->fuzzyActive)
+  {
+    this->UpdateFuzzyQuery();
+    return;
+  }
+
+  this->fuzzyEntries.Clear();
+  for (const FuzzyMatch& match : pFilter->Results())
+  {
+    if (!this->fuzzyEntries.Add(this->GetListedEntry(match.index)))
+    {
+      break;
     }
   }
+
+  this->mouseWheelAccumulator = 0;
+  this->scrollOffset          = 0;
+  this->pHoveredEntry         = nullptr;
+  this->BoostVisibleTextLayouts();
+  ::RequestRepaint();
+}
+
+/// <summary>
+/// Compiles filterText, and shows the folder again with it.
+/// A pending navigation is restarted for the same folder, so it is not undone.
+/// </summary>
+void mj::DirectoryNavigationPanel::ApplyFileFilter()
+{
+  // A pattern that does not compile leaves the filter empty, which shows all files
+  MJ_UNINITIALIZED StringView patterns;
+  patterns.Init(this->filterText.Get(), this->filterText.Size());
+  static_cast<void>(this->fileFilter.Compile(patterns));
+
+  // Cached listings are filtered right away, others are listed once more
+  if (this->pListFolderContentsTask || this->pendingFolder.Copy(this->breadcrumb))
+  {
+    this->OpenFolder();
+  }
 }
 
 void mj::DirectoryNavigationPanel::OnMouseWheel(int16_t x, int16_t y, uint16_t mkMask, int16_t zDelta)
@@ -553,7 +869,7 @@ void mj::DirectoryNavigationPanel::OnMouseWheel(int16_t x, int16_t y, uint16_t m
   if (diff != 0)
   {
     this->scrollOffset += diff;
-    int32_t pixelHeight = static_cast<int32_t>(this->entries.Size()) * this->entryHeight;
+    int32_t pixelHeight = static_cast<int32_t>(this->NumEntries()) * this->entryHeight;
     if (this->scrollOffset > 0 || pixelHeight < this->height)
     {
       this->scrollOffset = 0;
@@ -563,7 +879,100 @@ void mj::DirectoryNavigationPanel::OnMouseWheel(int16_t x, int16_t y, uint16_t m
       this->scrollOffset = this->height - pixelHeight;
     }
 
-    mj::ThreadpoolSubmitTask(mj::ThreadpoolCreateTask<InvalidateRectTask>());
+    this->BoostVisibleTextLayouts();
+    ::RequestRepaint();
+  }
+}
+
+/// <summary>
+/// Shows the shell context menu of a folder. The menu is filled on an I/O thread, as QueryContextMenu can take
+/// hundreds of milliseconds. If the token is cancelled before the menu is shown, the coroutine is destroyed
+/// where it waits, and the deferred calls clean up.
+/// </summary>
+static mj::Async ShowFolderContextMenu(mj::StringView folder, int16_t screenX, int16_t screenY,
+                                       mj::CancellationToken token)
+{
+  // The caller's string is gone after the first suspension
+  mj::ArrayList<wchar_t> al;
+  al.Init(svc::GeneralPurposeAllocator());
+  MJ_DEFER(al.Destroy());
+  mj::StringBuilder sb;
+  sb.SetArrayList(&al);
+  const mj::StringView path = sb.Append(folder).ToStringClosed();
+
+  co_await mj::ResumeOnThreadpool{ mj::ETaskPriority::Interactive, mj::ETaskKind::Io, token };
+
+  MJ_UNINITIALIZED IShellFolder* pDesktop;
+  MJ_ERR_HRESULT(::SHGetDesktopFolder(&pDesktop));
+  MJ_DEFER(pDesktop->Release());
+
+  MJ_UNINITIALIZED PIDLIST_RELATIVE pidl;
+  MJ_ERR_HRESULT(pDesktop->ParseDisplayName(nullptr,                        //
+                                            nullptr,                        //
+                                            const_cast<wchar_t*>(path.ptr), // Why is this not const?
+                                            nullptr,                        //
+                                            &pidl,                          //
+                                            nullptr));
+  MJ_DEFER(::CoTaskMemFree(pidl));
+
+  MJ_UNINITIALIZED IContextMenu* pContextMenu;
+  MJ_ERR_HRESULT(pDesktop->GetUIObjectOf(nullptr,                                        //
+                                         1,                                              //
+                                         reinterpret_cast<PCUITEMID_CHILD_ARRAY>(&pidl), //
+                                         IID_IContextMenu,                               //
+                                         nullptr,                                        //
+                                         reinterpret_cast<void**>(&pContextMenu)));
+  MJ_DEFER(pContextMenu->Release());
+
+  MJ_UNINITIALIZED HMENU pMenu;
+  MJ_ERR_IF(pMenu = ::CreatePopupMenu(), nullptr);
+  MJ_DEFER(::DestroyMenu(pMenu));
+
+  // Fill context menu
+  {
+    // Slow operation (100s of milliseconds), but part of critical path
+    ZoneScopedN("QueryContextMenu");
+
+    // If successful, returns an HRESULT value that has its severity value set to SEVERITY_SUCCESS and its code
+    // value set to the offset of the largest command identifier that was assigned, plus one. For example, if
+    // idCmdFirst is set to 5 and you add three items to the menu with command identifiers of 5, 7, and 8, the
+    // return value should be MAKE_HRESULT(SEVERITY_SUCCESS, 0, 8 - 5 + 1). Otherwise, it returns a COM error
+    // value.
+    static_cast<void>(pContextMenu->QueryContextMenu(pMenu, 0, 1, 0x7fff, CMF_NORMAL | CMF_EXPLORE));
+  }
+
+  co_await mj::ResumeOnMainThread{ token };
+
+  // This is one of those instances where a BOOL can have many values
+  MJ_UNINITIALIZED BOOL cmd;
+  {
+    // Blocking until popup menu is closed
+    ZoneScopedN("TrackPopupMenu");
+
+    // If you specify TPM_RETURNCMD in the uFlags parameter, the return value is the menu-item identifier of the
+    // item that the user selected. If the user cancels the menu without making a selection, or if an error
+    // occurs, the return value is zero. If you do not specify TPM_RETURNCMD in the uFlags parameter, the return
+    // value is nonzero if the function succeeds and zero if it fails. To get extended error information, call
+    // GetLastError.
+    cmd = ::TrackPopupMenu(pMenu,                   //
+                           TPM_RETURNCMD,           //
+                           screenX,                 //
+                           screenY,                 //
+                           0,                       //
+                           svc::MainWindowHandle(), //
+                           nullptr);
+  }
+
+  if (cmd)
+  {
+    CMINVOKECOMMANDINFOEX info = {};
+    info.cbSize                = sizeof(info);
+    info.fMask                 = CMIC_MASK_UNICODE;
+    info.hwnd                  = svc::MainWindowHandle();
+    info.lpVerb                = MAKEINTRESOURCEA(cmd - 1);
+    info.lpVerbW               = MAKEINTRESOURCEW(cmd - 1);
+    info.nShow                 = SW_SHOWNORMAL;
+    MJ_ERR_HRESULT(pContextMenu->InvokeCommand(reinterpret_cast<LPCMINVOKECOMMANDINFO>(&info)));
   }
 }
 
@@ -576,84 +985,23 @@ void mj::DirectoryNavigationPanel::OnContextMenu(int16_t clientX, int16_t client
     {
       ZoneScoped;
 
-      MJ_UNINITIALIZED IShellFolder* pDesktop;
-      MJ_ERR_HRESULT(::SHGetDesktopFolder(&pDesktop));
-      MJ_DEFER(pDesktop->Release());
-
-      StringView* pLast = this->breadcrumb.Last();
-      if (pLast)
+      if (this->breadcrumb.NumComponents() > 0)
       {
-        this->sbOpenFolder.Clear();
-        this->sbOpenFolder.Append(*pLast);
-        this->sbOpenFolder.Append(L"\\");
-        this->sbOpenFolder.Append(*pEntry->pName);
-
-        auto path = this->sbOpenFolder.ToStringClosed();
-        MJ_UNINITIALIZED PIDLIST_RELATIVE pidl;
-        MJ_ERR_HRESULT(pDesktop->ParseDisplayName(nullptr,                        //
-                                                  nullptr,                        //
-                                                  const_cast<wchar_t*>(path.ptr), // Why is this not const?
-                                                  nullptr,                        //
-                                                  &pidl,                          //
-                                                  nullptr));
-        MJ_DEFER(::CoTaskMemFree(pidl));
-
-        MJ_UNINITIALIZED IContextMenu* pContextMenu;
-        MJ_ERR_HRESULT(pDesktop->GetUIObjectOf(nullptr,                                        //
-                                               1,                                              //
-                                               reinterpret_cast<PCUITEMID_CHILD_ARRAY>(&pidl), //
-                                               IID_IContextMenu,                               //
-                                               nullptr,                                        //
-                                               reinterpret_cast<void**>(&pContextMenu)));
-
-        MJ_UNINITIALIZED HMENU pMenu;
-        MJ_ERR_IF(pMenu = ::CreatePopupMenu(), nullptr);
-        MJ_DEFER(::DestroyMenu(pMenu));
-
-        // Fill context menu
-        {
-          // Slow operation (100s of milliseconds), but part of critical path
-          ZoneScopedN("QueryContextMenu");
-
-          // If successful, returns an HRESULT value that has its severity value set to SEVERITY_SUCCESS and its code
-          // value set to the offset of the largest command identifier that was assigned, plus one. For example, if
-          // idCmdFirst is set to 5 and you add three items to the menu with command identifiers of 5, 7, and 8, the
-          // return value should be MAKE_HRESULT(SEVERITY_SUCCESS, 0, 8 - 5 + 1). Otherwise, it returns a COM error
-          // value.
-          static_cast<void>(pContextMenu->QueryContextMenu(pMenu, 0, 1, 0x7fff, CMF_NORMAL | CMF_EXPLORE));
-        }
-
-        // This is one of those instances where a BOOL can have many values
-        MJ_UNINITIALIZED BOOL cmd;
-        {
-          // Blocking until popup menu is closed
-          ZoneScopedN("TrackPopupMenu");
-
-          // If you specify TPM_RETURNCMD in the uFlags parameter, the return value is the menu-item identifier of the
-          // item that the user selected. If the user cancels the menu without making a selection, or if an error
-          // occurs, the return value is zero. If you do not specify TPM_RETURNCMD in the uFlags parameter, the return
-          // value is nonzero if the function succeeds and zero if it fails. To get extended error information, call
-          // GetLastError.
-          cmd = ::TrackPopupMenu(pMenu,                   //
-                                 TPM_RETURNCMD,           //
-                                 screenX,                 //
-                                 screenY,                 //
-                                 0,                       //
-                                 svc::MainWindowHandle(), //
-                                 nullptr);
-        }
-
-        if (cmd)
-        {
-          CMINVOKECOMMANDINFOEX info = {};
-          info.cbSize                = sizeof(info);
-          info.fMask                 = CMIC_MASK_UNICODE;
-          info.hwnd                  = svc::MainWindowHandle();
-          info.lpVerb                = MAKEINTRESOURCEA(cmd - 1);
-          info.lpVerbW               = MAKEINTRESOURCEW(cmd - 1);
-          info.nShow                 = SW_SHOWNORMAL;
-          MJ_ERR_HRESULT(pContextMenu->InvokeCommand(reinterpret_cast<LPCMINVOKECOMMANDINFO>(&info)));
-        }
+        // Do not touch sbOpenFolder here, a running ListFolderContentsTask may point into it
+        ArrayList<wchar_t> al;
+        al.Init(this->pAllocator);
+        MJ_DEFER(al.Destroy());
+        StringBuilder sb;
+        sb.SetArrayList(&al);
+
+        auto path = sb.Append(this->breadcrumb.ToStringView()) //
+                        .Append(L"\\")                         //
+                        .Append(*pEntry->pName)                //
+                        .ToStringClosed();
+
+        // A menu that is still being filled is dropped, as is one for a folder we navigated away from
+        this->contextMenuCancellation.Cancel();
+        static_cast<void>(::ShowFolderContextMenu(path, screenX, screenY, this->contextMenuCancellation.Token()));
       }
     }
   }
@@ -663,6 +1011,7 @@ void mj::DirectoryNavigationPanel::OnSize()
 {
   this->mouseWheelAccumulator = 0;
   this->scrollOffset          = 0;
+  this->BoostVisibleTextLayouts();
 }
 
 void mj::DirectoryNavigationPanel::OnEverythingQuery()
@@ -671,35 +1020,172 @@ void mj::DirectoryNavigationPanel::OnEverythingQuery()
   this->CheckEverythingQueryPrerequisites();
 }
 
-void mj::DirectoryNavigationPanel::OnListFolderContentsDone(detail::ListFolderContentsTask* pTask)
+void mj::DirectoryNavigationPanel::OnListFolderContentsChunk(detail::ListFolderChunkTask* pChunk)
 {
-  if (pTask->status == 0 &&                                              //
-      this->listFolderContentsTaskResult.files.Copy(pTask->files) &&     //
-      this->listFolderContentsTaskResult.folders.Copy(pTask->folders) && //
-      this->listFolderContentsTaskResult.stringCache.Copy(pTask->stringCache))
+  ZoneScoped;
+
+  if (!this->listingHasChunks)
+  {
+    // The new folder replaces the old one as soon as there is something to show
+    this->listingHasChunks = true;
+    this->ShowPendingFolder();
+
+    MJ_UNINITIALIZED LARGE_INTEGER now;
+    MJ_UNINITIALIZED LARGE_INTEGER frequency;
+    static_cast<void>(::QueryPerformanceCounter(&now));
+    static_cast<void>(::QueryPerformanceFrequency(&frequency));
+    TracyPlot("Time to first row (ms)",
+              static_cast<double>(now.QuadPart - this->listingStartTime.QuadPart) * 1000.0 / frequency.QuadPart);
+  }
+
+  // Names are copied, the chunk frees its own when it ends
+  if (!this->AddEntries(EEntryType::Directory, pChunk->folders, pChunk->stringCache) ||
+      !this->AddEntries(EEntryType::File, pChunk->files, pChunk->stringCache))
+  {
+    this->snapshotIncomplete = true;
+  }
+
+  // TODO: Start icon tasks if preconditions are met
+  this->BoostVisibleTextLayouts();
+  ::RequestRepaint();
+
+  // Rows typed for before the rest of the folder arrived
+  if (this->fuzzyActive)
   {
-    // FIXME: This can trigger a reallocation so if we use the breadcrumb elsewhere we're screwed
-    StringView str = this->sbOpenFolder.ToStringOpen();
-    str.Init(str.ptr, str.FindLastOf(L"\\*"));
+    this->UpdateFuzzyQuery();
+  }
+}
 
-    this->breadcrumb.Add(str);
+void mj::DirectoryNavigationPanel::OnListFolderContentsDone(detail::ListFolderContentsTask* pTask)
+{
+  if (pTask->status == 0)
+  {
+    // An empty folder sends no chunks
+    if (!this->listingHasChunks)
+    {
+      this->ShowPendingFolder();
+      ::RequestRepaint();
+    }
 
-    // TODO: Start icon, TextFormat tasks if preconditions are met
-    // this->TryLoadFolderContentIcons();
-    this->TryCreateFolderContentTextLayouts();
+    if (pTask->fileFilter.len == 0 && this->pSnapshot && !this->snapshotIncomplete &&
+        mj::ListingSnapshotFinish(this->pSnapshot, this->folderEntries.Size(), this->fileEntries.Size()))
+    {
+      for (size_t i = 0; i < this->folderEntries.Size(); i++)
+      {
+        this->pSnapshot->pFolders[i] = *this->folderEntries[i]->pName;
+      }
+      for (size_t i = 0; i < this->fileEntries.Size(); i++)
+      {
+        this->pSnapshot->pFiles[i] = *this->fileEntries[i]->pName;
+      }
+      mj::ListingCachePublish(pTask->watch, this->pSnapshot);
+    }
   }
   this->pListFolderContentsTask = nullptr;
 }
 
+/// <summary>
+/// Replaces the current folder with the pending one, without any entries yet.
+/// </summary>
+void mj::DirectoryNavigationPanel::ShowPendingFolder()
+{
+  static_cast<void>(this->breadcrumb.Copy(this->pendingFolder));
+  this->contextMenuCancellation.Cancel();
+  this->ClearEntries();
+  this->typedText.Clear();
+  this->UpdateFuzzyQuery();
+  this->mouseWheelAccumulator = 0;
+  this->scrollOffset          = 0;
+  this->pSnapshot             = mj::ListingSnapshotCreate();
+  this->snapshotIncomplete    = false;
+}
+
+/// <summary>
+/// Shows a cached listing right away, filtered. Takes over the reference.
+/// </summary>
+void mj::DirectoryNavigationPanel::ShowSnapshot(ListingSnapshot* pCachedSnapshot)
+{
+  ZoneScoped;
+
+  this->ShowPendingFolder();
+  if (this->pSnapshot)
+  {
+    mj::ListingSnapshotRelease(this->pSnapshot);
+  }
+  this->pSnapshot = pCachedSnapshot;
+
+  for (size_t i = 0; i < pCachedSnapshot->numFolders; i++)
+  {
+    static_cast<void>(this->AddEntry(EEntryType::Directory, &pCachedSnapshot->pFolders[i]));
+  }
+
+  const StringView* pFiles = pCachedSnapshot->pFiles;
+  const size_t numFiles    = pCachedSnapshot->numFiles;
+
+  ArrayList<bool> matched;
+  matched.Init(this->pAllocator);
+  MJ_DEFER(matched.Destroy());
+  ArrayList<uint32_t> matches;
+  matches.Init(this->pAllocator);
+  MJ_DEFER(matches.Destroy());
+
+  bool* pMatched = nullptr;
+  if (numFiles >= FILTER_PARALLEL_MIN_FILES && !this->fileFilter.IsEmpty())
+  {
+    pMatched = matched.Emplace(numFiles);
+  }
+
+  if (pMatched)
+  {
+    // Subranges are matched on all threads, then the rows are added in order
+    const Glob& fileFilter = this->fileFilter;
+    mj::ParallelFor(0, numFiles, FILTER_GRAIN, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++)
+      {
+        pMatched[i] = fileFilter.Matches(pFiles[i]);
+      }
+    });
+
+    for (size_t i = 0; i < numFiles; i++)
+    {
+      if (pMatched[i])
+      {
+        static_cast<void>(this->AddEntry(EEntryType::File, &pCachedSnapshot->pFiles[i]));
+      }
+    }
+  }
+  else if (this->fileFilter.Filter(ArrayListView<const StringView>(pFiles, numFiles), matches))
+  {
+    for (uint32_t i : matches)
+    {
+      static_cast<void>(this->AddEntry(EEntryType::File, &pCachedSnapshot->pFiles[i]));
+    }
+  }
+  else
+  {
+    // Out of memory, match them one by one
+    for (size_t i = 0; i < pCachedSnapshot->numFiles; i++)
+    {
+      if (this->fileFilter.Matches(pCachedSnapshot->pFiles[i]))
+      {
+        static_cast<void>(this->AddEntry(EEntryType::File, &pCachedSnapshot->pFiles[i]));
+      }
+    }
+  }
+
+  this->BoostVisibleTextLayouts();
+  ::RequestRepaint();
+}
+
 void mj::detail::CreateTextLayoutTask::Execute()
 {
   ZoneScoped;
 
-  MJ_ERR_HRESULT(svc::DWriteFactory()->CreateTextLayout(this->pEntry->pName->ptr,                      //
-                                                        static_cast<UINT32>(this->pEntry->pName->len), //
-                                                        pParent->pTextFormat,                          //
-                                                        1024.0f,                                       //
-                                                        1024.0f,                                       //
+  MJ_ERR_HRESULT(svc::DWriteFactory()->CreateTextLayout(this->name.ptr,                      //
+                                                        static_cast<UINT32>(this->name.len), //
+                                                        this->pTextFormat,                   //
+                                                        1024.0f,                             //
+                                                        1024.0f,                             //
                                                         &this->pTextLayout));
 
   // FIXME: If this task is slow, InvalidateRect does not show everything...
@@ -715,75 +1201,165 @@ void mj::detail::CreateTextLayoutTask::OnDone()
 
 void mj::detail::CreateTextLayoutTask::Destroy()
 {
-  this->pTextLayout->Release();
+  // Not set if the task was cancelled before it started
+  MJ_SAFE_RELEASE(this->pTextLayout);
+  MJ_SAFE_RELEASE(this->pTextFormat);
+  if (this->pSnapshot)
+  {
+    mj::ListingSnapshotRelease(this->pSnapshot);
+  }
 }
 
 void mj::DirectoryNavigationPanel::SetTextLayout(mj::Entry* pEntry, IDWriteTextLayout* pTextLayout)
 {
-  pEntry->pTextLayout = pTextLayout;
+  pEntry->pTextLayout     = pTextLayout;
+  pEntry->pTextLayoutTask = nullptr;
+
+  // Layouts arrive in batches, which still results in a single WM_PAINT
+  ::RequestRepaint();
+}
+
+size_t mj::DirectoryNavigationPanel::NumEntries() const
+{
+  return this->fuzzyActive ? this->fuzzyEntries.Size() : this->NumListedEntries();
+}
+
+mj::Entry* mj::DirectoryNavigationPanel::GetEntry(size_t row)
+{
+  return this->fuzzyActive ? this->fuzzyEntries[row] : this->GetListedEntry(row);
+}
+
+/// <summary>
+/// All entries, including the ones that are filtered out while typing
+/// </summary>
+size_t mj::DirectoryNavigationPanel::NumListedEntries() const
+{
+  return this->folderEntries.Size() + this->fileEntries.Size();
+}
+
+mj::Entry* mj::DirectoryNavigationPanel::GetListedEntry(size_t index)
+{
+  return index < this->folderEntries.Size() ? this->folderEntries[index]
+                                            : this->fileEntries[index - this->folderEntries.Size()];
+}
+
+/// <summary>
+/// Appends a row, and starts creating its text layout if it has a name.
+/// </summary>
+/// <param name="pName">Optional. Must belong to the current snapshot.</param>
+/// <returns>nullptr if we are out of memory</returns>
+mj::Entry* mj::DirectoryNavigationPanel::AddEntry(EEntryType::Enum type, StringView* pName)
+{
+  Entry* pEntry = static_cast<Entry*>(this->pEntryArena->Allocate(sizeof(Entry)));
+  if (!pEntry)
+  {
+    return nullptr;
+  }
+
+  ArrayList<Entry*>& rows = type == EEntryType::Directory ? this->folderEntries : this->fileEntries;
+  if (!rows.Add(pEntry))
+  {
+    return nullptr;
+  }
+  this->fuzzyNamesStale = true;
+
+  *pEntry       = {};
+  pEntry->type  = type;
+  pEntry->pName = pName;
+  pEntry->pIcon = type == EEntryType::Directory ? res::d2d1::FolderIcon() : res::d2d1::FileIcon();
 
-  if (++this->numEntriesDoneLoading == this->entries.Size())
+  // Skipping the check for DWrite because our TextFormat already depends on it.
+  if (pName && this->pTextFormat)
   {
-    this->scrollOffset = 0;
-    mj::ThreadpoolSubmitTask(mj::ThreadpoolCreateTask<InvalidateRectTask>());
+    auto pTask = mj::ThreadpoolCreateTask<mj::detail::CreateTextLayoutTask>();
+    if (pTask)
+    {
+      pTask->pParent          = this;
+      pTask->pEntry           = pEntry;
+      pTask->name             = *pName;
+      pTask->pSnapshot        = this->pSnapshot;
+      pTask->pTextFormat      = this->pTextFormat;
+      pTask->pTextLayout      = nullptr;
+      pTask->token            = this->textLayoutCancellation.Token();
+      pTask->priority         = ETaskPriority::Prefetch;
+      pEntry->pTextLayoutTask = pTask;
+      pTask->pTextFormat->AddRef();
+      if (pTask->pSnapshot)
+      {
+        mj::ListingSnapshotAddRef(pTask->pSnapshot);
+      }
+      mj::ThreadpoolSubmitTask(pTask);
+    }
   }
+
+  return pEntry;
 }
 
-void mj::DirectoryNavigationPanel::TryCreateFolderContentTextLayouts()
+/// <summary>
+/// Copies the names into the snapshot, as the string cache goes away with its chunk.
+/// </summary>
+/// <returns>False if we are out of memory</returns>
+bool mj::DirectoryNavigationPanel::AddEntries(EEntryType::Enum type, const ArrayList<size_t>& indices,
+                                              StringCache& stringCache)
 {
   ZoneScoped;
 
-  // Note: If the folder is empty, we do nothing.
-  // This is okay if we don't want to render anything, but this could change.
-  auto numItems = this->listFolderContentsTaskResult.stringCache.Size();
+  if (!this->pSnapshot)
+  {
+    return false;
+  }
 
-  // Skipping the check for DWrite because our TextFormat already depends on it.
-  if (numItems > 0 && this->pTextFormat)
+  for (size_t index : indices)
   {
-    this->ClearEntries();
-    this->pHoveredEntry = nullptr;
-    if (this->entries.Emplace(numItems))
+    StringView* pName = mj::ListingSnapshotAddName(this->pSnapshot, *stringCache[index]);
+    if (!pName || !this->AddEntry(type, pName))
     {
-      // Variable number of tasks with the same cancellation token
-      this->numEntriesDoneLoading = 0;
+      return false;
+    }
+  }
 
-      // Folders
-      for (auto i = 0; i < this->listFolderContentsTaskResult.folders.Size(); i++)
-      {
-        auto& entry = this->entries[i];
-        entry       = {};
-        entry.type  = EEntryType::Directory;
-        entry.pName = this->listFolderContentsTaskResult.stringCache[this->listFolderContentsTaskResult.folders[i]];
-        entry.pIcon = res::d2d1::FolderIcon();
+  return true;
+}
 
-        auto pTask     = mj::ThreadpoolCreateTask<mj::detail::CreateTextLayoutTask>();
-        pTask->pParent = this;
-        pTask->pEntry  = &entry;
-        mj::ThreadpoolSubmitTask(pTask);
-      }
+/// <summary>
+/// Text layout tasks are submitted as prefetch work. Moves the ones in the viewport to the front.
+/// </summary>
+void mj::DirectoryNavigationPanel::BoostVisibleTextLayouts()
+{
+  ZoneScoped;
 
-      // Files
-      for (auto i = 0; i < this->listFolderContentsTaskResult.files.Size(); i++)
-      {
-        auto& entry = this->entries[i + this->listFolderContentsTaskResult.folders.Size()];
-        entry       = {};
-        entry.type  = EEntryType::File;
-        entry.pName = this->listFolderContentsTaskResult.stringCache[this->listFolderContentsTaskResult.files[i]];
-        entry.pIcon = res::d2d1::FileIcon();
-
-        auto pTask     = mj::ThreadpoolCreateTask<mj::detail::CreateTextLayoutTask>();
-        pTask->pParent = this;
-        pTask->pEntry  = &entry;
-        mj::ThreadpoolSubmitTask(pTask);
-      }
+  // Row i is drawn at scrollOffset + (i + 1) * entryHeight, below the breadcrumb
+  int32_t first = -this->scrollOffset / this->entryHeight - 1;
+  int32_t last  = (this->height - this->scrollOffset) / this->entryHeight;
+  if (first < 0)
+  {
+    first = 0;
+  }
+  if (last > static_cast<int32_t>(this->NumEntries()))
+  {
+    last = static_cast<int32_t>(this->NumEntries());
+  }
+
+  for (int32_t i = first; i < last; i++)
+  {
+    mj::Entry& entry = *this->GetEntry(i);
+    if (entry.pTextLayoutTask)
+    {
+      mj::ThreadpoolSetTaskPriority(entry.pTextLayoutTask, ETaskPriority::Visible);
     }
   }
 }
 
 void mj::DirectoryNavigationPanel::ClearEntries()
 {
-  for (auto& element : this->entries)
+  // Queued text layout tasks go away now. Running ones only touch the entries in OnDone, which they skip.
+  this->textLayoutCancellation.Cancel();
+  mj::ThreadpoolPurgeCancelledTasks();
+
+  for (size_t i = 0; i < this->NumListedEntries(); i++)
   {
+    Entry& element = *this->GetListedEntry(i);
+
     // Only release if icon exists and is not a shared icon
     if (element.pIcon && element.pIcon != res::d2d1::FolderIcon() && element.pIcon != res::d2d1::FileIcon())
     {
@@ -794,7 +1370,19 @@ void mj::DirectoryNavigationPanel::ClearEntries()
       element.pTextLayout->Release();
     }
   }
-  this->entries.Clear();
+  this->folderEntries.Clear();
+  this->fileEntries.Clear();
+  this->fuzzyEntries.Clear();
+  this->fuzzyNamesStale = true;
+  this->pEntryArena->Reset();
+  this->pHoveredEntry = nullptr;
+
+  // Other panels, the listing cache and running text layout tasks may still hold it
+  if (this->pSnapshot)
+  {
+    mj::ListingSnapshotRelease(this->pSnapshot);
+    this->pSnapshot = nullptr;
+  }
 }
 
 void mj::DirectoryNavigationPanel::OnIDWriteFactoryAvailable(IDWriteFactory* pFactory)
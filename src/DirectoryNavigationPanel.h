@@ -2,8 +2,13 @@
 #include "Control.h"
 #include "mj_common.h"
 #include "mj_string.h"
+#include "mj_path.h"
+#include "mj_glob.h"
+#include "mj_fuzzy.h"
 #include "ServiceLocator.h"
 #include "Threadpool.h"
+#include "mj_arena.h"
+#include "mj_listingcache.h"
 #include <d2d1_1.h>
 #include "ResourcesD2D1.h"
 
@@ -24,11 +29,13 @@ namespace mj
     IDWriteTextLayout* pTextLayout;
     ID2D1Bitmap* pIcon;
     StringView* pName;
+    Task* pTextLayoutTask; // Until the text layout arrives
   };
 
   namespace detail
   {
     struct ListFolderContentsTask;
+    struct ListFolderChunkTask;
     struct CreateTextLayoutTask;
     struct LoadFolderIconTask;
     struct LoadFileIconTask;
@@ -37,34 +44,12 @@ namespace mj
 
   class DirectoryNavigationPanel : public Control,                     //
                                    public svc::IDWriteFactoryObserver, //
-                                   public res::d2d1::BitmapObserver
+                                   public res::d2d1::BitmapObserver,   //
+                                   public IFuzzyFilterHandler
   {
   private:
-    class Breadcrumb
-    {
-    private:
-      StringCache breadcrumb;
-
-    public:
-      /// <summary>
-      /// Does no allocation on construction.
-      /// </summary>
-      /// <returns></returns>
-      void Init(AllocatorBase* pAllocator);
-
-      /// <summary>
-      /// Data is freed using the assigned allocator.
-      /// </summary>
-      void Destroy();
-
-      bool Add(const wchar_t* pStringLiteral);
-
-      bool Add(const StringView& string);
-
-      StringView* Last();
-    };
-
     friend struct detail::ListFolderContentsTask;
+    friend struct detail::ListFolderChunkTask;
     friend struct detail::CreateTextLayoutTask;
     friend struct detail::LoadFolderIconTask;
     friend struct detail::LoadFileIconTask;
@@ -79,17 +64,78 @@ namespace mj
     /// </summary>
     IDWriteTextLayout* pCurrentFolderTextLayout = nullptr;
     const Entry* pHoveredEntry                  = nullptr;
-    Breadcrumb breadcrumb;
+
+    /// <summary>
+    /// The folder that is currently displayed
+    /// </summary>
+    Path breadcrumb;
+
+    /// <summary>
+    /// The folder that is being listed. Replaces the breadcrumb once listing succeeds.
+    /// </summary>
+    Path pendingFolder;
 
     // Open folder
     ArrayList<wchar_t> alOpenFolder;
     StringBuilder sbOpenFolder;
 
+    /// <summary>
+    /// Typed into the panel. Narrows the rows while typing, or is applied as the file filter on Enter, see OnChar.
+    /// </summary>
+    ArrayList<wchar_t> typedText;
+
+    /// <summary>
+    /// Narrows the rows to the entries that match typedText, best match first.
+    /// </summary>
+    FuzzyFilter fuzzyFilter;
+
+    /// <summary>
+    /// Names of all entries as passed to fuzzyFilter, folders first. Holds a reference to their snapshot,
+    /// as the filter may still be scanning them after the entries are cleared.
+    /// </summary>
+    ArrayList<StringView> fuzzyNames;
+    ListingSnapshot* pFuzzySnapshot = nullptr;
+    bool fuzzyNamesStale            = true; // Entries were added or cleared since fuzzyNames was filled
+
+    /// <summary>
+    /// Rows in display order while typedText narrows them
+    /// </summary>
+    bool fuzzyActive = false;
+    ArrayList<Entry*> fuzzyEntries;
+
+    /// <summary>
+    /// File patterns of the current listing, e.g. "*.cpp;*.h". Empty by default.
+    /// </summary>
+    ArrayList<wchar_t> filterText;
+
+    /// <summary>
+    /// Compiled from filterText. Files that do not match are not shown. Folders always are.
+    /// Empty by default, which shows all files.
+    /// Main thread only, listings compile their own.
+    /// </summary>
+    Glob fileFilter;
+
     MJ_UNINITIALIZED D2D1_RECT_F highlightRect;
 
     AllocatorBase* pAllocator = nullptr;
-    ArrayList<Entry> entries;
-    int32_t numEntriesDoneLoading = 0;
+
+    /// <summary>
+    /// Entries do not move once allocated, so tasks can point to them while more arrive.
+    /// </summary>
+    ArenaAllocator* pEntryArena = nullptr;
+
+    /// <summary>
+    /// Names of the entries. Filled in while a listing streams in, then shared through the listing cache.
+    /// </summary>
+    ListingSnapshot* pSnapshot = nullptr;
+    bool snapshotIncomplete    = false; // Not published if entries were dropped
+
+    /// <summary>
+    /// Rows in display order: all folders, then all files, each in the order they were listed.
+    /// See fuzzyEntries for the rows while typing.
+    /// </summary>
+    ArrayList<Entry*> folderEntries;
+    ArrayList<Entry*> fileEntries;
     Allocation searchBuffer;
     Allocation resultsBuffer;
 
@@ -97,15 +143,29 @@ namespace mj
     int16_t mouseWheelAccumulator = 0;
     int32_t scrollOffset          = 0;
 
-    // ListFolderContentsTask results
-    struct
-    {
-      mj::ArrayList<size_t> folders;
-      mj::ArrayList<size_t> files;
-      mj::StringCache stringCache;
-    } listFolderContentsTaskResult;
     detail::ListFolderContentsTask* pListFolderContentsTask = nullptr;
 
+    /// <summary>
+    /// Cancels the listing in flight, and the chunks it sent that have not arrived yet
+    /// </summary>
+    CancellationSource listingCancellation;
+
+    /// <summary>
+    /// The first chunk of a listing replaces the entries of the previous folder
+    /// </summary>
+    bool listingHasChunks = false;
+    MJ_UNINITIALIZED LARGE_INTEGER listingStartTime;
+
+    /// <summary>
+    /// Cancels all CreateTextLayoutTasks of the previous listing
+    /// </summary>
+    CancellationSource textLayoutCancellation;
+
+    /// <summary>
+    /// Drops a context menu that has not been shown yet, see OnContextMenu
+    /// </summary>
+    CancellationSource contextMenuCancellation;
+
     /// <summary>
     /// Dumb flag variable to check if the Everything query is done
     /// </summary>
@@ -113,15 +173,27 @@ namespace mj
 
     ID2D1Bitmap* ConvertIcon(HICON hIcon);
     void CheckEverythingQueryPrerequisites();
-    void TryCreateFolderContentTextLayouts();
+    Entry* AddEntry(EEntryType::Enum type, StringView* pName);
+    bool AddEntries(EEntryType::Enum type, const ArrayList<size_t>& indices, StringCache& stringCache);
+    void ShowPendingFolder();
+    void ShowSnapshot(ListingSnapshot* pCachedSnapshot);
+    size_t NumEntries() const;
+    Entry* GetEntry(size_t row);
+    size_t NumListedEntries() const;
+    Entry* GetListedEntry(size_t index);
+    void BoostVisibleTextLayouts();
     void SetTextLayout(Entry* pEntry, IDWriteTextLayout* pTextLayout);
     void ClearEntries();
     mj::Entry* TestMouseEntry(int16_t x, int16_t y, RECT* pRect);
-    void OpenSubFolder(const wchar_t* pFolder);
+    void OpenSubFolder(const StringView& folder);
     void OpenFolder();
+    void ApplyFileFilter();
+    void UpdateFuzzyQuery();
+    void SetFuzzyNames();
 
     // Event callbacks
     void OnEverythingQuery();
+    void OnListFolderContentsChunk(detail::ListFolderChunkTask* pChunk);
     void OnListFolderContentsDone(detail::ListFolderContentsTask* pTask);
 
     static constexpr const int16_t entryHeight = 21;
@@ -139,42 +211,71 @@ namespace mj
     virtual void OnDoubleClick(int16_t x, int16_t y, uint16_t mkMask) override;
     virtual void OnMouseWheel(int16_t x, int16_t y, uint16_t mkMask, int16_t zDelta) override;
     virtual void OnContextMenu(int16_t clientX, int16_t clientY, int16_t screenX, int16_t screenY) override;
+    virtual void OnChar(int16_t x, int16_t y, wchar_t c) override;
     virtual void OnSize() override;
 
     virtual void OnIDWriteFactoryAvailable(IDWriteFactory* pFactory) override;
     virtual void OnIconBitmapAvailable(ID2D1Bitmap* pIconBitmap, WORD resource) override;
+    virtual void OnFuzzyFilterDone(FuzzyFilter* pFilter) override;
   };
 
   namespace detail
   {
+    /// <summary>
+    /// Sends entries to the panel in chunks while it enumerates, so the first rows show up right away.
+    /// Chunks arrive in order, and all of them arrive before OnDone.
+    /// </summary>
     struct ListFolderContentsTask : public mj::Task
     {
       // In
       MJ_UNINITIALIZED mj::DirectoryNavigationPanel* pParent;
       MJ_UNINITIALIZED mj::StringView directory;
+      MJ_UNINITIALIZED mj::StringView fileFilter; // Optional patterns, matched against file names only. Owned.
 
       // Out
       MJ_UNINITIALIZED HRESULT status;
+      MJ_UNINITIALIZED mj::ListingCacheHandle watch; // Zero if the folder is not watched
+
+      virtual void Execute() override;
+      virtual void OnDone() override;
+      virtual void Destroy() override;
+
+    private:
+      MJ_UNINITIALIZED ListFolderChunkTask* pChunk; // Being filled
+      MJ_UNINITIALIZED LARGE_INTEGER chunkDeadline;
+
+      bool StartChunk();
+      void SendChunk();
+    };
+
+    /// <summary>
+    /// Part of a listing. Runs on the main thread, and is cancelled together with its listing.
+    /// </summary>
+    struct ListFolderChunkTask : public mj::Task
+    {
+      MJ_UNINITIALIZED mj::DirectoryNavigationPanel* pParent;
+
+      // Indices into the string cache
       mj::ArrayList<size_t> folders;
       mj::ArrayList<size_t> files;
       mj::StringCache stringCache;
 
-      // Private
-      MJ_UNINITIALIZED mj::HeapAllocator allocator;
-
       virtual void Execute() override;
       virtual void OnDone() override;
       virtual void Destroy() override;
-
-    private:
-      bool Add(mj::ArrayList<size_t>& list, size_t index);
     };
 
+    /// <summary>
+    /// Execute only reads what the task holds itself, as the panel may clear its entries while it runs.
+    /// </summary>
     struct CreateTextLayoutTask : public mj::Task
     {
       // In
       MJ_UNINITIALIZED mj::DirectoryNavigationPanel* pParent;
-      MJ_UNINITIALIZED mj::Entry* pEntry;
+      MJ_UNINITIALIZED mj::Entry* pEntry; // Only used in OnDone, which is skipped once the entries are cleared
+      MJ_UNINITIALIZED mj::StringView name;
+      MJ_UNINITIALIZED mj::ListingSnapshot* pSnapshot; // Holds a reference, as it owns the name. Optional.
+      MJ_UNINITIALIZED IDWriteTextFormat* pTextFormat; // Holds a reference
 
       // Out
       MJ_UNINITIALIZED IDWriteTextLayout* pTextLayout;
@@ -1,9 +1,41 @@
 #include "MainWindow.h"
 #include "mj_win32.h"
 #include "ErrorExit.h"
+#include "ThreadpoolTests.h"
+#include <shellapi.h>
+
+/// <summary>
+/// True if the command line contains /selftest.
+/// </summary>
+static bool IsSelfTest()
+{
+  int numArgs    = 0;
+  LPWSTR* ppArgs = ::CommandLineToArgvW(::GetCommandLineW(), &numArgs);
+  if (!ppArgs)
+  {
+    return false;
+  }
+  MJ_DEFER(static_cast<void>(::LocalFree(ppArgs)));
+
+  bool selfTest = false;
+  for (int i = 1; i < numArgs; i++)
+  {
+    MJ_UNINITIALIZED mj::StringView arg;
+    arg.Init(ppArgs[i]);
+    selfTest = selfTest || arg.Equals(L"/selftest");
+  }
+  return selfTest;
+}
 
 static void Main()
 {
+  // Runs the tests instead of the window. Exits with 0 once they all pass, a failed check exits with an error.
+  if (IsSelfTest())
+  {
+    mj::RunThreadpoolTests();
+    return;
+  }
+
   mj::MainWindow pMainWindow;
   pMainWindow.Run();
 }
@@ -174,3 +174,17 @@ void mj::LinearLayout::OnContextMenu(int16_t clientX, int16_t clientY, int16_t s
     }
   }
 }
+
+void mj::LinearLayout::OnChar(int16_t x, int16_t y, wchar_t c)
+{
+  for (Control* pControl : this->controls)
+  {
+    int16_t clientX = x;
+    int16_t clientY = y;
+    if (pControl->TranslateClientPoint(&clientX, &clientY))
+    {
+      pControl->OnChar(clientX, clientY, c);
+      break;
+    }
+  }
+}
@@ -13,6 +13,7 @@ namespace mj
     virtual void OnDoubleClick(int16_t x, int16_t y, uint16_t mkMask) override;
     virtual void OnMouseWheel(int16_t x, int16_t y, uint16_t mkMask, int16_t zDelta) override;
     virtual void OnContextMenu(int16_t clientX, int16_t clientY, int16_t screenX, int16_t screenY) override;
+    virtual void OnChar(int16_t x, int16_t y, wchar_t c) override;
     virtual void OnMouseMove(MouseMoveEvent* pMouseMoveEvent) override;
     [[nodiscard]] virtual bool OnLeftButtonDown(int16_t x, int16_t y) override;
     [[nodiscard]] virtual bool OnLeftButtonUp(int16_t x, int16_t y) override;
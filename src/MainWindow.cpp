@@ -6,6 +6,7 @@
 #include <wincodec.h> // WIC
 #include "../3rdparty/tracy/Tracy.hpp"
 #include "Threadpool.h"
+#include "mj_listingcache.h"
 #include "ResourcesD2D1.h"
 #include "ResourcesWin32.h"
 
@@ -118,6 +119,21 @@ struct CreateID2D1RenderTargetContext : public mj::Task
   }
 };
 
+/// <summary>
+/// Runs on the main thread once the window has everything it needs to paint.
+/// </summary>
+struct ShowWindowTask : public mj::Task
+{
+  virtual void Execute() override
+  {
+    ZoneScoped;
+
+    // If the window was previously visible, the return value is nonzero.
+    // If the window was previously hidden, the return value is zero.
+    static_cast<void>(::ShowWindow(svc::MainWindowHandle(), SW_SHOW));
+  }
+};
+
 struct CreateDWriteFactoryTask : public mj::Task
 {
   // In
@@ -159,10 +175,6 @@ void mj::MainWindow::OnCreateID2D1RenderTarget(IDCompositionDesktopDevice* dcomp
   MJ_ERR_HRESULT(this->dcompDevice->CreateVirtualSurface(0, 0, DXGI_FORMAT_B8G8R8A8_UNORM,
                                                          DXGI_ALPHA_MODE_PREMULTIPLIED, &this->pSurface));
   MJ_ERR_HRESULT(pVisual->SetContent(this->pSurface));
-
-  // If the window was previously visible, the return value is nonzero.
-  // If the window was previously hidden, the return value is zero.
-  static_cast<void>(::ShowWindow(svc::MainWindowHandle(), SW_SHOW));
 }
 
 #if 0
@@ -365,6 +377,7 @@ LRESULT CALLBACK mj::MainWindow::WindowProc(HWND hWnd, UINT message, WPARAM wPar
     pMainWindow       = reinterpret_cast<mj::MainWindow*>(pcs->lpCreateParams);
     MJ_ERR_ZERO_VALID(::SetWindowLongPtrW(hWnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(pMainWindow)));
     svc::ProvideMainWindowHandle(hWnd);
+    mj::ThreadpoolSetMainWindow(hWnd);
 
     // Disable animations, even before presenting the window
     // TODO: It is better to leave this as a configuration option.
@@ -397,8 +410,13 @@ LRESULT CALLBACK mj::MainWindow::WindowProc(HWND hWnd, UINT message, WPARAM wPar
     pMainWindow->Resize();
     return 0;
   case WM_DESTROY:
+    mj::ThreadpoolSetMainWindow(nullptr);
     ::PostQuitMessage(0);
     return 0;
+  case WM_MJTASKFINISH:
+    // Also dispatched by modal loops, e.g. while resizing or while a popup menu is open
+    mj::ThreadpoolDrainCompletions();
+    return 0;
   case WM_PAINT:
   {
     static constexpr const char* pFrameMark = STR(WM_PAINT);
@@ -484,6 +502,19 @@ LRESULT CALLBACK mj::MainWindow::WindowProc(HWND hWnd, UINT message, WPARAM wPar
     }
     return 0;
   }
+  case WM_CHAR:
+  {
+    MJ_UNINITIALIZED POINT ptCursor;
+    if (pMainWindow->pRootControl && ::GetCursorPos(&ptCursor))
+    {
+      MJ_UNINITIALIZED POINTS ptScreen;
+      ptScreen.x      = static_cast<SHORT>(ptCursor.x);
+      ptScreen.y      = static_cast<SHORT>(ptCursor.y);
+      POINTS ptClient = mj::ScreenPointToClient(hWnd, ptScreen);
+      pMainWindow->pRootControl->OnChar(ptClient.x, ptClient.y, static_cast<wchar_t>(wParam));
+    }
+    return 0;
+  }
   default:
     break;
   }
@@ -501,14 +532,26 @@ void mj::MainWindow::Run()
   pAllocator = &generalPurposeAllocator;
   svc::ProvideGeneralPurposeAllocator(pAllocator);
 
+  // Folder listings shared by all panels. Set up before the thread pool, so it is destroyed after the pool has
+  // stopped taking tasks. A listing that is still running sees the cache is gone.
+  mj::ListingCacheInit(64 * 1024 * 1024);
+  MJ_DEFER(mj::ListingCacheDestroy());
+
   // Initialize thread pool
   mj::ThreadpoolInit(::GetCurrentThreadId(), WM_MJTASKFINISH);
   MJ_DEFER(mj::ThreadpoolDestroy());
+#ifdef _DEBUG
+  // The counters are always on, only the periodic dump is opt-in
+  mj::ThreadpoolStartStatsDump(10000);
+#endif
 
-  // Start a bunch of tasks
+  // Start a bunch of tasks. The window is shown once all of them are done.
+  auto pShowWindowTask             = mj::ThreadpoolCreateTask<ShowWindowTask>();
+  pShowWindowTask->runOnMainThread = true;
   {
     auto pTask         = mj::ThreadpoolCreateTask<CreateIWICImagingFactoryContext>();
     pTask->pMainWindow = this;
+    mj::ThreadpoolAddDependency(pShowWindowTask, pTask);
     mj::ThreadpoolSubmitTask(pTask);
   }
   {
@@ -518,13 +561,16 @@ void mj::MainWindow::Run()
     pTask->rect.right  = 1280;
     pTask->rect.top    = 0;
     pTask->rect.bottom = 720;
+    mj::ThreadpoolAddDependency(pShowWindowTask, pTask);
     mj::ThreadpoolSubmitTask(pTask);
   }
   {
     auto pTask         = mj::ThreadpoolCreateTask<CreateDWriteFactoryTask>();
     pTask->pMainWindow = this;
+    mj::ThreadpoolAddDependency(pShowWindowTask, pTask);
     mj::ThreadpoolSubmitTask(pTask);
   }
+  mj::ThreadpoolSubmitTask(pShowWindowTask);
 
   res::win32::Init();
   res::d2d1::Init(pAllocator);
@@ -587,12 +633,13 @@ void mj::MainWindow::Run()
     // the return value generally is ignored.
     static_cast<void>(::DispatchMessageW(&msg));
 
-    if (msg.message == WM_MJTASKFINISH)
+    if (msg.message == WM_MJTASKFINISH && !msg.hwnd)
     {
-      // Threadpool notifies the main thread using PostThreadMessage.
+      // Threadpool notifies the main thread using PostThreadMessage
+      // until the window exists, once for every batch of finished tasks.
       // These messages are not associated with a window, so they must be
       // handled here, instead of in the WindowProc.
-      mj::ThreadpoolTaskEnd(reinterpret_cast<mj::Task*>(msg.wParam));
+      mj::ThreadpoolDrainCompletions();
     }
   }
   this->SaveLayoutToFile();
@@ -1,135 +1,2431 @@
 #include "Threadpool.h"
 #include "mj_win32.h"
 #include "mj_common.h"
+#include "mj_random.h"
+#include "mj_arena.h"
+#include "mj_topology.h"
+#include "mj_string.h"
+#include "ServiceLocator.h"
 #include "ErrorExit.h"
 #include "../3rdparty/tracy/Tracy.hpp"
 #include "../3rdparty/tracy/common/TracySystem.hpp"
 
-static constexpr auto MAX_TASKS   = 1024;
-static constexpr auto NUM_THREADS = 8;
-static mj::TaskContext s_TaskContextArray[MAX_TASKS];
-static mj::TaskContext* s_pTaskHead;
+static constexpr auto MAX_THREADS = mj::ThreadpoolStats::MAX_WORKERS;
+
+/// <summary>
+/// Capacity of each worker's deque. Must be a power of two.
+/// Tasks that do not fit go to the lanes.
+/// </summary>
+static constexpr LONG64 DEQUE_CAPACITY = 1024;
+
+/// <summary>
+/// Slab size and number of slabs allocated up front, per pooled task size.
+/// 64 KiB matches the allocation granularity of VirtualAlloc.
+/// </summary>
+static constexpr size_t SLAB_SIZES[]        = { 64 * 1024, 64 * 1024, 256 * 1024 };
+static constexpr size_t NUM_INITIAL_SLABS[] = { 4, 1, 0 };
+
+/// <summary>
+/// Same for the task states. There is one for every task, of any size.
+/// </summary>
+static constexpr size_t STATE_SLAB_SIZE         = 64 * 1024;
+static constexpr size_t NUM_INITIAL_STATE_SLABS = 4;
+
+/// <summary>
+/// Bounds for the number of pause instructions an idle worker spins before parking.
+/// A pause takes somewhere between 10 and 140 cycles, depending on the CPU.
+/// </summary>
+static constexpr uint32_t SPIN_BUDGET_MIN     = 256;
+static constexpr uint32_t SPIN_BUDGET_MAX     = 16384;
+static constexpr uint32_t SPIN_BUDGET_INITIAL = 1024;
+
+/// <summary>
+/// Pause instructions between looking for work while spinning.
+/// </summary>
+static constexpr uint32_t SPIN_POLL_INTERVAL = 64;
+
+/// <summary>
+/// Upper limit for the I/O pool. Each thread is mostly blocked, so this is about
+/// how many outstanding requests we allow, not about cores.
+/// </summary>
+static constexpr LONG MAX_IO_THREADS = 32;
+
+/// <summary>
+/// I/O threads that have had nothing to do for this long exit.
+/// </summary>
+static constexpr DWORD IO_THREAD_IDLE_TIMEOUT_MS = 10000;
+
+/// <summary>
+/// Latency histograms are exact below this many microseconds,
+/// and have this many linear buckets per power of two above it.
+/// </summary>
+static constexpr uint32_t HISTOGRAM_SUB_BUCKETS = 8;
+
+/// <summary>
+/// Enough for 2^32 microseconds (about 71 minutes). Anything longer goes in the last bucket.
+/// </summary>
+static constexpr uint32_t HISTOGRAM_NUM_BUCKETS = 240;
+
 static DWORD s_MainThreadId;
 static UINT s_Msg;
-static HANDLE s_Threads[NUM_THREADS];
-static HANDLE s_Iocp;
+static HWND volatile s_hMainWindow; // See ThreadpoolSetMainWindow
+
+// Deterministic mode: no threads, the test drives everything through ThreadpoolStep
+static mj::EExecutorMode::Enum s_ExecutorMode;
+static mj::rng::xoshiro128plusplus s_StepRng;
+static uint64_t s_VirtualTime;
+static bool s_Stepping;
 
 /// <summary>
-/// The return value of this function can be cast to anything you want
-/// (as long as its size is less or equal)
+/// Deterministic modes run everything on the calling thread, so there is nobody to exclude or wake.
+/// Locks, wakeups and the clock go through these, and only touch the OS when threaded.
 /// </summary>
-mj::TaskContext* mj::detail::ThreadpoolAllocTaskContext()
+static bool IsThreaded()
 {
-  MJ_EXIT_NULL(s_pTaskHead);
-
-  mj::TaskContext* pTaskContext = s_pTaskHead;
+  return s_ExecutorMode == mj::EExecutorMode::Threaded;
+}
 
-  s_pTaskHead = s_pTaskHead->pNextFreeNode;
+static void LockExclusive(SRWLOCK* pLock)
+{
+  if (IsThreaded())
+  {
+    ::AcquireSRWLockExclusive(pLock);
+  }
+}
 
-  return pTaskContext;
+static void UnlockExclusive(SRWLOCK* pLock)
+{
+  if (IsThreaded())
+  {
+    ::ReleaseSRWLockExclusive(pLock);
+  }
 }
 
-namespace mj
+/// <summary>
+/// Bumps the epoch, and wakes one thread waiting on it.
+/// </summary>
+static void WakeOne(volatile LONG* pEpoch)
 {
-  static void ThreadpoolFreeContext(TaskContext* pContext)
+  static_cast<void>(::InterlockedIncrement(pEpoch));
+  if (IsThreaded())
   {
-    // Write a new TaskContext over this piece of memory
-    TaskContext* pNode   = new (pContext) TaskContext;
-    pNode->pNextFreeNode = s_pTaskHead;
-    s_pTaskHead          = pNode;
+    ::WakeByAddressSingle(const_cast<LONG*>(pEpoch));
   }
-} // namespace mj
+}
 
-static DWORD WINAPI ThreadMain(LPVOID lpThreadParameter)
+/// <summary>
+/// Bumps the epoch, and wakes every thread waiting on it.
+/// </summary>
+static void WakeAll(volatile LONG* pEpoch)
 {
-#ifdef TRACY_ENABLE
-  tracy::SetThreadName("Threadpool thread");
-#endif
-  static_cast<void>(lpThreadParameter);
+  static_cast<void>(::InterlockedIncrement(pEpoch));
+  if (IsThreaded())
+  {
+    ::WakeByAddressAll(const_cast<LONG*>(pEpoch));
+  }
+}
 
-  while (true)
+namespace mj
+{
+  namespace detail
   {
-    MJ_UNINITIALIZED DWORD numBytes;
-    MJ_UNINITIALIZED mj::Task* pTask;
-    MJ_UNINITIALIZED LPOVERLAPPED pOverlapped;
+    struct DebounceSlot;
+    struct TaskTypeStats;
+
+    /// <summary>
+    /// The parts of a task that only the threadpool touches. Lives in a pool of its own,
+    /// so the size classes of task contexts are not taken up by bookkeeping.
+    /// Aligned to a cache line, as numBlockers is decremented from any thread.
+    /// </summary>
+    struct alignas(64) TaskState
+    {
+      /// <summary>
+      /// Entry in the free list of the task state pool
+      /// </summary>
+      SLIST_ENTRY freeListEntry;
+
+      /// <summary>
+      /// Number of predecessors that have not ended yet, plus one until the task is submitted
+      /// </summary>
+      volatile LONG numBlockers;
+
+      /// <summary>
+      /// Size class of the memory the task lives in
+      /// </summary>
+      ETaskSize::Enum size;
+
+      /// <summary>
+      /// True while the task waits in a lane
+      /// </summary>
+      bool queued;
+
+      /// <summary>
+      /// True while the task waits in the timer wheel
+      /// </summary>
+      bool delayed;
 
+      /// <summary>
+      /// Tasks that wait for this one
+      /// </summary>
+      TaskEdge* pSuccessors;
+
+      /// <summary>
+      /// Timer wheel tick at which the task is released
+      /// </summary>
+      uint64_t dueTick;
+
+      /// <summary>
+      /// Set while the task is pending for ThreadpoolDebounce or ThreadpoolThrottle
+      /// </summary>
+      DebounceSlot* pDebounceSlot;
+
+      /// <summary>
+      /// See ThreadpoolGetTaskTypeName
+      /// </summary>
+      const char* pTypeName;
+
+      /// <summary>
+      /// Statistics for this task type, looked up on first use
+      /// </summary>
+      TaskTypeStats* pTypeStats;
+
+      /// <summary>
+      /// Performance counter values of when the task became ready to run, and when Execute returned
+      /// </summary>
+      uint64_t readyTime;
+      uint64_t endTime;
+
+      /// <summary>
+      /// See ThreadpoolGetOutputAllocator
+      /// </summary>
+      ArenaAllocator* pOutputArena;
+
+      /// <summary>
+      /// Neighbors in the lane or timer wheel slot. pNextTask is reused for the completion queue.
+      /// </summary>
+      Task* pPrevTask;
+      Task* pNextTask;
+    };
+
+    /// <summary>
+    /// Chase-Lev work-stealing deque. The owning worker pushes and pops at the bottom,
+    /// other workers steal from the top.
+    /// </summary>
+    struct WorkStealingDeque
     {
-      ZoneScopedNC("Sleeping", 0x21231C);
-      BOOL ret =
-          ::GetQueuedCompletionStatus(s_Iocp, &numBytes, reinterpret_cast<PULONG_PTR>(&pTask), &pOverlapped, INFINITE);
-      if (ret == FALSE && ::GetLastError() == ERROR_ABANDONED_WAIT_0)
+      alignas(64) volatile LONG64 top;
+      alignas(64) volatile LONG64 bottom;
+      alignas(64) Task* volatile buffer[DEQUE_CAPACITY];
+
+      void Init()
       {
-        break;
+        this->top    = 0;
+        this->bottom = 0;
       }
-    }
 
-    if (pTask)
+      /// <summary>
+      /// Owner only.
+      /// </summary>
+      /// <returns>False if the deque is full.</returns>
+      bool Push(Task* pTask)
+      {
+        const LONG64 b = ::ReadNoFence64(&this->bottom);
+        const LONG64 t = ::ReadAcquire64(&this->top);
+        if (b - t >= DEQUE_CAPACITY)
+        {
+          return false;
+        }
+
+        this->buffer[b & (DEQUE_CAPACITY - 1)] = pTask;
+        ::WriteRelease64(&this->bottom, b + 1);
+        return true;
+      }
+
+      /// <summary>
+      /// Owner only. Takes the most recently pushed task.
+      /// </summary>
+      Task* Pop()
+      {
+        const LONG64 b = ::ReadNoFence64(&this->bottom) - 1;
+
+        // Full barrier: thieves must see the new bottom before we read top
+        static_cast<void>(::InterlockedExchange64(&this->bottom, b));
+        LONG64 t = ::ReadNoFence64(&this->top);
+
+        if (t > b)
+        {
+          // Empty
+          ::WriteNoFence64(&this->bottom, b + 1);
+          return nullptr;
+        }
+
+        Task* pTask = this->buffer[b & (DEQUE_CAPACITY - 1)];
+        if (t == b)
+        {
+          // Last task, race against thieves
+          if (::InterlockedCompareExchange64(&this->top, t + 1, t) != t)
+          {
+            pTask = nullptr;
+          }
+          ::WriteNoFence64(&this->bottom, b + 1);
+        }
+
+        return pTask;
+      }
+
+      /// <summary>
+      /// Any thread. Takes the oldest task.
+      /// </summary>
+      /// <returns>nullptr if the deque is empty, or if another thread won the race.</returns>
+      Task* Steal()
+      {
+        const LONG64 t = ::ReadAcquire64(&this->top);
+        ::MemoryBarrier();
+        const LONG64 b = ::ReadAcquire64(&this->bottom);
+        if (t >= b)
+        {
+          return nullptr;
+        }
+
+        Task* pTask = this->buffer[t & (DEQUE_CAPACITY - 1)];
+        if (::InterlockedCompareExchange64(&this->top, t + 1, t) != t)
+        {
+          return nullptr;
+        }
+
+        return pTask;
+      }
+    };
+
+    /// <summary>
+    /// Lock-free pool of equally sized task contexts (or task states) that grows in slabs.
+    /// Safe to use from any thread.
+    /// Slabs live until the process exits.
+    /// The free list is a Win32 interlocked singly linked list, which tags its head to avoid ABA.
+    /// </summary>
+    template <class T>
+    struct SlabPool
+    {
+      SLIST_HEADER freeList;
+      SRWLOCK growLock;
+      size_t contextSize;
+      size_t slabSize;
+
+      void Init(size_t contextSize, size_t slabSize, size_t numInitialSlabs)
+      {
+        ::InitializeSListHead(&this->freeList);
+        this->growLock    = SRWLOCK_INIT;
+        this->contextSize = contextSize;
+        this->slabSize    = slabSize;
+
+        for (size_t i = 0; i < numInitialSlabs; i++)
+        {
+          T* pContext = this->Grow();
+          MJ_EXIT_NULL(pContext);
+          static_cast<void>(::InterlockedPushEntrySList(&this->freeList, &pContext->freeListEntry));
+        }
+      }
+
+      T* Alloc()
+      {
+        T* pContext = reinterpret_cast<T*>(::InterlockedPopEntrySList(&this->freeList));
+        if (!pContext)
+        {
+          pContext = this->Grow();
+        }
+
+        return pContext;
+      }
+
+      void Free(T* pContext)
+      {
+        // Write a new node over this piece of memory
+        T* pNode = new (pContext) T;
+        static_cast<void>(::InterlockedPushEntrySList(&this->freeList, &pNode->freeListEntry));
+      }
+
+    private:
+      /// <summary>
+      /// Allocates a new slab, unless another thread did so while we were waiting for the lock.
+      /// </summary>
+      /// <returns>A context for the caller, or nullptr if we are out of memory.</returns>
+      T* Grow()
+      {
+        ZoneScoped;
+
+        LockExclusive(&this->growLock);
+
+        T* pContext = reinterpret_cast<T*>(::InterlockedPopEntrySList(&this->freeList));
+        if (!pContext)
+        {
+          void* pMemory = ::VirtualAlloc(nullptr, this->slabSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+          if (pMemory)
+          {
+            // The first context goes to the caller. Link up the rest and push them in one go.
+            const size_t stride      = this->contextSize / sizeof(T);
+            const size_t numContexts = this->slabSize / this->contextSize;
+            T* pContexts             = static_cast<T*>(pMemory);
+            for (size_t i = 1; i < numContexts; i++)
+            {
+              T* pNode                  = new (&pContexts[i * stride]) T;
+              pNode->freeListEntry.Next = i + 1 < numContexts ? &pContexts[(i + 1) * stride].freeListEntry : nullptr;
+            }
+            static_cast<void>(::InterlockedPushListSListEx(&this->freeList, &pContexts[stride].freeListEntry,
+                                                           &pContexts[(numContexts - 1) * stride].freeListEntry,
+                                                           static_cast<ULONG>(numContexts - 1)));
+
+            pContext = new (&pContexts[0]) T;
+          }
+        }
+
+        UnlockExclusive(&this->growLock);
+
+        return pContext;
+      }
+    };
+
+    using TaskContextPool = SlabPool<TaskContext>;
+    using TaskStatePool   = SlabPool<TaskState>;
+
+    struct Worker
+    {
+      WorkStealingDeque deque;
+      mj::rng::xoshiro128plusplus rng; // Victim selection
+      HANDLE hThread;
+      uint32_t index;
+      uint32_t numaNode; // Steal from workers on the same node first
+
+      // Only written by the worker itself
+      uint32_t spinBudget;
+      volatile LONG64 busyTime; // Performance counter ticks spent in Execute
+      volatile LONG64 numTasksRun;
+      volatile LONG64 numSpinHits; // Found work while spinning
+      volatile LONG64 numParks;    // Went to sleep in the kernel
+    };
+
+    /// <summary>
+    /// Log-linear (HDR-style) histogram of microsecond values. Recording is a few interlocked adds.
+    /// </summary>
+    struct LatencyHistogram
     {
-      pTask->Execute();
+      volatile LONG64 buckets[HISTOGRAM_NUM_BUCKETS];
+      volatile LONG64 count;
+      volatile LONG64 sumUs;
+      volatile LONG64 maxUs;
+
+      static uint32_t GetBucket(uint64_t us)
+      {
+        if (us < HISTOGRAM_SUB_BUCKETS)
+        {
+          return static_cast<uint32_t>(us);
+        }
+
+        // The highest bit picks the power of two, the three bits below it the linear bucket
+        MJ_UNINITIALIZED unsigned long msb;
+        static_cast<void>(::_BitScanReverse64(&msb, us));
+        const uint32_t bucket =
+            (msb - 2) * HISTOGRAM_SUB_BUCKETS + static_cast<uint32_t>((us >> (msb - 3)) & (HISTOGRAM_SUB_BUCKETS - 1));
+        return bucket < HISTOGRAM_NUM_BUCKETS ? bucket : HISTOGRAM_NUM_BUCKETS - 1;
+      }
+
+      /// <returns>The largest value that falls in the bucket</returns>
+      static uint64_t GetBucketLimit(uint32_t bucket)
+      {
+        if (bucket < HISTOGRAM_SUB_BUCKETS)
+        {
+          return bucket;
+        }
+
+        const uint32_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+        const uint64_t sub   = HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS;
+        return ((sub + 1) << shift) - 1;
+      }
+
+      void Record(uint64_t us)
+      {
+        static_cast<void>(::InterlockedIncrement64(&this->buckets[GetBucket(us)]));
+        static_cast<void>(::InterlockedIncrement64(&this->count));
+        static_cast<void>(::InterlockedExchangeAdd64(&this->sumUs, static_cast<LONG64>(us)));
+
+        LONG64 maxUs = ::ReadNoFence64(&this->maxUs);
+        while (static_cast<LONG64>(us) > maxUs)
+        {
+          const LONG64 previous = ::InterlockedCompareExchange64(&this->maxUs, static_cast<LONG64>(us), maxUs);
+          if (previous == maxUs)
+          {
+            break;
+          }
+          maxUs = previous;
+        }
+      }
 
+      void Read(ThreadpoolLatencyStats* pStats) const
       {
-        ZoneScopedNC("PostMessageW", 0x31332C);
-        MJ_ERR_ZERO(::PostThreadMessageW(s_MainThreadId, s_Msg, reinterpret_cast<WPARAM>(pTask), 0));
+        // Sum the buckets instead of reading count, so percentiles stay consistent with each other
+        uint64_t counts[HISTOGRAM_NUM_BUCKETS];
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++)
+        {
+          counts[i] = static_cast<uint64_t>(::ReadNoFence64(&this->buckets[i]));
+          total += counts[i];
+        }
+
+        pStats->count  = total;
+        pStats->maxUs  = static_cast<uint64_t>(::ReadNoFence64(&this->maxUs));
+        pStats->meanUs = total > 0 ? static_cast<uint64_t>(::ReadNoFence64(&this->sumUs)) / total : 0;
+        pStats->p50Us  = GetPercentile(counts, total, 500, pStats->maxUs);
+        pStats->p90Us  = GetPercentile(counts, total, 900, pStats->maxUs);
+        pStats->p99Us  = GetPercentile(counts, total, 990, pStats->maxUs);
+      }
+
+    private:
+      static uint64_t GetPercentile(const uint64_t* pCounts, uint64_t total, uint64_t perMille, uint64_t maxUs)
+      {
+        const uint64_t rank = (total * perMille + 999) / 1000;
+        uint64_t seen       = 0;
+        for (uint32_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++)
+        {
+          seen += pCounts[i];
+          if (seen >= rank && seen > 0)
+          {
+            const uint64_t limit = GetBucketLimit(i);
+            return limit < maxUs ? limit : maxUs;
+          }
+        }
+        return 0;
       }
+    };
+
+    struct TaskTypeStats
+    {
+      const char* pTypeName; // nullptr for the overflow entry
+      wchar_t name[64];
+      volatile LONG64 numCancelled;
+      LatencyHistogram latencies[ETaskLatency::COUNT];
+    };
+  } // namespace detail
+} // namespace mj
+
+// One pool per size class. Huge tasks come straight from the process heap.
+static mj::detail::TaskContextPool s_TaskContextPools[mj::ETaskSize::Huge];
+static mj::detail::TaskStatePool s_TaskStatePool;
+static volatile LONG s_NumTasks;
+static volatile LONG s_HighWaterMark;
+static mj::detail::Worker s_Workers[MAX_THREADS];
+static uint32_t s_NumWorkers;
+static mj::CpuTopology s_Topology;
+static bool s_HasTopology;
+
+// Statistics. Entries are only ever added, and published through s_NumTaskTypes.
+static SRWLOCK s_TaskTypeLock = SRWLOCK_INIT;
+static mj::detail::TaskTypeStats s_TaskTypes[mj::ThreadpoolStats::MAX_TASK_TYPES];
+static volatile LONG s_NumTaskTypes;
+static LONG64 s_PerformanceFrequency;
+static LONG64 s_StartTime;
+static mj::Task* s_pStatsDumpTask;
+
+/// <summary>
+/// Index of the worker in s_Workers, plus one. Zero for threads outside the pool.
+/// Implicit TLS (thread_local) requires the CRT, so we use a TLS slot.
+/// </summary>
+static DWORD s_WorkerTlsIndex = TLS_OUT_OF_INDEXES;
+
+/// <summary>
+/// Scratch arena of pool threads. The main thread uses s_pMainThreadScratch.
+/// Arenas have a vtable and we have no static constructors, so they are all created at runtime.
+/// </summary>
+static DWORD s_ScratchTlsIndex = TLS_OUT_OF_INDEXES;
+static mj::ArenaAllocator* s_pMainThreadScratch;
+
+/// <summary>
+/// Intrusive FIFO of queued tasks with the same priority.
+/// Takes tasks submitted from outside the pool, or from workers whose deque is full.
+/// </summary>
+struct TaskLane
+{
+  mj::Task* pHead;
+  mj::Task* pTail;
+  volatile LONG size; // Lets workers skip the lock when the lane is empty
+};
+
+// One lock for all lanes, so a task can move between lanes atomically.
+// CPU workers and I/O threads each have their own set of lanes.
+static SRWLOCK s_LaneLock = SRWLOCK_INIT;
+static TaskLane s_Lanes[mj::ETaskKind::COUNT][mj::ETaskPriority::COUNT];
+
+// Finished tasks, newest first. Workers push, the main thread takes them all at once.
+// There is no single pop, so a plain compare-and-swap is free of ABA.
+static mj::Task* volatile s_pCompletedTasks;
+static volatile LONG s_NumCompletions;
+
+// Main thread only. Taken off the stack, oldest first, but not ended yet. See ThreadpoolDrainCompletions.
+static mj::Task* s_pDrainHead;
+static mj::Task* s_pDrainTail;
+
+// Parking. Workers wait on s_WakeEpoch, which submitters increment.
+static volatile LONG s_WakeEpoch;
+static volatile LONG s_NumParked;
+static volatile LONG s_NumSpinning;
+static volatile LONG s_NumSpinClaims; // Tasks that were submitted without a wake, as a spinner will take them
+static volatile LONG s_Quit;
+
+// I/O threads are started on demand, and wait on s_IoWakeEpoch when idle
+static volatile LONG s_IoWakeEpoch;
+static volatile LONG s_NumIoThreads;
+static volatile LONG s_NumIdleIoThreads;
+
+/// <summary>
+/// The return value of this function can be cast to anything you want
+/// (as long as its size is less or equal to the size class)
+/// </summary>
+mj::TaskContext* mj::detail::ThreadpoolAllocTaskContext(ETaskSize::Enum size, size_t numBytes)
+{
+  MJ_UNINITIALIZED mj::TaskContext* pTaskContext;
+  if (size == ETaskSize::Huge)
+  {
+    pTaskContext = static_cast<mj::TaskContext*>(::HeapAlloc(::GetProcessHeap(), 0, numBytes));
+  }
+  else
+  {
+    pTaskContext = s_TaskContextPools[size].Alloc();
+  }
+  MJ_EXIT_NULL(pTaskContext);
+
+  const LONG numTasks = ::InterlockedIncrement(&s_NumTasks);
+  LONG highWaterMark  = ::ReadNoFence(&s_HighWaterMark);
+  while (numTasks > highWaterMark)
+  {
+    const LONG previous = ::InterlockedCompareExchange(&s_HighWaterMark, numTasks, highWaterMark);
+    if (previous == highWaterMark)
+    {
+      break;
     }
+    highWaterMark = previous;
   }
 
-  return 0;
+  return pTaskContext;
 }
 
-void mj::ThreadpoolInit(DWORD threadId, UINT userMessage)
+mj::detail::TaskState* mj::detail::ThreadpoolAllocTaskState(ETaskSize::Enum size, const char* pTypeName)
 {
-  ZoneScoped;
+  mj::detail::TaskState* pState = s_TaskStatePool.Alloc();
+  MJ_EXIT_NULL(pState);
 
-  s_MainThreadId = threadId;
-  s_Msg          = userMessage;
+  pState->numBlockers   = 1;
+  pState->size          = size;
+  pState->queued        = false;
+  pState->delayed       = false;
+  pState->pSuccessors   = nullptr;
+  pState->pDebounceSlot = nullptr;
+  pState->pTypeName     = pTypeName;
+  pState->pTypeStats    = nullptr;
+  pState->endTime       = 0;
+  pState->pOutputArena  = nullptr;
 
-  // Initialize message queue for this thread
-  // TODO: Check if this is necessary
-  // MJ_UNINITIALIZED MSG msg;
-  // static_cast<void>(::PeekMessageW(&msg, nullptr, WM_USER, WM_USER, PM_NOREMOVE));
+  return pState;
+}
 
-  MJ_ERR_IF(s_Iocp = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 0), nullptr);
+static void ThreadpoolFreeTaskContext(mj::TaskContext* pContext, mj::ETaskSize::Enum size)
+{
+  static_cast<void>(::InterlockedDecrement(&s_NumTasks));
 
-  // Initialize free list
-  mj::TaskContext* pNext = nullptr;
-  for (int i = 0; i < MAX_TASKS; i++)
+  if (size == mj::ETaskSize::Huge)
+  {
+    static_cast<void>(::HeapFree(::GetProcessHeap(), 0, pContext));
+  }
+  else
   {
-    s_TaskContextArray[i].pNextFreeNode = pNext;
-    pNext                               = &s_TaskContextArray[i];
+    s_TaskContextPools[size].Free(pContext);
   }
-  s_pTaskHead = &s_TaskContextArray[MAX_TASKS - 1];
+}
+
+bool mj::ThreadpoolIsMainThread()
+{
+  return !IsThreaded() || ::GetCurrentThreadId() == s_MainThreadId;
+}
+
+uint32_t mj::ThreadpoolGetNumThreads()
+{
+  return s_NumWorkers;
+}
 
-  for (int i = 0; i < NUM_THREADS; i++)
+uint32_t mj::ThreadpoolGetHighWaterMark()
+{
+  return static_cast<uint32_t>(::ReadAcquire(&s_HighWaterMark));
+}
+
+/// <summary>
+/// Performance counter ticks, or virtual milliseconds in deterministic mode.
+/// </summary>
+static uint64_t GetTime()
+{
+  if (!IsThreaded())
   {
-    ZoneScopedN("CreateThread");
-    MJ_ERR_IF(s_Threads[i] = ::CreateThread(nullptr,    // default security attributes
-                                            0,          // default stack size
-                                            ThreadMain, // entry point
-                                            nullptr,    // argument
-                                            0,          // default flags
-                                            nullptr),
-              nullptr);
+    return s_VirtualTime;
   }
+
+  MJ_UNINITIALIZED LARGE_INTEGER time;
+  static_cast<void>(::QueryPerformanceCounter(&time));
+  return static_cast<uint64_t>(time.QuadPart);
 }
 
-void mj::ThreadpoolTaskEnd(mj::Task* pTask)
+static uint64_t TimeToMicroseconds(uint64_t time)
+{
+  // Split up, so we do not overflow after a few days
+  const uint64_t frequency = static_cast<uint64_t>(s_PerformanceFrequency);
+  return time / frequency * 1000000 + time % frequency * 1000000 / frequency;
+}
+
+/// <summary>
+/// Without /GF, every translation unit may have its own copy of a type name.
+/// </summary>
+static bool IsSameTypeName(const char* pA, const char* pB)
 {
-  if (!pTask->cancelled)
+  if (pA == pB)
   {
-    pTask->OnDone();
+    return true;
   }
-  pTask->Destroy();
-  mj::ThreadpoolFreeContext(reinterpret_cast<mj::TaskContext*>(pTask));
+  if (!pA || !pB)
+  {
+    return false;
+  }
+  while (*pA && *pA == *pB)
+  {
+    pA++;
+    pB++;
+  }
+  return *pA == *pB;
 }
 
-void mj::ThreadpoolDestroy()
+/// <summary>
+/// Turns "const char *__cdecl mj::detail::ThreadpoolGetTaskTypeName<struct mj::Foo>(void)" into "mj::Foo".
+/// </summary>
+static void InitTaskTypeName(wchar_t* pDest, size_t numChars, const char* pTypeName)
+{
+  const char* pBegin = pTypeName;
+  const char* pEnd   = pTypeName;
+  for (const char* p = pTypeName; *p; p++)
+  {
+    if (*p == '<' && pBegin == pTypeName)
+    {
+      pBegin = p + 1;
+    }
+    else if (*p == '>')
+    {
+      pEnd = p;
+    }
+  }
+  if (pEnd <= pBegin)
+  {
+    pBegin = pTypeName;
+    pEnd   = pTypeName;
+    while (*pEnd)
+    {
+      pEnd++;
+    }
+  }
+
+  static const char* const prefixes[] = { "struct ", "class " };
+  for (const char* pPrefix : prefixes)
+  {
+    const char* p = pBegin;
+    while (*pPrefix && p < pEnd && *p == *pPrefix)
+    {
+      p++;
+      pPrefix++;
+    }
+    if (!*pPrefix)
+    {
+      pBegin = p;
+    }
+  }
+
+  size_t i = 0;
+  for (; i + 1 < numChars && pBegin + i < pEnd; i++)
+  {
+    pDest[i] = static_cast<wchar_t>(pBegin[i]);
+  }
+  pDest[i] = L'\0';
+}
+
+static mj::detail::TaskTypeStats* FindTaskTypeStats(const char* pTypeName)
+{
+  constexpr LONG maxTaskTypes = mj::ThreadpoolStats::MAX_TASK_TYPES;
+
+  LONG numTaskTypes = ::ReadAcquire(&s_NumTaskTypes);
+  for (LONG i = 0; i < numTaskTypes; i++)
+  {
+    if (IsSameTypeName(s_TaskTypes[i].pTypeName, pTypeName))
+    {
+      return &s_TaskTypes[i];
+    }
+  }
+
+  LockExclusive(&s_TaskTypeLock);
+
+  // Someone else may have added it in the meantime
+  mj::detail::TaskTypeStats* pStats = nullptr;
+  for (LONG i = numTaskTypes; i < s_NumTaskTypes; i++)
+  {
+    if (IsSameTypeName(s_TaskTypes[i].pTypeName, pTypeName))
+    {
+      pStats = &s_TaskTypes[i];
+    }
+  }
+
+  if (!pStats)
+  {
+    numTaskTypes = s_NumTaskTypes;
+    if (numTaskTypes < maxTaskTypes - 1)
+    {
+      pStats            = &s_TaskTypes[numTaskTypes];
+      pStats->pTypeName = pTypeName;
+      InitTaskTypeName(pStats->name, sizeof(pStats->name) / sizeof(*pStats->name), pTypeName);
+      ::WriteRelease(&s_NumTaskTypes, numTaskTypes + 1);
+    }
+    else
+    {
+      pStats = &s_TaskTypes[maxTaskTypes - 1];
+      if (numTaskTypes < maxTaskTypes)
+      {
+        pStats->pTypeName = nullptr;
+        InitTaskTypeName(pStats->name, sizeof(pStats->name) / sizeof(*pStats->name), "(other)");
+        ::WriteRelease(&s_NumTaskTypes, maxTaskTypes);
+      }
+    }
+  }
+
+  UnlockExclusive(&s_TaskTypeLock);
+
+  return pStats;
+}
+
+static mj::detail::TaskTypeStats* GetTaskTypeStats(mj::Task* pTask)
 {
-  ::CloseHandle(s_Iocp);
-  s_Iocp = nullptr;
+  if (!pTask->pState->pTypeStats)
+  {
+    pTask->pState->pTypeStats = FindTaskTypeStats(pTask->pState->pTypeName);
+  }
+  return pTask->pState->pTypeStats;
 }
 
-void mj::ThreadpoolSubmitTask(mj::Task* pTask)
+static mj::ArenaAllocator* CurrentScratch()
 {
-  ::PostQueuedCompletionStatus(s_Iocp, 0, reinterpret_cast<ULONG_PTR>(pTask), nullptr);
+  if (!IsThreaded())
+  {
+    return s_pMainThreadScratch;
+  }
+
+  mj::ArenaAllocator* pScratch = static_cast<mj::ArenaAllocator*>(::TlsGetValue(s_ScratchTlsIndex));
+  if (!pScratch && ::GetCurrentThreadId() == s_MainThreadId)
+  {
+    pScratch = s_pMainThreadScratch;
+  }
+  return pScratch;
+}
+
+/// <summary>
+/// Runs Execute, and records how long the task waited and ran.
+/// </summary>
+/// <returns>Run time in performance counter ticks</returns>
+static uint64_t ExecuteTask(mj::Task* pTask)
+{
+  mj::detail::TaskTypeStats* pStats = GetTaskTypeStats(pTask);
+
+  const uint64_t startTime = GetTime();
+  pStats->latencies[mj::ETaskLatency::Wait].Record(TimeToMicroseconds(startTime - pTask->pState->readyTime));
+
+  pTask->Execute();
+
+  mj::ArenaAllocator* pScratch = CurrentScratch();
+  if (pScratch)
+  {
+    pScratch->Reset();
+  }
+
+  pTask->pState->endTime = GetTime();
+  pStats->latencies[mj::ETaskLatency::Run].Record(TimeToMicroseconds(pTask->pState->endTime - startTime));
+
+  return pTask->pState->endTime - startTime;
+}
+
+static mj::detail::Worker* CurrentWorker()
+{
+  if (!IsThreaded())
+  {
+    return nullptr;
+  }
+
+  const uintptr_t value = reinterpret_cast<uintptr_t>(::TlsGetValue(s_WorkerTlsIndex));
+  return value ? &s_Workers[value - 1] : nullptr;
+}
+
+static void LanePushLocked(mj::Task* pTask)
+{
+  TaskLane& lane           = s_Lanes[pTask->kind][pTask->priority];
+  pTask->pState->pPrevTask = lane.pTail;
+  pTask->pState->pNextTask = nullptr;
+  if (lane.pTail)
+  {
+    lane.pTail->pState->pNextTask = pTask;
+  }
+  else
+  {
+    lane.pHead = pTask;
+  }
+  lane.pTail            = pTask;
+  pTask->pState->queued = true;
+  static_cast<void>(::InterlockedIncrement(&lane.size));
+}
+
+static void LaneRemoveLocked(mj::Task* pTask)
+{
+  TaskLane& lane = s_Lanes[pTask->kind][pTask->priority];
+  if (pTask->pState->pPrevTask)
+  {
+    pTask->pState->pPrevTask->pState->pNextTask = pTask->pState->pNextTask;
+  }
+  else
+  {
+    lane.pHead = pTask->pState->pNextTask;
+  }
+  if (pTask->pState->pNextTask)
+  {
+    pTask->pState->pNextTask->pState->pPrevTask = pTask->pState->pPrevTask;
+  }
+  else
+  {
+    lane.pTail = pTask->pState->pPrevTask;
+  }
+  pTask->pState->queued = false;
+  static_cast<void>(::InterlockedDecrement(&lane.size));
+}
+
+static void InjectTask(mj::Task* pTask)
+{
+  LockExclusive(&s_LaneLock);
+  LanePushLocked(pTask);
+  UnlockExclusive(&s_LaneLock);
+}
+
+static mj::Task* TakeInjectedTask(mj::ETaskPriority::Enum priority, mj::ETaskKind::Enum kind = mj::ETaskKind::Cpu)
+{
+  // Avoid the lock when there is nothing to take
+  if (::ReadAcquire(&s_Lanes[kind][priority].size) == 0)
+  {
+    return nullptr;
+  }
+
+  LockExclusive(&s_LaneLock);
+  mj::Task* pTask = s_Lanes[kind][priority].pHead;
+  if (pTask)
+  {
+    LaneRemoveLocked(pTask);
+  }
+  UnlockExclusive(&s_LaneLock);
+
+  return pTask;
+}
+
+/// <summary>
+/// Tries every other worker once, starting at a random victim.
+/// Workers on the same NUMA node go first, so tasks and the memory they touch stay on the node where possible.
+/// </summary>
+static mj::Task* StealTask(mj::detail::Worker* pThief)
+{
+  if (s_NumWorkers < 2)
+  {
+    return nullptr;
+  }
+
+  const uint32_t start = pThief->rng.next() % s_NumWorkers;
+  for (int remote = 0; remote < 2; remote++)
+  {
+    for (uint32_t i = 0; i < s_NumWorkers; i++)
+    {
+      mj::detail::Worker* pVictim = &s_Workers[(start + i) % s_NumWorkers];
+      if (pVictim != pThief && (pVictim->numaNode != pThief->numaNode) == static_cast<bool>(remote))
+      {
+        mj::Task* pTask = pVictim->deque.Steal();
+        if (pTask)
+        {
+          return pTask;
+        }
+      }
+    }
+
+    if (s_Topology.numNumaNodes < 2)
+    {
+      break;
+    }
+  }
+
+  return nullptr;
+}
+
+/// <summary>
+/// Strict priority order. Work in the deques was spawned by running tasks,
+/// so it goes before prefetching and background work.
+/// </summary>
+static mj::Task* FindTask(mj::detail::Worker* pWorker)
+{
+  mj::Task* pTask = TakeInjectedTask(mj::ETaskPriority::Interactive);
+  if (!pTask)
+  {
+    pTask = TakeInjectedTask(mj::ETaskPriority::Visible);
+  }
+  if (!pTask)
+  {
+    pTask = pWorker->deque.Pop();
+  }
+  if (!pTask)
+  {
+    pTask = StealTask(pWorker);
+  }
+  if (!pTask)
+  {
+    pTask = TakeInjectedTask(mj::ETaskPriority::Prefetch);
+  }
+  if (!pTask)
+  {
+    pTask = TakeInjectedTask(mj::ETaskPriority::Background);
+  }
+  return pTask;
+}
+
+/// <summary>
+/// Leaves the task to a spinning worker that has not been claimed by another task yet,
+/// otherwise wakes one parked worker, if there is any. A burst of tasks wakes as many workers
+/// as there are tasks beyond the spinners, up to the number of parked workers.
+/// Must be called after the task is visible in a queue.
+/// </summary>
+static void WakeWorker()
+{
+  // Pairs with the barrier in ParkWorker: either we see the parked worker,
+  // or the worker sees the new task when it checks the queues one last time.
+  // The same goes for spinning workers, which check once more before they park.
+  ::MemoryBarrier();
+  const LONG numSpinning = ::ReadNoFence(&s_NumSpinning);
+  if (numSpinning > 0)
+  {
+    // A spinning worker will find the task without a trip through the kernel
+    if (::InterlockedIncrement(&s_NumSpinClaims) <= numSpinning)
+    {
+      return;
+    }
+    static_cast<void>(::InterlockedDecrement(&s_NumSpinClaims));
+  }
+  if (::ReadNoFence(&s_NumParked) > 0)
+  {
+    WakeOne(&s_WakeEpoch);
+  }
+}
+
+/// <summary>
+/// Looks for work a little longer before parking, as waking a parked worker costs a kernel call on both sides.
+/// The budget doubles when spinning pays off, and halves when it does not, so it follows the arrival rate:
+/// bursts of small tasks are picked up by spinning workers, while an idle pool soon parks right away.
+/// </summary>
+static mj::Task* SpinForTask(mj::detail::Worker* pWorker)
+{
+  // More spinners than half the workers only burn CPU
+  const LONG maxSpinning = s_NumWorkers > 1 ? static_cast<LONG>(s_NumWorkers / 2) : 1;
+  LONG numSpinning       = ::ReadNoFence(&s_NumSpinning);
+  while (true)
+  {
+    if (numSpinning >= maxSpinning)
+    {
+      return nullptr;
+    }
+    const LONG previous = ::InterlockedCompareExchange(&s_NumSpinning, numSpinning + 1, numSpinning);
+    if (previous == numSpinning)
+    {
+      break;
+    }
+    numSpinning = previous;
+  }
+
+  mj::Task* pTask = nullptr;
+  {
+    ZoneScopedNC("Spinning", 0x31332C);
+    for (uint32_t i = 0; i < pWorker->spinBudget && !pTask && !::ReadAcquire(&s_Quit); i += SPIN_POLL_INTERVAL)
+    {
+      for (uint32_t j = 0; j < SPIN_POLL_INTERVAL; j++)
+      {
+        YieldProcessor();
+      }
+      pTask = FindTask(pWorker);
+    }
+  }
+
+  // Full barrier, see WakeWorker
+  const LONG numStillSpinning = ::InterlockedDecrement(&s_NumSpinning);
+
+  // Settle our claim: we either took a task, or there was none left for us.
+  // Claims beyond the remaining spinners have no one to take them, and would hold up the next wakes.
+  LONG numClaims = ::ReadNoFence(&s_NumSpinClaims);
+  while (numClaims > 0)
+  {
+    const LONG settled  = numClaims - 1 < numStillSpinning ? numClaims - 1 : numStillSpinning;
+    const LONG previous = ::InterlockedCompareExchange(&s_NumSpinClaims, settled, numClaims);
+    if (previous == numClaims)
+    {
+      break;
+    }
+    numClaims = previous;
+  }
+
+  if (pTask)
+  {
+    pWorker->spinBudget = pWorker->spinBudget < SPIN_BUDGET_MAX / 2 ? pWorker->spinBudget * 2 : SPIN_BUDGET_MAX;
+    ::WriteNoFence64(&pWorker->numSpinHits, ::ReadNoFence64(&pWorker->numSpinHits) + 1);
+  }
+  else
+  {
+    pWorker->spinBudget = pWorker->spinBudget > SPIN_BUDGET_MIN * 2 ? pWorker->spinBudget / 2 : SPIN_BUDGET_MIN;
+  }
+
+  return pTask;
+}
+
+/// <returns>A task that arrived while getting ready to park, or nullptr after waking up.</returns>
+static mj::Task* ParkWorker(mj::detail::Worker* pWorker)
+{
+  static_cast<void>(::InterlockedIncrement(&s_NumParked));
+  LONG epoch = ::ReadAcquire(&s_WakeEpoch);
+
+  mj::Task* pTask = FindTask(pWorker);
+  if (!pTask && !::ReadAcquire(&s_Quit))
+  {
+    ZoneScopedNC("Sleeping", 0x21231C);
+    ::WriteNoFence64(&pWorker->numParks, ::ReadNoFence64(&pWorker->numParks) + 1);
+    static_cast<void>(::WaitOnAddress(&s_WakeEpoch, &epoch, sizeof(epoch), INFINITE));
+  }
+
+  static_cast<void>(::InterlockedDecrement(&s_NumParked));
+  return pTask;
+}
+
+/// <summary>
+/// I/O tasks have no deques to steal from, so this is just the lanes in priority order.
+/// </summary>
+static mj::Task* FindIoTask()
+{
+  mj::Task* pTask = nullptr;
+  for (int i = 0; i < mj::ETaskPriority::COUNT && !pTask; i++)
+  {
+    pTask = TakeInjectedTask(static_cast<mj::ETaskPriority::Enum>(i), mj::ETaskKind::Io);
+  }
+  return pTask;
+}
+
+static DWORD WINAPI IoThreadMain(LPVOID lpThreadParameter);
+
+/// <summary>
+/// Wakes an idle I/O thread. If they are all blocked, starts a new one.
+/// Must be called after the task is visible in a lane.
+/// </summary>
+static void WakeIoThread()
+{
+  // Same handshake as WakeWorker and ParkWorker
+  ::MemoryBarrier();
+  if (::ReadNoFence(&s_NumIdleIoThreads) > 0)
+  {
+    WakeOne(&s_IoWakeEpoch);
+    return;
+  }
+
+  LONG numThreads = ::ReadAcquire(&s_NumIoThreads);
+  while (numThreads < MAX_IO_THREADS)
+  {
+    const LONG previous = ::InterlockedCompareExchange(&s_NumIoThreads, numThreads + 1, numThreads);
+    if (previous == numThreads)
+    {
+      ZoneScopedN("CreateThread");
+      HANDLE hThread = ::CreateThread(nullptr, 0, IoThreadMain, nullptr, 0, nullptr);
+      if (hThread)
+      {
+        // Nobody joins I/O threads
+        ::CloseHandle(hThread);
+      }
+      else
+      {
+        // Running threads will get to the task eventually
+        static_cast<void>(::InterlockedDecrement(&s_NumIoThreads));
+      }
+      return;
+    }
+    numThreads = previous;
+  }
+
+  // At the limit. The task waits for a thread to finish.
+}
+
+/// <summary>
+/// Wakes the main thread. Goes to the window once there is one, as modal loops (moving, resizing, popup menus)
+/// dispatch window messages but drop thread messages, and a lost message would leave the completions stuck.
+/// </summary>
+static void PostCompletionMessage()
+{
+  // Deterministic mode hands out completions in ThreadpoolStep
+  if (!IsThreaded())
+  {
+    return;
+  }
+
+  ZoneScopedNC("PostMessageW", 0x31332C);
+
+  // Fails once the window is gone, the message loop may still be running
+  HWND hWnd = static_cast<HWND>(::ReadPointerAcquire(reinterpret_cast<PVOID const volatile*>(&s_hMainWindow)));
+  if (!hWnd || !::PostMessageW(hWnd, s_Msg, 0, 0))
+  {
+    MJ_ERR_ZERO(::PostThreadMessageW(s_MainThreadId, s_Msg, 0, 0));
+  }
+}
+
+/// <summary>
+/// Hands a finished task, or a main thread task that is ready to run, to the main thread.
+/// Only the first task of a batch posts a message, the rest are picked up by the same
+/// ThreadpoolDrainCompletions call.
+/// </summary>
+static void PushCompletedTask(mj::Task* pTask)
+{
+  static_cast<void>(::InterlockedIncrement(&s_NumCompletions));
+
+  mj::Task* pHead = s_pCompletedTasks;
+  while (true)
+  {
+    pTask->pState->pNextTask = pHead;
+    mj::Task* pPrevious      = static_cast<mj::Task*>(::InterlockedCompareExchangePointer(
+        reinterpret_cast<PVOID volatile*>(&s_pCompletedTasks), pTask, pHead));
+    if (pPrevious == pHead)
+    {
+      break;
+    }
+    pHead = pPrevious;
+  }
+
+  if (!pHead)
+  {
+    PostCompletionMessage();
+  }
+}
+
+/// <summary>
+/// Sends a task whose predecessors have all ended to the thread it should run on.
+/// </summary>
+static void ScheduleTask(mj::Task* pTask)
+{
+  pTask->pState->readyTime = GetTime();
+
+  if (!IsThreaded())
+  {
+    // Waits for ThreadpoolStep
+    if (pTask->runOnMainThread)
+    {
+      PushCompletedTask(pTask);
+    }
+    else
+    {
+      InjectTask(pTask);
+    }
+    if (s_ExecutorMode == mj::EExecutorMode::Inline)
+    {
+      mj::ThreadpoolRunUntilIdle();
+    }
+    return;
+  }
+
+  if (pTask->runOnMainThread)
+  {
+    PushCompletedTask(pTask);
+    return;
+  }
+
+  if (pTask->kind == mj::ETaskKind::Io)
+  {
+    InjectTask(pTask);
+    WakeIoThread();
+    return;
+  }
+
+  // Workers keep their own tasks close, everyone else goes through the lanes
+  mj::detail::Worker* pWorker = CurrentWorker();
+  if (!pWorker || !pWorker->deque.Push(pTask))
+  {
+    InjectTask(pTask);
+  }
+
+  WakeWorker();
+}
+
+static void ReleaseTask(mj::Task* pTask)
+{
+  if (::InterlockedDecrement(&pTask->pState->numBlockers) == 0)
+  {
+    ScheduleTask(pTask);
+  }
+}
+
+/// <summary>
+/// Milliseconds. Only advanced by ThreadpoolAdvanceTime in deterministic mode.
+/// </summary>
+static uint64_t GetTimerTime()
+{
+  return IsThreaded() ? ::GetTickCount64() : s_VirtualTime;
+}
+
+/// <summary>
+/// Timer wheel resolution. GetTickCount64 only advances every 10-16 ms anyway.
+/// </summary>
+static constexpr uint64_t TIMER_TICK_MS = 8;
+
+/// <summary>
+/// Number of wheel slots. Must be a power of two. Timers further out than one revolution
+/// (about two seconds) wait in their slot until their tick comes around.
+/// </summary>
+static constexpr uint64_t TIMER_NUM_SLOTS = 256;
+
+/// <summary>
+/// Number of ids that can be debounced or throttled at the same time.
+/// </summary>
+static constexpr size_t MAX_DEBOUNCE_SLOTS = 64;
+
+namespace mj
+{
+  namespace detail
+  {
+    struct DebounceSlot
+    {
+      uint32_t id;
+      Task* pTask;      // Pending task, if any
+      uint64_t lastRun; // Tick count of the last time the pending task ended
+    };
+  } // namespace detail
+} // namespace mj
+
+/// <summary>
+/// Intrusive doubly linked list per slot, so debouncing can take a task out in O(1).
+/// </summary>
+struct TimerSlot
+{
+  mj::Task* pHead;
+};
+
+static SRWLOCK s_TimerLock = SRWLOCK_INIT;
+static TimerSlot s_TimerSlots[TIMER_NUM_SLOTS];
+static uint64_t s_TimerLastTick; // Last tick processed by the timer thread
+static uint64_t s_TimerNextTick; // Earliest tick the timer thread is waiting for, UINT64_MAX if none
+static volatile LONG s_NumTimers;
+static volatile LONG s_TimerEpoch; // The timer thread waits on this
+static HANDLE s_hTimerThread;
+
+// Main thread only
+static mj::detail::DebounceSlot s_DebounceSlots[MAX_DEBOUNCE_SLOTS];
+static size_t s_NumDebounceSlots;
+
+static void TimerRemoveLocked(mj::Task* pTask)
+{
+  TimerSlot& slot = s_TimerSlots[pTask->pState->dueTick & (TIMER_NUM_SLOTS - 1)];
+  if (pTask->pState->pPrevTask)
+  {
+    pTask->pState->pPrevTask->pState->pNextTask = pTask->pState->pNextTask;
+  }
+  else
+  {
+    slot.pHead = pTask->pState->pNextTask;
+  }
+  if (pTask->pState->pNextTask)
+  {
+    pTask->pState->pNextTask->pState->pPrevTask = pTask->pState->pPrevTask;
+  }
+  pTask->pState->delayed = false;
+  static_cast<void>(::InterlockedDecrement(&s_NumTimers));
+}
+
+/// <summary>
+/// Releases the task after at least delayMs milliseconds.
+/// </summary>
+static void AddTimer(mj::Task* pTask, uint32_t delayMs)
+{
+  const uint64_t due = GetTimerTime() + delayMs;
+
+  LockExclusive(&s_TimerLock);
+
+  // Round up, and never into a tick that was already processed
+  uint64_t dueTick = (due + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+  if (dueTick <= s_TimerLastTick)
+  {
+    dueTick = s_TimerLastTick + 1;
+  }
+
+  TimerSlot& slot          = s_TimerSlots[dueTick & (TIMER_NUM_SLOTS - 1)];
+  pTask->pState->dueTick   = dueTick;
+  pTask->pState->pPrevTask = nullptr;
+  pTask->pState->pNextTask = slot.pHead;
+  if (slot.pHead)
+  {
+    slot.pHead->pState->pPrevTask = pTask;
+  }
+  slot.pHead             = pTask;
+  pTask->pState->delayed = true;
+  static_cast<void>(::InterlockedIncrement(&s_NumTimers));
+
+  // The timer thread sleeps until the earliest timer it knows of
+  const bool wake = dueTick < s_TimerNextTick;
+  if (wake)
+  {
+    s_TimerNextTick = dueTick;
+  }
+
+  UnlockExclusive(&s_TimerLock);
+
+  if (wake)
+  {
+    WakeOne(&s_TimerEpoch);
+  }
+}
+
+/// <summary>
+/// Releases all timers that have expired since the last call.
+/// </summary>
+/// <returns>The tick at which the earliest remaining timer is due, or UINT64_MAX if there is none.</returns>
+static uint64_t ProcessTimers()
+{
+  const uint64_t now = GetTimerTime() / TIMER_TICK_MS;
+
+  // Collect expired timers, and release them outside of the lock
+  mj::Task* pExpired = nullptr;
+
+  LockExclusive(&s_TimerLock);
+  uint64_t first = s_TimerLastTick + 1;
+  if (now >= TIMER_NUM_SLOTS && first < now - TIMER_NUM_SLOTS + 1)
+  {
+    // Fell behind by more than a revolution, every slot is visited once
+    first = now - TIMER_NUM_SLOTS + 1;
+  }
+  for (uint64_t tick = first; tick <= now; tick++)
+  {
+    mj::Task* pTask = s_TimerSlots[tick & (TIMER_NUM_SLOTS - 1)].pHead;
+    while (pTask)
+    {
+      mj::Task* pNext = pTask->pState->pNextTask;
+      if (pTask->pState->dueTick <= now)
+      {
+        TimerRemoveLocked(pTask);
+        pTask->pState->pNextTask = pExpired;
+        pExpired                 = pTask;
+      }
+      pTask = pNext;
+    }
+  }
+  if (now > s_TimerLastTick)
+  {
+    s_TimerLastTick = now;
+  }
+
+  // Timers are few, and this only runs when one is due
+  uint64_t nextTick = UINT64_MAX;
+  if (::ReadNoFence(&s_NumTimers) > 0)
+  {
+    for (const TimerSlot& slot : s_TimerSlots)
+    {
+      for (mj::Task* pTask = slot.pHead; pTask; pTask = pTask->pState->pNextTask)
+      {
+        nextTick = pTask->pState->dueTick < nextTick ? pTask->pState->dueTick : nextTick;
+      }
+    }
+  }
+  s_TimerNextTick = nextTick;
+  UnlockExclusive(&s_TimerLock);
+
+  while (pExpired)
+  {
+    mj::Task* pNext = pExpired->pState->pNextTask;
+    ReleaseTask(pExpired);
+    pExpired = pNext;
+  }
+
+  return nextTick;
+}
+
+static DWORD WINAPI TimerThreadMain(LPVOID lpThreadParameter)
+{
+#ifdef TRACY_ENABLE
+  tracy::SetThreadName("Threadpool timer thread");
+#endif
+  static_cast<void>(lpThreadParameter);
+
+  while (!::ReadAcquire(&s_Quit))
+  {
+    // Read the epoch first, so a sooner timer added after ProcessTimers still wakes us
+    LONG epoch              = ::ReadAcquire(&s_TimerEpoch);
+    const uint64_t nextTick = ProcessTimers();
+
+    DWORD timeout = INFINITE;
+    if (nextTick != UINT64_MAX)
+    {
+      const uint64_t now   = GetTimerTime();
+      const uint64_t due   = nextTick * TIMER_TICK_MS;
+      const uint64_t delay = due > now ? due - now : 0;
+      timeout              = delay < MAXLONG ? static_cast<DWORD>(delay) : MAXLONG;
+    }
+    static_cast<void>(::WaitOnAddress(&s_TimerEpoch, &epoch, sizeof(epoch), timeout));
+  }
+
+  return 0;
+}
+
+static mj::detail::DebounceSlot* FindDebounceSlot(uint32_t id)
+{
+  for (size_t i = 0; i < s_NumDebounceSlots; i++)
+  {
+    if (s_DebounceSlots[i].id == id)
+    {
+      return &s_DebounceSlots[i];
+    }
+  }
+
+  // Reuse an idle slot before taking a new one
+  for (size_t i = 0; i < s_NumDebounceSlots; i++)
+  {
+    if (!s_DebounceSlots[i].pTask)
+    {
+      s_DebounceSlots[i].id      = id;
+      s_DebounceSlots[i].lastRun = 0;
+      return &s_DebounceSlots[i];
+    }
+  }
+
+  if (s_NumDebounceSlots < MAX_DEBOUNCE_SLOTS)
+  {
+    mj::detail::DebounceSlot* pSlot = &s_DebounceSlots[s_NumDebounceSlots++];
+    pSlot->id                       = id;
+    pSlot->pTask                    = nullptr;
+    pSlot->lastRun                  = 0;
+    return pSlot;
+  }
+
+  return nullptr;
+}
+
+static DWORD WINAPI ThreadMain(LPVOID lpThreadParameter)
+{
+#ifdef TRACY_ENABLE
+  tracy::SetThreadName("Threadpool thread");
+#endif
+  mj::detail::Worker* pWorker = static_cast<mj::detail::Worker*>(lpThreadParameter);
+  MJ_ERR_ZERO(::TlsSetValue(s_WorkerTlsIndex, reinterpret_cast<LPVOID>(static_cast<uintptr_t>(pWorker->index + 1))));
+
+  // Created here rather than in ThreadpoolInit, so the first touch of new blocks happens on the worker's own node
+  mj::ArenaAllocator* pScratch = mj::ArenaAllocator::Create();
+  MJ_EXIT_NULL(pScratch);
+  MJ_DEFER(pScratch->Destroy());
+  MJ_ERR_ZERO(::TlsSetValue(s_ScratchTlsIndex, pScratch));
+
+  while (!::ReadAcquire(&s_Quit))
+  {
+    mj::Task* pTask = FindTask(pWorker);
+    if (!pTask)
+    {
+      pTask = SpinForTask(pWorker);
+    }
+    if (!pTask)
+    {
+      pTask = ParkWorker(pWorker);
+    }
+
+    if (pTask)
+    {
+      // Cancelled tasks still go back to the main thread, to be destroyed there
+      if (!pTask->IsCancelled())
+      {
+        const uint64_t time = ExecuteTask(pTask);
+        ::WriteNoFence64(&pWorker->busyTime, ::ReadNoFence64(&pWorker->busyTime) + static_cast<LONG64>(time));
+        ::WriteNoFence64(&pWorker->numTasksRun, ::ReadNoFence64(&pWorker->numTasksRun) + 1);
+      }
+
+      PushCompletedTask(pTask);
+    }
+  }
+
+  return 0;
+}
+
+static DWORD WINAPI IoThreadMain(LPVOID lpThreadParameter)
+{
+#ifdef TRACY_ENABLE
+  tracy::SetThreadName("Threadpool I/O thread");
+#endif
+  static_cast<void>(lpThreadParameter);
+
+  mj::ArenaAllocator* pScratch = mj::ArenaAllocator::Create();
+  MJ_EXIT_NULL(pScratch);
+  MJ_DEFER(pScratch->Destroy());
+  MJ_ERR_ZERO(::TlsSetValue(s_ScratchTlsIndex, pScratch));
+
+  while (!::ReadAcquire(&s_Quit))
+  {
+    mj::Task* pTask = FindIoTask();
+    if (!pTask)
+    {
+      static_cast<void>(::InterlockedIncrement(&s_NumIdleIoThreads));
+      LONG epoch = ::ReadAcquire(&s_IoWakeEpoch);
+
+      pTask         = FindIoTask();
+      bool timedOut = false;
+      if (!pTask && !::ReadAcquire(&s_Quit))
+      {
+        ZoneScopedNC("Sleeping", 0x21231C);
+        timedOut = !::WaitOnAddress(&s_IoWakeEpoch, &epoch, sizeof(epoch), IO_THREAD_IDLE_TIMEOUT_MS) &&
+                   ::GetLastError() == ERROR_TIMEOUT;
+      }
+
+      static_cast<void>(::InterlockedDecrement(&s_NumIdleIoThreads));
+
+      if (!pTask && timedOut)
+      {
+        // A submitter may have counted on us before we stopped being idle
+        pTask = FindIoTask();
+        if (!pTask)
+        {
+          break;
+        }
+      }
+    }
+
+    if (pTask)
+    {
+      if (!pTask->IsCancelled())
+      {
+        static_cast<void>(ExecuteTask(pTask));
+      }
+
+      PushCompletedTask(pTask);
+    }
+  }
+
+  static_cast<void>(::InterlockedDecrement(&s_NumIoThreads));
+  return 0;
+}
+
+/// <summary>
+/// Everything both modes need before the first task is created.
+/// </summary>
+static void InitCommon(DWORD threadId, UINT userMessage, mj::EExecutorMode::Enum mode)
+{
+  s_MainThreadId = threadId;
+  s_Msg          = userMessage;
+  s_hMainWindow  = nullptr;
+  s_Quit         = 0;
+  s_ExecutorMode = mode;
+  s_VirtualTime  = 0;
+
+  s_pMainThreadScratch = mj::ArenaAllocator::Create();
+  MJ_EXIT_NULL(s_pMainThreadScratch);
+
+  if (IsThreaded())
+  {
+    MJ_ERR_IF(s_WorkerTlsIndex = ::TlsAlloc(), TLS_OUT_OF_INDEXES);
+    MJ_ERR_IF(s_ScratchTlsIndex = ::TlsAlloc(), TLS_OUT_OF_INDEXES);
+
+    MJ_UNINITIALIZED LARGE_INTEGER frequency;
+    static_cast<void>(::QueryPerformanceFrequency(&frequency));
+    s_PerformanceFrequency = frequency.QuadPart;
+  }
+  else
+  {
+    // GetTime reads the virtual clock
+    s_PerformanceFrequency = 1000;
+  }
+  s_StartTime = static_cast<LONG64>(GetTime());
+
+  for (int i = 0; i < mj::ETaskSize::Huge; i++)
+  {
+    s_TaskContextPools[i].Init(mj::detail::ThreadpoolGetTaskSize(static_cast<mj::ETaskSize::Enum>(i)), SLAB_SIZES[i],
+                               NUM_INITIAL_SLABS[i]);
+  }
+  s_TaskStatePool.Init(sizeof(mj::detail::TaskState), STATE_SLAB_SIZE, NUM_INITIAL_STATE_SLABS);
+
+  s_TimerLastTick = GetTimerTime() / TIMER_TICK_MS;
+  s_TimerNextTick = UINT64_MAX;
+}
+
+/// <summary>
+/// Applies the placement to a suspended worker thread.
+/// Failure is not fatal, the worker just runs wherever the scheduler puts it.
+/// </summary>
+static void PlaceWorker(HANDLE hThread, const mj::LogicalProcessor& processor, mj::EThreadPlacement::Enum placement)
+{
+  if (placement == mj::EThreadPlacement::None)
+  {
+    return;
+  }
+
+  GROUP_AFFINITY affinity = {};
+  affinity.Group          = processor.number.Group;
+  if (placement == mj::EThreadPlacement::Pinned)
+  {
+    affinity.Mask = static_cast<KAFFINITY>(1) << processor.number.Number;
+  }
+  else
+  {
+    // A node can span groups, but a thread can only run in one. Take the part in this processor's group.
+    for (uint32_t i = 0; i < s_Topology.numLogicalProcessors; i++)
+    {
+      const mj::LogicalProcessor& other = s_Topology.processors[i];
+      if (other.numaNode == processor.numaNode && other.number.Group == processor.number.Group)
+      {
+        affinity.Mask |= static_cast<KAFFINITY>(1) << other.number.Number;
+      }
+    }
+  }
+
+  static_cast<void>(::SetThreadGroupAffinity(hThread, &affinity, nullptr));
+
+  PROCESSOR_NUMBER idealProcessor = processor.number;
+  static_cast<void>(::SetThreadIdealProcessorEx(hThread, &idealProcessor, nullptr));
+}
+
+void mj::ThreadpoolInit(DWORD threadId, UINT userMessage, const mj::ThreadpoolOptions* pOptions)
+{
+  ZoneScoped;
+
+  InitCommon(threadId, userMessage, mj::EExecutorMode::Threaded);
+
+  mj::ThreadpoolOptions options = {};
+  options.placement             = mj::EThreadPlacement::Node;
+  if (pOptions)
+  {
+    options = *pOptions;
+  }
+
+  s_HasTopology = mj::QueryCpuTopology(&s_Topology);
+  if (!s_HasTopology)
+  {
+    // Treat it as a single node, and leave placement to the scheduler
+    s_Topology.numLogicalProcessors = 0;
+    s_Topology.numNumaNodes         = 1;
+    options.placement               = mj::EThreadPlacement::None;
+  }
+
+  // One worker per logical processor, except for the one running the main thread
+  s_NumWorkers = options.numWorkers;
+  if (s_NumWorkers == 0)
+  {
+    DWORD numProcessors = ::GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    s_NumWorkers        = numProcessors > 1 ? numProcessors - 1 : 1;
+  }
+  if (s_NumWorkers > MAX_THREADS)
+  {
+    s_NumWorkers = MAX_THREADS;
+  }
+
+  for (uint32_t i = 0; i < s_NumWorkers; i++)
+  {
+    mj::detail::Worker& worker = s_Workers[i];
+    worker.deque.Init();
+    worker.rng.seed(0x9E3779B9 ^ i, 0x243F6A88 + i, 0xB7E15162, 0x7F4A7C15 * (i + 1));
+    worker.index       = i;
+    worker.busyTime    = 0;
+    worker.numTasksRun = 0;
+    worker.numSpinHits = 0;
+    worker.numParks    = 0;
+    worker.spinBudget  = SPIN_BUDGET_INITIAL;
+
+    // More workers than processors wrap around to the start of the placement order
+    worker.numaNode = s_HasTopology ? s_Topology.processors[i % s_Topology.numLogicalProcessors].numaNode : 0;
+  }
+
+  MJ_ERR_IF(s_hTimerThread = ::CreateThread(nullptr, 0, TimerThreadMain, nullptr, 0, nullptr), nullptr);
+
+  for (uint32_t i = 0; i < s_NumWorkers; i++)
+  {
+    ZoneScopedN("CreateThread");
+    MJ_ERR_IF(s_Workers[i].hThread = ::CreateThread(nullptr,          // default security attributes
+                                                    0,                // default stack size
+                                                    ThreadMain,       // entry point
+                                                    &s_Workers[i],    // argument
+                                                    CREATE_SUSPENDED, // placed before it touches any memory
+                                                    nullptr),
+              nullptr);
+
+    if (s_HasTopology)
+    {
+      PlaceWorker(s_Workers[i].hThread, s_Topology.processors[i % s_Topology.numLogicalProcessors],
+                  options.placement);
+    }
+    MJ_ERR_IF(::ResumeThread(s_Workers[i].hThread), static_cast<DWORD>(-1));
+  }
+}
+
+void mj::ThreadpoolInitDeterministic(mj::EExecutorMode::Enum mode, uint64_t seed)
+{
+  ZoneScoped;
+
+  // Everything runs on the calling thread, so there is no main thread to tell apart
+  InitCommon(0, 0, mode);
+  s_StepRng.seed(static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32), 0x9E3779B9, 0x243F6A88);
+
+  // No workers, so ParallelFor runs on the calling thread
+  s_NumWorkers                    = 0;
+  s_HasTopology                   = false;
+  s_Topology.numLogicalProcessors = 0;
+  s_Topology.numNumaNodes         = 1;
+}
+
+/// <summary>
+/// Takes a queued task by position, counting through all lanes in the order they are served.
+/// </summary>
+static mj::Task* TakeQueuedTask(uint32_t index)
+{
+  mj::Task* pTask = nullptr;
+
+  LockExclusive(&s_LaneLock);
+  for (int i = 0; i < mj::ETaskKind::COUNT && !pTask; i++)
+  {
+    for (int j = 0; j < mj::ETaskPriority::COUNT && !pTask; j++)
+    {
+      const uint32_t size = static_cast<uint32_t>(s_Lanes[i][j].size);
+      if (index < size)
+      {
+        pTask = s_Lanes[i][j].pHead;
+        for (uint32_t k = 0; k < index; k++)
+        {
+          pTask = pTask->pState->pNextTask;
+        }
+        LaneRemoveLocked(pTask);
+      }
+      index -= size;
+    }
+  }
+  UnlockExclusive(&s_LaneLock);
+
+  return pTask;
+}
+
+/// <summary>
+/// Takes a finished task by position, oldest first.
+/// </summary>
+static mj::Task* TakeCompletedTask(uint32_t index)
+{
+  // The stack is newest first
+  const uint32_t position = static_cast<uint32_t>(s_NumCompletions) - 1 - index;
+
+  mj::Task* volatile* ppLink = &s_pCompletedTasks;
+  for (uint32_t i = 0; i < position; i++)
+  {
+    ppLink = &(*ppLink)->pState->pNextTask;
+  }
+
+  mj::Task* pTask = *ppLink;
+  *ppLink         = pTask->pState->pNextTask;
+  static_cast<void>(::InterlockedDecrement(&s_NumCompletions));
+  return pTask;
+}
+
+bool mj::ThreadpoolStep()
+{
+  MJ_ERR_IF(s_ExecutorMode, mj::EExecutorMode::Threaded);
+
+  // Every queued Execute and every pending OnDone is a candidate
+  const uint32_t numCompleted = static_cast<uint32_t>(s_NumCompletions);
+  uint32_t numQueued          = 0;
+  for (int i = 0; i < mj::ETaskKind::COUNT; i++)
+  {
+    for (int j = 0; j < mj::ETaskPriority::COUNT; j++)
+    {
+      numQueued += static_cast<uint32_t>(s_Lanes[i][j].size);
+    }
+  }
+
+  if (numCompleted + numQueued == 0)
+  {
+    return false;
+  }
+
+  // Inline: OnDone right after Execute, otherwise in lane order.
+  // Seeded: any order, like threads finishing and the main thread draining at random moments.
+  uint32_t index = 0;
+  if (s_ExecutorMode == mj::EExecutorMode::Seeded)
+  {
+    index = s_StepRng.next() % (numCompleted + numQueued);
+  }
+
+  if (index < numCompleted)
+  {
+    mj::Task* pTask = TakeCompletedTask(index);
+    if (pTask->runOnMainThread && !pTask->IsCancelled())
+    {
+      static_cast<void>(ExecuteTask(pTask));
+    }
+    mj::ThreadpoolTaskEnd(pTask);
+  }
+  else
+  {
+    mj::Task* pTask = TakeQueuedTask(index - numCompleted);
+    if (!pTask->IsCancelled())
+    {
+      static_cast<void>(ExecuteTask(pTask));
+    }
+    PushCompletedTask(pTask);
+  }
+
+  return true;
+}
+
+void mj::ThreadpoolRunUntilIdle()
+{
+  // Tasks submitted by a step are picked up by the loop that is already running
+  if (s_Stepping)
+  {
+    return;
+  }
+
+  s_Stepping = true;
+  while (mj::ThreadpoolStep())
+  {
+  }
+  s_Stepping = false;
+}
+
+void mj::ThreadpoolAdvanceTime(uint32_t ms)
+{
+  MJ_ERR_IF(s_ExecutorMode, mj::EExecutorMode::Threaded);
+
+  s_VirtualTime += ms;
+  static_cast<void>(ProcessTimers());
+}
+
+void mj::ThreadpoolTaskEnd(mj::Task* pTask)
+{
+  const bool cancelled              = pTask->IsCancelled();
+  mj::detail::TaskTypeStats* pStats = GetTaskTypeStats(pTask);
+  if (cancelled)
+  {
+    static_cast<void>(::InterlockedIncrement64(&pStats->numCancelled));
+  }
+  else
+  {
+    if (pTask->pState->endTime)
+    {
+      const uint64_t completionTime = GetTime() - pTask->pState->endTime;
+      pStats->latencies[mj::ETaskLatency::Completion].Record(TimeToMicroseconds(completionTime));
+    }
+    pTask->OnDone();
+  }
+
+  if (pTask->pState->pDebounceSlot)
+  {
+    // A newer task may have taken over the slot already
+    if (pTask->pState->pDebounceSlot->pTask == pTask)
+    {
+      pTask->pState->pDebounceSlot->pTask   = nullptr;
+      pTask->pState->pDebounceSlot->lastRun = GetTimerTime();
+    }
+    pTask->pState->pDebounceSlot = nullptr;
+  }
+
+  if (pTask->periodMs > 0 && !cancelled)
+  {
+    // Periodic tasks live on until they are cancelled
+    if (pTask->pState->pOutputArena)
+    {
+      pTask->pState->pOutputArena->Reset();
+    }
+    pTask->pState->numBlockers = 1;
+    AddTimer(pTask, pTask->periodMs);
+    return;
+  }
+
+  // Successors start now that our results have been handed out.
+  // They cannot do their work without them, so cancellation carries over.
+  mj::detail::TaskEdge* pEdge = pTask->pState->pSuccessors;
+  while (pEdge)
+  {
+    mj::detail::TaskEdge* pNext = pEdge->pNext;
+    if (cancelled)
+    {
+      pEdge->pSuccessor->cancelled = true;
+    }
+    ReleaseTask(pEdge->pSuccessor);
+    static_cast<void>(::HeapFree(::GetProcessHeap(), 0, pEdge));
+    pEdge = pNext;
+  }
+
+  mj::detail::TaskState* pState = pTask->pState;
+  pTask->Destroy();
+  if (pState->pOutputArena)
+  {
+    pState->pOutputArena->Destroy();
+  }
+  ThreadpoolFreeTaskContext(reinterpret_cast<mj::TaskContext*>(pTask), pState->size);
+  s_TaskStatePool.Free(pState);
+}
+
+void mj::ThreadpoolSetMainWindow(HWND hWnd)
+{
+  ::WritePointerRelease(reinterpret_cast<PVOID volatile*>(&s_hMainWindow), hWnd);
+
+  // A message posted to the thread queue just before may not be seen until the next modal loop has ended
+  if (hWnd && ::ReadPointerAcquire(reinterpret_cast<PVOID const volatile*>(&s_pCompletedTasks)))
+  {
+    PostCompletionMessage();
+  }
+}
+
+void mj::ThreadpoolDrainCompletions()
+{
+  ZoneScoped;
+
+  mj::Task* pTask = static_cast<mj::Task*>(
+      ::InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&s_pCompletedTasks), nullptr));
+
+  // Reverse, so tasks end in the order they finished
+  mj::Task* pOrdered = nullptr;
+  mj::Task* pLast    = pTask;
+  LONG numTasks      = 0;
+  while (pTask)
+  {
+    mj::Task* pNext          = pTask->pState->pNextTask;
+    pTask->pState->pNextTask = pOrdered;
+    pOrdered                 = pTask;
+    pTask                    = pNext;
+    numTasks++;
+  }
+  static_cast<void>(::InterlockedExchangeAdd(&s_NumCompletions, -numTasks));
+
+  if (pOrdered)
+  {
+    if (s_pDrainTail)
+    {
+      s_pDrainTail->pState->pNextTask = pOrdered;
+    }
+    else
+    {
+      s_pDrainHead = pOrdered;
+    }
+    s_pDrainTail = pLast;
+  }
+
+  // A task may run a modal loop (e.g. a popup menu) which calls this again.
+  // The nested call carries on with the tasks the outer one has not ended yet, so the order holds.
+  while (s_pDrainHead)
+  {
+    pTask        = s_pDrainHead;
+    s_pDrainHead = pTask->pState->pNextTask;
+    if (!s_pDrainHead)
+    {
+      s_pDrainTail = nullptr;
+    }
+
+    // Main thread tasks arrive here unexecuted
+    if (pTask->runOnMainThread && !pTask->IsCancelled())
+    {
+      static_cast<void>(ExecuteTask(pTask));
+    }
+    mj::ThreadpoolTaskEnd(pTask);
+  }
+}
+
+void mj::ThreadpoolDestroy()
+{
+  if (s_pStatsDumpTask)
+  {
+    mj::ThreadpoolCancelTask(s_pStatsDumpTask);
+    s_pStatsDumpTask = nullptr;
+  }
+
+  // Workers finish the task they are running, then exit
+  ::WriteRelease(&s_Quit, 1);
+  WakeAll(&s_WakeEpoch);
+  WakeAll(&s_IoWakeEpoch);
+
+  for (uint32_t i = 0; i < s_NumWorkers; i++)
+  {
+    ::CloseHandle(s_Workers[i].hThread);
+    s_Workers[i].hThread = nullptr;
+  }
+  s_NumWorkers = 0;
+
+  WakeAll(&s_TimerEpoch);
+  if (s_hTimerThread)
+  {
+    ::CloseHandle(s_hTimerThread);
+    s_hTimerThread = nullptr;
+  }
+
+  // Slabs are never released, as workers may still be finishing their last task.
+}
+
+void mj::ThreadpoolSubmitTask(mj::Task* pTask)
+{
+  ReleaseTask(pTask);
+}
+
+void mj::ThreadpoolAddDependency(mj::Task* pTask, mj::Task* pPredecessor)
+{
+  // Edges are only touched on the main thread, here and in ThreadpoolTaskEnd
+  mj::detail::TaskEdge* pEdge =
+      static_cast<mj::detail::TaskEdge*>(::HeapAlloc(::GetProcessHeap(), 0, sizeof(mj::detail::TaskEdge)));
+  MJ_EXIT_NULL(pEdge);
+
+  static_cast<void>(::InterlockedIncrement(&pTask->pState->numBlockers));
+  pEdge->pSuccessor                 = pTask;
+  pEdge->pNext                      = pPredecessor->pState->pSuccessors;
+  pPredecessor->pState->pSuccessors = pEdge;
+}
+
+void mj::ThreadpoolSetTaskPriority(mj::Task* pTask, mj::ETaskPriority::Enum priority)
+{
+  LockExclusive(&s_LaneLock);
+  if (pTask->priority != priority)
+  {
+    if (pTask->pState->queued)
+    {
+      LaneRemoveLocked(pTask);
+      pTask->priority = priority;
+      LanePushLocked(pTask);
+    }
+    else
+    {
+      pTask->priority = priority;
+    }
+  }
+  UnlockExclusive(&s_LaneLock);
+}
+
+void mj::ThreadpoolCancelTask(mj::Task* pTask)
+{
+  pTask->cancelled = true;
+
+  LockExclusive(&s_LaneLock);
+  bool queued = pTask->pState->queued;
+  if (queued)
+  {
+    LaneRemoveLocked(pTask);
+  }
+  UnlockExclusive(&s_LaneLock);
+
+  LockExclusive(&s_TimerLock);
+  if (pTask->pState->delayed)
+  {
+    TimerRemoveLocked(pTask);
+    queued = true;
+  }
+  UnlockExclusive(&s_TimerLock);
+
+  if (queued)
+  {
+    mj::ThreadpoolTaskEnd(pTask);
+  }
+}
+
+void mj::ThreadpoolPurgeCancelledTasks()
+{
+  ZoneScoped;
+
+  // Collect first, as Destroy can do anything, including submitting new tasks
+  mj::Task* pPurged = nullptr;
+
+  LockExclusive(&s_LaneLock);
+  for (int i = 0; i < mj::ETaskKind::COUNT; i++)
+  {
+    for (int j = 0; j < mj::ETaskPriority::COUNT; j++)
+    {
+      mj::Task* pTask = s_Lanes[i][j].pHead;
+      while (pTask)
+      {
+        mj::Task* pNext = pTask->pState->pNextTask;
+        if (pTask->IsCancelled())
+        {
+          LaneRemoveLocked(pTask);
+          pTask->pState->pNextTask = pPurged;
+          pPurged                  = pTask;
+        }
+        pTask = pNext;
+      }
+    }
+  }
+  UnlockExclusive(&s_LaneLock);
+
+  while (pPurged)
+  {
+    mj::Task* pNext = pPurged->pState->pNextTask;
+    mj::ThreadpoolTaskEnd(pPurged);
+    pPurged = pNext;
+  }
+}
+
+void mj::ThreadpoolSubmitTaskDelayed(mj::Task* pTask, uint32_t delayMs)
+{
+  if (delayMs == 0)
+  {
+    ReleaseTask(pTask);
+  }
+  else
+  {
+    AddTimer(pTask, delayMs);
+  }
+}
+
+void mj::ThreadpoolDebounce(uint32_t id, mj::Task* pTask, uint32_t delayMs)
+{
+  mj::detail::DebounceSlot* pSlot = FindDebounceSlot(id);
+  if (pSlot)
+  {
+    if (pSlot->pTask)
+    {
+      mj::ThreadpoolCancelTask(pSlot->pTask);
+    }
+    pSlot->pTask                 = pTask;
+    pTask->pState->pDebounceSlot = pSlot;
+  }
+
+  mj::ThreadpoolSubmitTaskDelayed(pTask, delayMs);
+}
+
+void mj::ThreadpoolThrottle(uint32_t id, mj::Task* pTask, uint32_t intervalMs)
+{
+  mj::detail::DebounceSlot* pSlot = FindDebounceSlot(id);
+  if (!pSlot)
+  {
+    mj::ThreadpoolSubmitTask(pTask);
+    return;
+  }
+
+  if (pSlot->pTask)
+  {
+    // The pending task covers this one
+    pTask->cancelled = true;
+    mj::ThreadpoolTaskEnd(pTask);
+    return;
+  }
+
+  const uint64_t now           = GetTimerTime();
+  const uint64_t next          = pSlot->lastRun + intervalMs;
+  pSlot->pTask                 = pTask;
+  pTask->pState->pDebounceSlot = pSlot;
+  mj::ThreadpoolSubmitTaskDelayed(pTask, next > now ? static_cast<uint32_t>(next - now) : 0);
+}
+
+const mj::CpuTopology* mj::ThreadpoolGetCpuTopology()
+{
+  return s_HasTopology ? &s_Topology : nullptr;
+}
+
+void mj::ThreadpoolGetStats(mj::ThreadpoolStats* pStats)
+{
+  ZoneScoped;
+
+  for (int i = 0; i < mj::ETaskKind::COUNT; i++)
+  {
+    for (int j = 0; j < mj::ETaskPriority::COUNT; j++)
+    {
+      pStats->numQueued[i][j] = static_cast<uint32_t>(::ReadNoFence(&s_Lanes[i][j].size));
+    }
+  }
+
+  pStats->numInDeques  = 0;
+  pStats->numWorkers   = s_NumWorkers;
+  pStats->numNumaNodes = s_Topology.numNumaNodes;
+  for (uint32_t i = 0; i < s_NumWorkers; i++)
+  {
+    const mj::detail::Worker& worker = s_Workers[i];
+
+    const LONG64 depth = ::ReadNoFence64(&worker.deque.bottom) - ::ReadNoFence64(&worker.deque.top);
+    if (depth > 0)
+    {
+      pStats->numInDeques += static_cast<uint32_t>(depth);
+    }
+
+    pStats->workerNumaNode[i] = worker.numaNode;
+    pStats->workerBusyUs[i]   = TimeToMicroseconds(static_cast<uint64_t>(::ReadNoFence64(&worker.busyTime)));
+    pStats->workerNumTasks[i] = static_cast<uint64_t>(::ReadNoFence64(&worker.numTasksRun));
+    pStats->workerSpinHits[i] = static_cast<uint64_t>(::ReadNoFence64(&worker.numSpinHits));
+    pStats->workerNumParks[i] = static_cast<uint64_t>(::ReadNoFence64(&worker.numParks));
+  }
+
+  pStats->numIoThreads     = static_cast<uint32_t>(::ReadNoFence(&s_NumIoThreads));
+  pStats->numIdleIoThreads = static_cast<uint32_t>(::ReadNoFence(&s_NumIdleIoThreads));
+
+  pStats->numDelayed     = static_cast<uint32_t>(::ReadNoFence(&s_NumTimers));
+  pStats->numCompletions = static_cast<uint32_t>(::ReadNoFence(&s_NumCompletions));
+  pStats->numParked      = static_cast<uint32_t>(::ReadNoFence(&s_NumParked));
+  pStats->numTasks       = static_cast<uint32_t>(::ReadNoFence(&s_NumTasks));
+  pStats->highWaterMark  = static_cast<uint32_t>(::ReadNoFence(&s_HighWaterMark));
+  pStats->timeUs         = TimeToMicroseconds(GetTime() - static_cast<uint64_t>(s_StartTime));
+
+  pStats->numTaskTypes = static_cast<uint32_t>(::ReadAcquire(&s_NumTaskTypes));
+  for (uint32_t i = 0; i < pStats->numTaskTypes; i++)
+  {
+    const mj::detail::TaskTypeStats& type = s_TaskTypes[i];
+    mj::ThreadpoolTaskTypeStats& out      = pStats->taskTypes[i];
+
+    out.pName        = type.name;
+    out.numCancelled = static_cast<uint64_t>(::ReadNoFence64(&type.numCancelled));
+    for (int j = 0; j < mj::ETaskLatency::COUNT; j++)
+    {
+      type.latencies[j].Read(&out.latencies[j]);
+    }
+  }
+}
+
+namespace mj
+{
+  namespace detail
+  {
+    struct StatsDumpTask : public Task
+    {
+      ThreadpoolStats stats;
+      uint64_t previousTimeUs;
+      uint64_t previousBusyUs[ThreadpoolStats::MAX_WORKERS];
+      uint64_t previousSpinHits[ThreadpoolStats::MAX_WORKERS];
+      uint64_t previousNumParks[ThreadpoolStats::MAX_WORKERS];
+
+      virtual void Execute() override
+      {
+        ZoneScoped;
+
+        ThreadpoolGetStats(&this->stats);
+
+        ArrayList<wchar_t> al;
+        al.Init(svc::GeneralPurposeAllocator());
+        MJ_DEFER(al.Destroy());
+        StringBuilder sb;
+        sb.SetArrayList(&al);
+
+        static constexpr const wchar_t* laneNames[] = { L" interactive ", L", visible ", L", prefetch ",
+                                                        L", background " };
+        static_assert(sizeof(laneNames) / sizeof(*laneNames) == ETaskPriority::COUNT);
+
+        sb.Append(L"Threadpool: ")
+            .Append(this->stats.numTasks)
+            .Append(L" tasks (high water mark ")
+            .Append(this->stats.highWaterMark)
+            .Append(L"), queued");
+        for (int i = 0; i < ETaskPriority::COUNT; i++)
+        {
+          sb.Append(laneNames[i]).Append(this->stats.numQueued[ETaskKind::Cpu][i]);
+        }
+        sb.Append(L", I/O queued");
+        for (int i = 0; i < ETaskPriority::COUNT; i++)
+        {
+          sb.Append(laneNames[i]).Append(this->stats.numQueued[ETaskKind::Io][i]);
+        }
+        sb.Append(L", I/O threads ")
+            .Append(this->stats.numIoThreads)
+            .Append(L" (")
+            .Append(this->stats.numIdleIoThreads)
+            .Append(L" idle), in deques ")
+            .Append(this->stats.numInDeques)
+            .Append(L", delayed ")
+            .Append(this->stats.numDelayed)
+            .Append(L", completions ")
+            .Append(this->stats.numCompletions)
+            .Append(L", parked ")
+            .Append(this->stats.numParked)
+            .Append(L"\n  Utilization %:");
+
+        const uint64_t elapsedUs = this->stats.timeUs - this->previousTimeUs;
+        for (uint32_t i = 0; i < this->stats.numWorkers; i++)
+        {
+          const uint64_t busyUs = this->stats.workerBusyUs[i] - this->previousBusyUs[i];
+          sb.Append(L" ").Append(elapsedUs > 0 ? busyUs * 100 / elapsedUs : 0);
+          this->previousBusyUs[i] = this->stats.workerBusyUs[i];
+        }
+        this->previousTimeUs = this->stats.timeUs;
+
+        // Share of idle periods that ended while spinning, rather than in the kernel
+        sb.Append(L"\n  Spin hits %:");
+        for (uint32_t i = 0; i < this->stats.numWorkers; i++)
+        {
+          const uint64_t numSpinHits = this->stats.workerSpinHits[i] - this->previousSpinHits[i];
+          const uint64_t numWakeups  = numSpinHits + this->stats.workerNumParks[i] - this->previousNumParks[i];
+          sb.Append(L" ").Append(numWakeups > 0 ? numSpinHits * 100 / numWakeups : 0);
+          this->previousSpinHits[i] = this->stats.workerSpinHits[i];
+          this->previousNumParks[i] = this->stats.workerNumParks[i];
+        }
+
+        if (this->stats.numNumaNodes > 1)
+        {
+          sb.Append(L"\n  NUMA node:");
+          for (uint32_t i = 0; i < this->stats.numWorkers; i++)
+          {
+            sb.Append(L" ").Append(this->stats.workerNumaNode[i]);
+          }
+        }
+
+        static constexpr const wchar_t* latencyNames[] = { L"\n    wait", L"\n    run", L"\n    completion" };
+        static_assert(sizeof(latencyNames) / sizeof(*latencyNames) == ETaskLatency::COUNT);
+
+        for (uint32_t i = 0; i < this->stats.numTaskTypes; i++)
+        {
+          const ThreadpoolTaskTypeStats& type = this->stats.taskTypes[i];
+          sb.Append(L"\n  ")
+              .Append(type.pName)
+              .Append(L": ")
+              .Append(type.latencies[ETaskLatency::Run].count)
+              .Append(L" run, ")
+              .Append(type.numCancelled)
+              .Append(L" cancelled");
+          for (int j = 0; j < ETaskLatency::COUNT; j++)
+          {
+            const ThreadpoolLatencyStats& latency = type.latencies[j];
+            sb.Append(latencyNames[j])
+                .Append(L" us: mean ")
+                .Append(latency.meanUs)
+                .Append(L", p50 ")
+                .Append(latency.p50Us)
+                .Append(L", p90 ")
+                .Append(latency.p90Us)
+                .Append(L", p99 ")
+                .Append(latency.p99Us)
+                .Append(L", max ")
+                .Append(latency.maxUs);
+          }
+        }
+        sb.Append(L"\n");
+
+        ::OutputDebugStringW(sb.ToStringClosed().ptr);
+      }
+    };
+  } // namespace detail
+} // namespace mj
+
+void mj::ThreadpoolStartStatsDump(uint32_t periodMs)
+{
+  if (s_pStatsDumpTask)
+  {
+    s_pStatsDumpTask->periodMs = periodMs;
+    return;
+  }
+
+  auto pTask            = ThreadpoolCreateTask<mj::detail::StatsDumpTask>();
+  pTask->priority       = ETaskPriority::Background;
+  pTask->periodMs       = periodMs;
+  pTask->previousTimeUs = 0;
+  for (uint32_t i = 0; i < mj::ThreadpoolStats::MAX_WORKERS; i++)
+  {
+    pTask->previousBusyUs[i]   = 0;
+    pTask->previousSpinHits[i] = 0;
+    pTask->previousNumParks[i] = 0;
+  }
+
+  s_pStatsDumpTask = pTask;
+  mj::ThreadpoolSubmitTaskDelayed(pTask, periodMs);
+}
+
+mj::AllocatorBase* mj::ThreadpoolGetScratchAllocator()
+{
+  return CurrentScratch();
+}
+
+mj::AllocatorBase* mj::ThreadpoolGetOutputAllocator(mj::Task* pTask)
+{
+  if (!pTask->pState->pOutputArena)
+  {
+    pTask->pState->pOutputArena = mj::ArenaAllocator::Create();
+  }
+  return pTask->pState->pOutputArena;
 }
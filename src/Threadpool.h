@@ -3,19 +3,176 @@
 
 namespace mj
 {
+  struct CpuTopology;
+
   // A cache line for work object context.
 #pragma warning(push)
 #pragma warning(disable : 4324) // structure was padded due to alignment specifier (Yes, we know. That's the point.)
   struct alignas(256) TaskContext
   {
     /// <summary>
-    /// (Internal) Pointer to next available TaskContext node
+    /// (Internal) Entry in the free list of the task context pool
     /// </summary>
-    TaskContext* pNextFreeNode;
+    SLIST_ENTRY freeListEntry;
   };
 #pragma warning(pop)
 
+  /// <summary>
+  /// Task contexts come in several sizes. ThreadpoolCreateTask picks the smallest one that fits the task.
+  /// </summary>
+  struct ETaskSize
+  {
+    enum Enum
+    {
+      Small,  // 256 bytes
+      Medium, // 1 KiB
+      Large,  // 4 KiB
+      Huge,   // Separate heap allocation
+    };
+  };
+
+  /// <summary>
+  /// Workers always pick the highest priority task available.
+  /// </summary>
+  struct ETaskPriority
+  {
+    enum Enum
+    {
+      Interactive, // The user is waiting for this, e.g. navigation
+      Visible,     // Affects what is on screen right now
+      Prefetch,    // Might be on screen soon
+      Background,  // Everything else
+      COUNT
+    };
+  };
+
+  /// <summary>
+  /// Which executor runs the task.
+  /// </summary>
+  struct ETaskKind
+  {
+    enum Enum
+    {
+      Cpu, // Fixed pool, one worker per core
+      Io,  // Elastic pool for tasks that block, e.g. on the file system. Grows while its threads are blocked.
+      COUNT
+    };
+  };
+
+  /// <summary>
+  /// Where worker threads run. Workers are assigned processors in topology order: one per physical core first,
+  /// grouped by NUMA node and L3 cache, then the SMT siblings.
+  /// </summary>
+  struct EThreadPlacement
+  {
+    enum Enum
+    {
+      None,   // Leave it to the scheduler. Threads stay in the processor group of the process.
+      Node,   // Restrict each worker to the NUMA node of its processor, and prefer that processor
+      Pinned, // Restrict each worker to its processor
+      COUNT
+    };
+  };
+
+  /// <summary>
+  /// How submitted tasks are run.
+  /// </summary>
+  struct EExecutorMode
+  {
+    enum Enum
+    {
+      Threaded, // Worker threads, completions are posted to the main thread
+      Inline,   // Deterministic. Tasks run on the submitting thread right away, OnDone right after Execute.
+      Seeded,   // Deterministic. Nothing runs until ThreadpoolStep, which picks the next Execute or OnDone
+                // at random from a seeded generator, to simulate interleavings.
+      COUNT
+    };
+  };
+
+  /// <summary>
+  /// Latencies the threadpool keeps a histogram of, per task type.
+  /// </summary>
+  struct ETaskLatency
+  {
+    enum Enum
+    {
+      Wait,       // From ready (submitted, and all predecessors ended) to the start of Execute
+      Run,        // Execute
+      Completion, // From the end of Execute to the start of OnDone
+      COUNT
+    };
+  };
+
+  /// <summary>
+  /// Lightweight handle to a CancellationSource, copied into tasks.
+  /// A zero-initialized token is never cancelled.
+  /// </summary>
+  struct CancellationToken
+  {
+    const volatile LONG* pGeneration;
+    LONG generation;
+
+    bool IsCancelled() const
+    {
+      return this->pGeneration && ::ReadAcquire(this->pGeneration) != this->generation;
+    }
+  };
+
+  /// <summary>
+  /// Cancels a group of tasks at once, e.g. all tasks started for one folder listing.
+  /// Lives in the object that owns the tasks, and must outlive them.
+  /// </summary>
+  class CancellationSource
+  {
+  private:
+    volatile LONG generation;
+
+  public:
+    void Init()
+    {
+      this->generation = 0;
+    }
+
+    /// <summary>
+    /// Cancels every token handed out so far. Tokens handed out afterwards are not cancelled.
+    /// </summary>
+    void Cancel()
+    {
+      static_cast<void>(::InterlockedIncrement(&this->generation));
+    }
+
+    CancellationToken Token() const
+    {
+      return { &this->generation, ::ReadAcquire(&this->generation) };
+    }
+  };
+
   struct Task;
+  class AllocatorBase;
+  class ArenaAllocator;
+
+  namespace detail
+  {
+    struct TaskState;
+
+    /// <summary>
+    /// Unique per task type, and readable enough for statistics. We have no RTTI.
+    /// </summary>
+    template <class T>
+    const char* ThreadpoolGetTaskTypeName()
+    {
+      return __FUNCSIG__;
+    }
+
+    /// <summary>
+    /// Links a task to one of the tasks waiting for it.
+    /// </summary>
+    struct TaskEdge
+    {
+      Task* pSuccessor;
+      TaskEdge* pNext;
+    };
+  } // namespace detail
 
   class ITaskCompletionHandler
   {
@@ -29,7 +186,7 @@ namespace mj
   struct Task
   {
     /// <summary>
-    /// Called from a threadpool thread.
+    /// Called from a threadpool thread, or from the main thread if runOnMainThread is set.
     /// </summary>
     virtual void Execute() = 0;
 
@@ -37,6 +194,7 @@ namespace mj
     /// Called in the main thread when the task is done.
     /// Do not use this method to clean up resources, as it doesn't get called when
     /// this task is cancelled. Use Destroy instead.
+    /// Execute may not have been called either, if the task was cancelled before it started.
     /// </summary>
     virtual void OnDone()
     {
@@ -52,42 +210,324 @@ namespace mj
       // Optional
     }
 
+    /// <summary>
+    /// Poll this in long loops inside Execute, and bail out early.
+    /// </summary>
+    bool IsCancelled() const
+    {
+      return this->cancelled || this->token.IsCancelled();
+    }
+
     ITaskCompletionHandler* pHandler;
-    bool cancelled;
+
+    /// <summary>
+    /// Use ThreadpoolCancelTask to set this.
+    /// </summary>
+    volatile bool cancelled;
+
+    /// <summary>
+    /// Optional. Cancels this task together with the rest of its group.
+    /// </summary>
+    CancellationToken token;
+
+    /// <summary>
+    /// Set before submitting. Use ThreadpoolSetTaskPriority afterwards.
+    /// </summary>
+    ETaskPriority::Enum priority;
+
+    /// <summary>
+    /// Set before submitting. Blocking tasks must use ETaskKind::Io, so they do not hold up CPU workers.
+    /// </summary>
+    ETaskKind::Enum kind;
+
+    /// <summary>
+    /// Set before submitting. Runs Execute on the main thread, for continuations that touch UI state.
+    /// </summary>
+    bool runOnMainThread;
+
+    /// <summary>
+    /// Set before submitting. If nonzero, the task runs again every periodMs milliseconds until it is cancelled.
+    /// OnDone is called after every run, Destroy only once the task is cancelled.
+    /// </summary>
+    uint32_t periodMs;
+
+    /// <summary>
+    /// (Internal) Scheduling state and statistics. Kept out of the task context, so it is left to the payload.
+    /// </summary>
+    detail::TaskState* pState;
   };
 
+  // The task header should stay within a cache line, so small tasks have most of their context to themselves
+  static_assert(sizeof(Task) <= 64);
+
   namespace detail
   {
-    TaskContext* ThreadpoolAllocTaskContext();
-  }
+    constexpr size_t ThreadpoolGetTaskSize(ETaskSize::Enum size)
+    {
+      return sizeof(TaskContext) << (2 * size);
+    }
+
+    constexpr ETaskSize::Enum ThreadpoolGetTaskSizeClass(size_t numBytes)
+    {
+      return numBytes <= ThreadpoolGetTaskSize(ETaskSize::Small)    ? ETaskSize::Small
+             : numBytes <= ThreadpoolGetTaskSize(ETaskSize::Medium) ? ETaskSize::Medium
+             : numBytes <= ThreadpoolGetTaskSize(ETaskSize::Large)  ? ETaskSize::Large
+                                                                    : ETaskSize::Huge;
+    }
+
+    /// <summary>
+    /// Safe to call from any thread.
+    /// </summary>
+    /// <param name="size">Size class</param>
+    /// <param name="numBytes">Only used for huge tasks</param>
+    TaskContext* ThreadpoolAllocTaskContext(ETaskSize::Enum size, size_t numBytes);
+
+    /// <summary>
+    /// Safe to call from any thread.
+    /// </summary>
+    /// <param name="size">Size class of the task context</param>
+    /// <param name="pTypeName">See ThreadpoolGetTaskTypeName</param>
+    TaskState* ThreadpoolAllocTaskState(ETaskSize::Enum size, const char* pTypeName);
+  } // namespace detail
+
+  struct ThreadpoolLatencyStats
+  {
+    uint64_t count;
+    uint64_t meanUs;
+    uint64_t p50Us;
+    uint64_t p90Us;
+    uint64_t p99Us;
+    uint64_t maxUs;
+  };
+
+  struct ThreadpoolTaskTypeStats
+  {
+    const wchar_t* pName;
+    uint64_t numCancelled;
+    ThreadpoolLatencyStats latencies[ETaskLatency::COUNT];
+  };
+
+  /// <summary>
+  /// Snapshot of the threadpool counters. Gauges are sampled without locks, so they may be slightly off.
+  /// Percentiles come from log-linear histograms, and are accurate to within 12.5%.
+  /// </summary>
+  struct ThreadpoolStats
+  {
+    static constexpr uint32_t MAX_WORKERS    = 64;
+    static constexpr uint32_t MAX_TASK_TYPES = 32; // The last one collects all types that did not fit
+
+    // Queue depths
+    uint32_t numQueued[ETaskKind::COUNT][ETaskPriority::COUNT]; // Lanes
+    uint32_t numInDeques;
+    uint32_t numDelayed;
+    uint32_t numCompletions; // Waiting for ThreadpoolDrainCompletions
+    uint32_t numParked;
+    uint32_t numTasks;
+    uint32_t highWaterMark;
+
+    // Compare two snapshots to get the utilization of each worker
+    uint64_t timeUs; // Since ThreadpoolInit
+    uint32_t numWorkers;
+    uint32_t numNumaNodes;
+    uint32_t workerNumaNode[MAX_WORKERS];
+    uint64_t workerBusyUs[MAX_WORKERS];
+    uint64_t workerNumTasks[MAX_WORKERS];
+    uint64_t workerSpinHits[MAX_WORKERS]; // Idle periods that ended while spinning
+    uint64_t workerNumParks[MAX_WORKERS]; // Idle periods that ended in the kernel
+
+    uint32_t numIoThreads;
+    uint32_t numIdleIoThreads;
+
+    uint32_t numTaskTypes;
+    ThreadpoolTaskTypeStats taskTypes[MAX_TASK_TYPES];
+  };
+
+  struct ThreadpoolOptions
+  {
+    uint32_t numWorkers; // Zero for one per logical processor, minus one for the main thread
+    EThreadPlacement::Enum placement;
+  };
 
   /// <summary>
   /// Initializes the threadpool system.
   /// </summary>
   /// <param name="threadId">Thread ID of the window message queue</param>
-  /// <param name="userMessage">The message to send. Should be WM_USER + some number.</param>
-  void ThreadpoolInit(DWORD threadId, UINT userMessage);
+  /// <param name="userMessage">
+  /// The message to send when tasks are done. Should be WM_USER + some number.
+  /// Posted to the thread until ThreadpoolSetMainWindow is called, then to the window.
+  /// </param>
+  /// <param name="pOptions">Optional. Defaults to one worker per logical processor, placed by NUMA node.</param>
+  void ThreadpoolInit(DWORD threadId, UINT userMessage, const ThreadpoolOptions* pOptions = nullptr);
+
+  /// <summary>
+  /// Initializes the threadpool without any threads or message queue, for tests and benchmarks.
+  /// It does not touch locks, thread local storage, the clock or wait/wake calls either.
+  /// The calling thread counts as the main thread. Timers only advance through ThreadpoolAdvanceTime.
+  /// Same seed, same order.
+  /// </summary>
+  /// <param name="mode">Inline or Seeded</param>
+  void ThreadpoolInitDeterministic(EExecutorMode::Enum mode, uint64_t seed);
+
+  /// <summary>
+  /// Deterministic mode only. Runs one Execute, or ends one finished task (OnDone, successors, Destroy).
+  /// </summary>
+  /// <returns>False if there was nothing to do.</returns>
+  bool ThreadpoolStep();
+
+  /// <summary>
+  /// Deterministic mode only. Steps until there is nothing left to do, except for timers.
+  /// </summary>
+  void ThreadpoolRunUntilIdle();
+
+  /// <summary>
+  /// Deterministic mode only. Moves the virtual clock forward, and releases timers that expire.
+  /// In Inline mode they run before this returns; in Seeded mode, call ThreadpoolStep.
+  /// </summary>
+  void ThreadpoolAdvanceTime(uint32_t ms);
 
   template <class T>
   T* ThreadpoolCreateTask(ITaskCompletionHandler* pHandler = nullptr)
   {
-    static_assert(sizeof(T) <= sizeof(TaskContext));
     static_assert(std::is_base_of<Task, T>::value);
 
-    TaskContext* pContext = detail::ThreadpoolAllocTaskContext();
+    constexpr ETaskSize::Enum size = detail::ThreadpoolGetTaskSizeClass(sizeof(T));
+    static_assert(alignof(T) <= (size == ETaskSize::Huge ? MEMORY_ALLOCATION_ALIGNMENT : alignof(TaskContext)));
+
+    TaskContext* pContext = detail::ThreadpoolAllocTaskContext(size, sizeof(T));
     T* pTask              = nullptr;
 
     if (pContext)
     {
-      pTask            = new (pContext) T;
-      pTask->pHandler  = pHandler;
-      pTask->cancelled = false;
+      pTask                  = new (pContext) T;
+      pTask->pHandler        = pHandler;
+      pTask->cancelled       = false;
+      pTask->token           = {};
+      pTask->priority        = ETaskPriority::Visible;
+      pTask->kind            = ETaskKind::Cpu;
+      pTask->runOnMainThread = false;
+      pTask->periodMs        = 0;
+      pTask->pState          = detail::ThreadpoolAllocTaskState(size, detail::ThreadpoolGetTaskTypeName<T>());
     }
 
     return pTask;
   }
 
   void ThreadpoolTaskEnd(Task* pTask);
+
+  /// <summary>
+  /// Ends all tasks that finished since the last call, and runs main thread tasks that became ready.
+  /// Call this from the main thread when it receives the user message passed to ThreadpoolInit.
+  /// May be called again from a modal loop inside one of those tasks.
+  /// </summary>
+  void ThreadpoolDrainCompletions();
+
+  /// <summary>
+  /// Posts the completion message to this window from now on, so it also arrives during modal loops.
+  /// Pass nullptr when the window is destroyed.
+  /// Call this from the main thread.
+  /// </summary>
+  void ThreadpoolSetMainWindow(HWND hWnd);
+
+  /// <summary>
+  /// The task starts once all its predecessors have ended.
+  /// </summary>
   void ThreadpoolSubmitTask(Task* pTask);
+
+  /// <summary>
+  /// Like ThreadpoolSubmitTask, but the task starts no earlier than delayMs milliseconds from now.
+  /// Timers have a resolution of about 10 ms.
+  /// </summary>
+  void ThreadpoolSubmitTaskDelayed(Task* pTask, uint32_t delayMs);
+
+  /// <summary>
+  /// Submits the task after delayMs milliseconds, unless another task is debounced with the same id before then.
+  /// In that case this task is cancelled, and the delay starts over for the new one.
+  /// Call this from the main thread.
+  /// </summary>
+  void ThreadpoolDebounce(uint32_t id, Task* pTask, uint32_t delayMs);
+
+  /// <summary>
+  /// Submits the task at most once every intervalMs milliseconds per id.
+  /// If a task with the same id is still pending, this one is dropped (ended as cancelled).
+  /// Call this from the main thread.
+  /// </summary>
+  void ThreadpoolThrottle(uint32_t id, Task* pTask, uint32_t intervalMs);
+
+  /// <summary>
+  /// Scratch memory for the task that is running on this thread. Everything is freed at once when Execute returns.
+  /// Only valid inside Execute.
+  /// </summary>
+  AllocatorBase* ThreadpoolGetScratchAllocator();
+
+  /// <summary>
+  /// Memory for the results of a task, created on first use. Allocate from it in Execute, read it in OnDone.
+  /// It is freed after Destroy, or reset before the next run of a periodic task.
+  /// Use it from one thread at a time, i.e. not from tasks spawned by this one.
+  /// </summary>
+  /// <returns>nullptr if we are out of memory</returns>
+  AllocatorBase* ThreadpoolGetOutputAllocator(Task* pTask);
+
+  /// <summary>
+  /// Safe to call from any thread. Counters are always on.
+  /// </summary>
+  void ThreadpoolGetStats(ThreadpoolStats* pStats);
+
+  /// <summary>
+  /// The topology that ThreadpoolInit placed the workers by.
+  /// </summary>
+  /// <returns>nullptr if the system did not report it, or in deterministic mode</returns>
+  const CpuTopology* ThreadpoolGetCpuTopology();
+
+  /// <summary>
+  /// Writes the statistics to the debugger output every periodMs milliseconds, until ThreadpoolDestroy.
+  /// </summary>
+  void ThreadpoolStartStatsDump(uint32_t periodMs);
+
+  /// <summary>
+  /// Makes pTask wait until pPredecessor has ended, i.e. after its OnDone was called.
+  /// If the predecessor is cancelled, so is pTask.
+  /// Call this from the main thread, before submitting pTask and before the predecessor ends.
+  /// A task can have any number of predecessors and successors.
+  /// </summary>
+  void ThreadpoolAddDependency(Task* pTask, Task* pPredecessor);
+
+  /// <summary>
+  /// Moves a queued task to another lane. Has no effect on the order of tasks that have started already,
+  /// or that were submitted from a threadpool thread.
+  /// Call this before ThreadpoolTaskEnd is called for the task.
+  /// </summary>
+  void ThreadpoolSetTaskPriority(Task* pTask, ETaskPriority::Enum priority);
+
+  /// <summary>
+  /// Cancels a task. If it has not started yet, it is taken off the queue and ended right away,
+  /// so do not use the pointer afterwards.
+  /// Call this from the main thread.
+  /// </summary>
+  void ThreadpoolCancelTask(Task* pTask);
+
+  /// <summary>
+  /// Ends all queued tasks that were cancelled through their token. Cancelled tasks that are not purged
+  /// are skipped when a thread picks them up.
+  /// Call this from the main thread.
+  /// </summary>
+  void ThreadpoolPurgeCancelledTasks();
   void ThreadpoolDestroy();
+
+  /// <summary>
+  /// Safe to call from any thread.
+  /// </summary>
+  /// <returns>True if called from the thread passed to ThreadpoolInit.</returns>
+  bool ThreadpoolIsMainThread();
+
+  /// <summary>
+  /// Safe to call from any thread.
+  /// </summary>
+  /// <returns>The number of threadpool threads.</returns>
+  uint32_t ThreadpoolGetNumThreads();
+
+  /// <summary>
+  /// Safe to call from any thread.
+  /// </summary>
+  /// <returns>The largest number of tasks that existed at the same time.</returns>
+  uint32_t ThreadpoolGetHighWaterMark();
 } // namespace mj
@@ -0,0 +1,192 @@
+#include "ThreadpoolTests.h"
+#include "Threadpool.h"
+#include "ErrorExit.h"
+
+// Reports the failing check through ErrorExit
+#define MJ_CHECK(expr) MJ_ERR_IF(static_cast<bool>(expr), false)
+
+/// <summary>
+/// Enough for every event of one run.
+/// </summary>
+static constexpr uint32_t MAX_EVENTS = 256;
+
+/// <summary>
+/// Number of seeds each seeded test runs with.
+/// </summary>
+static constexpr uint64_t NUM_SEEDS = 16;
+
+/// <summary>
+/// Execute and OnDone of every task, in the order they ran. Execute is id * 2, OnDone is id * 2 + 1.
+/// </summary>
+static uint32_t s_Events[MAX_EVENTS];
+static uint32_t s_NumEvents;
+
+static void RecordEvent(uint32_t event)
+{
+  MJ_CHECK(s_NumEvents < MAX_EVENTS);
+  s_Events[s_NumEvents++] = event;
+}
+
+/// <summary>
+/// Position of the event in the log. Exits if it did not happen exactly once.
+/// </summary>
+static uint32_t FindEvent(uint32_t event)
+{
+  uint32_t position = MAX_EVENTS;
+  for (uint32_t i = 0; i < s_NumEvents; i++)
+  {
+    if (s_Events[i] == event)
+    {
+      MJ_CHECK(position == MAX_EVENTS);
+      position = i;
+    }
+  }
+  MJ_CHECK(position != MAX_EVENTS);
+  return position;
+}
+
+struct RecordTask : public mj::Task
+{
+  uint32_t id;
+
+  virtual void Execute() override
+  {
+    RecordEvent(this->id * 2);
+  }
+
+  virtual void OnDone() override
+  {
+    RecordEvent(this->id * 2 + 1);
+  }
+};
+
+static RecordTask* CreateRecordTask(uint32_t id)
+{
+  RecordTask* pTask = mj::ThreadpoolCreateTask<RecordTask>();
+  MJ_EXIT_NULL(pTask);
+  pTask->id = id;
+  return pTask;
+}
+
+/// <summary>
+/// Eight independent tasks on both executors, a CPU task that waits for the first four,
+/// and a main thread task that waits for that one.
+/// </summary>
+static void RunDependencyGraph(uint64_t seed)
+{
+  static constexpr uint32_t NUM_LEAVES = 8;
+  static constexpr uint32_t JOIN_ID    = NUM_LEAVES;
+  static constexpr uint32_t MAIN_ID    = NUM_LEAVES + 1;
+
+  mj::ThreadpoolInitDeterministic(mj::EExecutorMode::Seeded, seed);
+  s_NumEvents = 0;
+
+  RecordTask* pMain      = CreateRecordTask(MAIN_ID);
+  pMain->runOnMainThread = true;
+  RecordTask* pJoin      = CreateRecordTask(JOIN_ID);
+  mj::ThreadpoolAddDependency(pMain, pJoin);
+
+  for (uint32_t i = 0; i < NUM_LEAVES; i++)
+  {
+    RecordTask* pLeaf = CreateRecordTask(i);
+    pLeaf->kind       = i % 2 ? mj::ETaskKind::Io : mj::ETaskKind::Cpu;
+    pLeaf->priority   = static_cast<mj::ETaskPriority::Enum>(i % mj::ETaskPriority::COUNT);
+    if (i < NUM_LEAVES / 2)
+    {
+      mj::ThreadpoolAddDependency(pJoin, pLeaf);
+    }
+    mj::ThreadpoolSubmitTask(pLeaf);
+  }
+  mj::ThreadpoolSubmitTask(pJoin);
+  mj::ThreadpoolSubmitTask(pMain);
+
+  // Nothing runs before it is stepped
+  MJ_CHECK(s_NumEvents == 0);
+  mj::ThreadpoolRunUntilIdle();
+  MJ_CHECK(s_NumEvents == (NUM_LEAVES + 2) * 2);
+
+  for (uint32_t i = 0; i < NUM_LEAVES + 2; i++)
+  {
+    MJ_CHECK(FindEvent(i * 2) < FindEvent(i * 2 + 1));
+  }
+  for (uint32_t i = 0; i < NUM_LEAVES / 2; i++)
+  {
+    MJ_CHECK(FindEvent(i * 2 + 1) < FindEvent(JOIN_ID * 2));
+  }
+  MJ_CHECK(FindEvent(JOIN_ID * 2 + 1) < FindEvent(MAIN_ID * 2));
+}
+
+/// <summary>
+/// Every seed respects the dependencies, the same seed replays the same order,
+/// and different seeds actually interleave differently.
+/// </summary>
+static void TestSeededDependencies()
+{
+  MJ_UNINITIALIZED uint32_t firstEvents[MAX_EVENTS];
+  uint32_t numFirstEvents = 0;
+  bool anyDifferent = false;
+
+  for (uint64_t seed = 1; seed <= NUM_SEEDS; seed++)
+  {
+    RunDependencyGraph(seed);
+    if (seed == 1)
+    {
+      numFirstEvents = s_NumEvents;
+      for (uint32_t i = 0; i < s_NumEvents; i++)
+      {
+        firstEvents[i] = s_Events[i];
+      }
+    }
+    else
+    {
+      for (uint32_t i = 0; i < s_NumEvents; i++)
+      {
+        anyDifferent = anyDifferent || s_Events[i] != firstEvents[i];
+      }
+    }
+  }
+  MJ_CHECK(anyDifferent);
+
+  RunDependencyGraph(1);
+  MJ_CHECK(s_NumEvents == numFirstEvents);
+  for (uint32_t i = 0; i < s_NumEvents; i++)
+  {
+    MJ_CHECK(s_Events[i] == firstEvents[i]);
+  }
+}
+
+/// <summary>
+/// Delayed tasks wait for the virtual clock, not the wall clock. Cancelled ones never run.
+/// </summary>
+static void TestSeededTimers()
+{
+  for (uint64_t seed = 1; seed <= NUM_SEEDS; seed++)
+  {
+    mj::ThreadpoolInitDeterministic(mj::EExecutorMode::Seeded, seed);
+    s_NumEvents = 0;
+
+    mj::ThreadpoolSubmitTaskDelayed(CreateRecordTask(0), 100);
+    RecordTask* pCancelled = CreateRecordTask(1);
+    mj::ThreadpoolSubmitTaskDelayed(pCancelled, 50);
+
+    mj::ThreadpoolRunUntilIdle();
+    MJ_CHECK(s_NumEvents == 0);
+
+    mj::ThreadpoolCancelTask(pCancelled);
+    mj::ThreadpoolAdvanceTime(60);
+    mj::ThreadpoolRunUntilIdle();
+    MJ_CHECK(s_NumEvents == 0);
+
+    mj::ThreadpoolAdvanceTime(60);
+    mj::ThreadpoolRunUntilIdle();
+    MJ_CHECK(s_NumEvents == 2);
+    MJ_CHECK(s_Events[0] == 0 && s_Events[1] == 1);
+  }
+}
+
+void mj::RunThreadpoolTests()
+{
+  TestSeededDependencies();
+  TestSeededTimers();
+  mj::ThreadpoolDestroy();
+}
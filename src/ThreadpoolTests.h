@@ -0,0 +1,11 @@
+#pragma once
+
+namespace mj
+{
+  /// <summary>
+  /// Runs the threadpool through the deterministic executor. A failed check exits the process like any other
+  /// fatal error, with the file and line of the check. Returns once everything passed.
+  /// Replaces the threadpool state, so call this instead of ThreadpoolInit, not alongside it.
+  /// </summary>
+  void RunThreadpoolTests();
+} // namespace mj
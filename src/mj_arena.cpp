@@ -0,0 +1,193 @@
+#include "mj_arena.h"
+#include "../3rdparty/tracy/Tracy.hpp"
+
+/// <summary>
+/// Matches the allocation granularity of VirtualAlloc.
+/// </summary>
+static constexpr size_t ARENA_BLOCK_SIZE = 64 * 1024;
+
+/// <summary>
+/// Larger allocations get a block of their own, so they do not waste the rest of the current block.
+/// </summary>
+static constexpr size_t ARENA_LARGE_SIZE = ARENA_BLOCK_SIZE / 4;
+
+/// <summary>
+/// Blocks beyond this many in the pool are released to the system (16 MiB).
+/// </summary>
+static constexpr USHORT ARENA_MAX_FREE_BLOCKS = 256;
+
+namespace mj
+{
+  namespace detail
+  {
+    struct alignas(MEMORY_ALLOCATION_ALIGNMENT) ArenaBlock
+    {
+      SLIST_ENTRY freeListEntry;
+      ArenaBlock* pNext;
+      size_t numBytes; // Including this header
+    };
+  } // namespace detail
+} // namespace mj
+
+using mj::detail::ArenaBlock;
+
+// A zeroed SLIST_HEADER is an empty list, so this needs no initialization
+static SLIST_HEADER s_FreeBlocks;
+
+static size_t AlignUp(size_t size)
+{
+  return (size + MEMORY_ALLOCATION_ALIGNMENT - 1) & ~static_cast<size_t>(MEMORY_ALLOCATION_ALIGNMENT - 1);
+}
+
+static ArenaBlock* AcquireBlock()
+{
+  ArenaBlock* pBlock = reinterpret_cast<ArenaBlock*>(::InterlockedPopEntrySList(&s_FreeBlocks));
+  if (!pBlock)
+  {
+    ZoneScopedN("VirtualAlloc");
+    pBlock = static_cast<ArenaBlock*>(
+        ::VirtualAlloc(nullptr, ARENA_BLOCK_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (!pBlock)
+    {
+      return nullptr;
+    }
+  }
+
+  pBlock->pNext    = nullptr;
+  pBlock->numBytes = ARENA_BLOCK_SIZE;
+  return pBlock;
+}
+
+static void ReleaseBlocks(ArenaBlock* pBlock)
+{
+  while (pBlock)
+  {
+    ArenaBlock* pNext = pBlock->pNext;
+    if (pBlock->numBytes == ARENA_BLOCK_SIZE && ::QueryDepthSList(&s_FreeBlocks) < ARENA_MAX_FREE_BLOCKS)
+    {
+      static_cast<void>(::InterlockedPushEntrySList(&s_FreeBlocks, &pBlock->freeListEntry));
+    }
+    else
+    {
+      static_cast<void>(::VirtualFree(pBlock, 0, MEM_RELEASE));
+    }
+    pBlock = pNext;
+  }
+}
+
+void mj::ArenaAllocator::Init()
+{
+  this->pBlocks      = nullptr;
+  this->pLargeBlocks = nullptr;
+  this->pFirstBlock  = nullptr;
+  this->pResetPoint  = nullptr;
+  this->pCurrent     = nullptr;
+  this->pEnd         = nullptr;
+}
+
+void mj::ArenaAllocator::Reset()
+{
+  ReleaseBlocks(this->pLargeBlocks);
+  this->pLargeBlocks = nullptr;
+
+  if (this->pFirstBlock)
+  {
+    // The first block is the oldest, so it is last in the list
+    ArenaBlock* pBlock = this->pBlocks;
+    while (pBlock != this->pFirstBlock)
+    {
+      ArenaBlock* pNext = pBlock->pNext;
+      pBlock->pNext     = nullptr;
+      ReleaseBlocks(pBlock);
+      pBlock = pNext;
+    }
+
+    this->pBlocks  = this->pFirstBlock;
+    this->pCurrent = this->pResetPoint;
+    this->pEnd     = reinterpret_cast<char*>(this->pFirstBlock) + ARENA_BLOCK_SIZE;
+  }
+}
+
+void mj::ArenaAllocator::Destroy()
+{
+  // This object may live in one of the blocks, so do not touch it after releasing them
+  ArenaBlock* pBlocks      = this->pBlocks;
+  ArenaBlock* pLargeBlocks = this->pLargeBlocks;
+  this->Init();
+
+  ReleaseBlocks(pLargeBlocks);
+  ReleaseBlocks(pBlocks);
+}
+
+mj::ArenaAllocator* mj::ArenaAllocator::Create()
+{
+  ArenaBlock* pBlock = AcquireBlock();
+  if (!pBlock)
+  {
+    return nullptr;
+  }
+
+  char* pMemory          = reinterpret_cast<char*>(pBlock + 1);
+  ArenaAllocator* pArena = new (pMemory) ArenaAllocator;
+  pArena->pBlocks        = pBlock;
+  pArena->pLargeBlocks   = nullptr;
+  pArena->pFirstBlock    = pBlock;
+  pArena->pResetPoint    = pMemory + AlignUp(sizeof(ArenaAllocator));
+  pArena->pCurrent       = pArena->pResetPoint;
+  pArena->pEnd           = reinterpret_cast<char*>(pBlock) + ARENA_BLOCK_SIZE;
+  return pArena;
+}
+
+void* mj::ArenaAllocator::AllocateInternal(size_t size)
+{
+  size = AlignUp(size);
+
+  if (size > static_cast<size_t>(this->pEnd - this->pCurrent))
+  {
+    if (size > ARENA_LARGE_SIZE)
+    {
+      const size_t numBytes = sizeof(ArenaBlock) + size;
+      ArenaBlock* pBlock =
+          static_cast<ArenaBlock*>(::VirtualAlloc(nullptr, numBytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+      if (!pBlock)
+      {
+        return nullptr;
+      }
+      pBlock->numBytes   = numBytes;
+      pBlock->pNext      = this->pLargeBlocks;
+      this->pLargeBlocks = pBlock;
+      return pBlock + 1;
+    }
+
+    // The rest of the current block is wasted
+    ArenaBlock* pBlock = AcquireBlock();
+    if (!pBlock)
+    {
+      return nullptr;
+    }
+    pBlock->pNext  = this->pBlocks;
+    this->pBlocks  = pBlock;
+    this->pCurrent = reinterpret_cast<char*>(pBlock + 1);
+    this->pEnd     = reinterpret_cast<char*>(pBlock) + ARENA_BLOCK_SIZE;
+
+    if (!this->pFirstBlock)
+    {
+      this->pFirstBlock = pBlock;
+      this->pResetPoint = this->pCurrent;
+    }
+  }
+
+  void* ptr = this->pCurrent;
+  this->pCurrent += size;
+  return ptr;
+}
+
+void mj::ArenaAllocator::FreeInternal(void* ptr)
+{
+  static_cast<void>(ptr);
+}
+
+const char* mj::ArenaAllocator::GetName()
+{
+  return STR(ArenaAllocator);
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "mj_win32.h"
+
+namespace mj
+{
+  namespace detail
+  {
+    struct ArenaBlock;
+  } // namespace detail
+
+  /// <summary>
+  /// Bump allocator that grows in 64 KiB blocks. Blocks come from a process-wide lock-free pool,
+  /// and go back there on Reset and Destroy, so a warm arena allocates without system calls.
+  /// Free does nothing. Allocations are aligned to MEMORY_ALLOCATION_ALIGNMENT.
+  /// Not thread-safe, but can be handed from one thread to another.
+  /// </summary>
+  class ArenaAllocator : public AllocatorBase
+  {
+  private:
+    detail::ArenaBlock* pBlocks;      // Newest first
+    detail::ArenaBlock* pLargeBlocks; // Allocations that do not fit in a block
+    detail::ArenaBlock* pFirstBlock;  // Kept on Reset
+    char* pResetPoint;
+    char* pCurrent;
+    char* pEnd;
+
+  public:
+    /// <summary>
+    /// Does no allocation.
+    /// </summary>
+    void Init();
+
+    /// <summary>
+    /// Frees all allocations at once. Keeps the first block, so the next use is free as well.
+    /// </summary>
+    void Reset();
+
+    /// <summary>
+    /// Returns all blocks to the pool.
+    /// </summary>
+    void Destroy();
+
+    /// <summary>
+    /// Creates an arena that lives inside its own first block. Destroy frees the arena object as well.
+    /// </summary>
+    /// <returns>nullptr if we are out of memory</returns>
+    static ArenaAllocator* Create();
+
+  protected:
+    [[nodiscard]] virtual void* AllocateInternal(size_t size) override;
+    virtual void FreeInternal(void* ptr) override;
+    virtual const char* GetName() override;
+  };
+} // namespace mj
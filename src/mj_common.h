@@ -365,6 +365,19 @@ namespace mj
       this->numElements = 0;
     }
 
+    /// <summary>
+    /// Reduces the number of elements to the specified size.
+    /// Does nothing if the ArrayList is not larger than that.
+    /// Keeps current allocation.
+    /// </summary>
+    void Truncate(size_t size)
+    {
+      if (size < this->numElements)
+      {
+        this->numElements = size;
+      }
+    }
+
     size_t Size() const
     {
       return this->numElements;
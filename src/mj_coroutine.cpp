@@ -0,0 +1,64 @@
+#include "mj_coroutine.h"
+#include "ServiceLocator.h"
+#include "../3rdparty/tracy/Tracy.hpp"
+
+namespace mj
+{
+  namespace detail
+  {
+    /// <summary>
+    /// Resumes a suspended coroutine. If the task is cancelled before it runs,
+    /// nobody will resume the coroutine anymore, so its frame is destroyed instead.
+    /// </summary>
+    struct ResumeCoroutineTask : public Task
+    {
+      MJ_UNINITIALIZED std::coroutine_handle<> handle;
+      MJ_UNINITIALIZED bool resumed;
+
+      virtual void Execute() override
+      {
+        ZoneScoped;
+        this->resumed = true;
+        this->handle.resume();
+      }
+
+      virtual void Destroy() override
+      {
+        if (!this->resumed)
+        {
+          this->handle.destroy();
+        }
+      }
+    };
+  } // namespace detail
+} // namespace mj
+
+void* mj::detail::AllocateCoroutineFrame(size_t size)
+{
+  return svc::GeneralPurposeAllocator()->Allocate(size);
+}
+
+void mj::detail::FreeCoroutineFrame(void* ptr)
+{
+  svc::GeneralPurposeAllocator()->Free(ptr);
+}
+
+void mj::detail::ScheduleResume(std::coroutine_handle<> handle, ETaskPriority::Enum priority, ETaskKind::Enum kind,
+                                bool runOnMainThread, CancellationToken token, Task* const* ppPredecessors,
+                                size_t numPredecessors)
+{
+  auto pTask             = ThreadpoolCreateTask<ResumeCoroutineTask>();
+  pTask->handle          = handle;
+  pTask->resumed         = false;
+  pTask->token           = token;
+  pTask->priority        = priority;
+  pTask->kind            = kind;
+  pTask->runOnMainThread = runOnMainThread;
+
+  for (size_t i = 0; i < numPredecessors; i++)
+  {
+    ThreadpoolAddDependency(pTask, ppPredecessors[i]);
+  }
+
+  ThreadpoolSubmitTask(pTask);
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include "Threadpool.h"
+#include <coroutine>
+
+namespace mj
+{
+  namespace detail
+  {
+    void* AllocateCoroutineFrame(size_t size);
+    void FreeCoroutineFrame(void* ptr);
+
+    /// <summary>
+    /// Creates a task that resumes the coroutine, and submits it.
+    /// If the task is cancelled, the coroutine is destroyed instead.
+    /// </summary>
+    void ScheduleResume(std::coroutine_handle<> handle, ETaskPriority::Enum priority, ETaskKind::Enum kind,
+                        bool runOnMainThread, CancellationToken token, Task* const* ppPredecessors,
+                        size_t numPredecessors);
+  } // namespace detail
+
+  /// <summary>
+  /// Return type of fire-and-forget coroutines.
+  /// The coroutine starts on the calling thread, and frees its own frame when it returns.
+  /// Frames come from the general purpose allocator. If that fails, the coroutine does not run at all.
+  /// A coroutine that is cancelled while suspended is destroyed where it is, which ends the scope of its locals,
+  /// so clean up with MJ_DEFER.
+  /// </summary>
+  struct Async
+  {
+    struct promise_type
+    {
+      static void* operator new(size_t size) noexcept
+      {
+        return detail::AllocateCoroutineFrame(size);
+      }
+
+      static void operator delete(void* ptr)
+      {
+        detail::FreeCoroutineFrame(ptr);
+      }
+
+      static Async get_return_object_on_allocation_failure()
+      {
+        return {};
+      }
+
+      Async get_return_object()
+      {
+        return {};
+      }
+
+      std::suspend_never initial_suspend() noexcept
+      {
+        return {};
+      }
+
+      std::suspend_never final_suspend() noexcept
+      {
+        return {};
+      }
+
+      void return_void()
+      {
+      }
+
+      void unhandled_exception()
+      {
+        // Exceptions are disabled
+      }
+    };
+  };
+
+  /// <summary>
+  /// co_await ResumeOnThreadpool{} continues on a threadpool thread.
+  /// </summary>
+  struct ResumeOnThreadpool
+  {
+    ETaskPriority::Enum priority = ETaskPriority::Visible;
+    ETaskKind::Enum kind         = ETaskKind::Cpu; // Use ETaskKind::Io before blocking calls
+    CancellationToken token      = {};             // Optional. Destroys the coroutine instead of resuming it.
+
+    bool await_ready() const noexcept
+    {
+      return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) const
+    {
+      detail::ScheduleResume(handle, this->priority, this->kind, false, this->token, nullptr, 0);
+    }
+
+    void await_resume() const noexcept
+    {
+    }
+  };
+
+  /// <summary>
+  /// co_await ResumeOnMainThread{} continues on the main thread, during ThreadpoolDrainCompletions.
+  /// Does not suspend if we are on the main thread already.
+  /// </summary>
+  struct ResumeOnMainThread
+  {
+    CancellationToken token = {}; // Optional. Destroys the coroutine instead of resuming it.
+
+    bool await_ready() const noexcept
+    {
+      return ThreadpoolIsMainThread();
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) const
+    {
+      detail::ScheduleResume(handle, ETaskPriority::Visible, ETaskKind::Cpu, true, this->token, nullptr, 0);
+    }
+
+    void await_resume() const noexcept
+    {
+    }
+  };
+
+  /// <summary>
+  /// co_await AwaitTasks{ ppTasks, numTasks } continues on the main thread once all tasks have ended,
+  /// i.e. after their OnDone. If any of them is cancelled, the coroutine is destroyed instead of resumed.
+  /// Same rules as ThreadpoolAddDependency: await on the main thread, before the tasks end.
+  /// </summary>
+  struct AwaitTasks
+  {
+    Task* const* ppTasks;
+    size_t numTasks;
+
+    bool await_ready() const noexcept
+    {
+      return this->numTasks == 0;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) const
+    {
+      detail::ScheduleResume(handle, ETaskPriority::Visible, ETaskKind::Cpu, true, {}, this->ppTasks, this->numTasks);
+    }
+
+    void await_resume() const noexcept
+    {
+    }
+  };
+} // namespace mj
@@ -0,0 +1,340 @@
+#include "mj_directory.h"
+#include "mj_common.h"
+#include "../3rdparty/tracy/Tracy.hpp"
+
+/// <summary>
+/// Both platforms describe entries with FILE_ATTRIBUTE_*, so they share these rules.
+/// </summary>
+static uint32_t FlagsFromAttributes(DWORD attributes)
+{
+  uint32_t flags = 0;
+  if (attributes & FILE_ATTRIBUTE_DIRECTORY)
+  {
+    flags |= mj::EDirectoryEntryFlags::Directory;
+  }
+  if (attributes & FILE_ATTRIBUTE_HIDDEN)
+  {
+    flags |= mj::EDirectoryEntryFlags::Hidden;
+  }
+  if (attributes & FILE_ATTRIBUTE_SYSTEM)
+  {
+    flags |= mj::EDirectoryEntryFlags::System;
+  }
+  return flags;
+}
+
+#ifdef __linux__
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/// <summary>
+/// Record layout of getdents64. Older glibc versions do not declare it.
+/// </summary>
+struct LinuxDirent64
+{
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1]; // Null-terminated, padded up to d_reclen
+};
+
+/// <summary>
+/// Room for hundreds of entries per system call.
+/// </summary>
+static constexpr size_t GETDENTS_BUFFER_SIZE = 64 * 1024;
+
+/// <summary>
+/// Appends a null-terminated copy. wchar_t holds UTF-32 on Linux.
+/// </summary>
+/// <returns>False if memory allocation failed</returns>
+static bool EncodeUtf8(const mj::StringView& string, mj::ArrayList<char>& utf8)
+{
+  for (size_t i = 0; i < string.len; i++)
+  {
+    const uint32_t c = static_cast<uint32_t>(string.ptr[i]);
+    MJ_UNINITIALIZED char bytes[4];
+    size_t numBytes = 0;
+    if (c < 0x80)
+    {
+      bytes[numBytes++] = static_cast<char>(c);
+    }
+    else if (c < 0x800)
+    {
+      bytes[numBytes++] = static_cast<char>(0xC0 | (c >> 6));
+      bytes[numBytes++] = static_cast<char>(0x80 | (c & 0x3F));
+    }
+    else if (c < 0x10000)
+    {
+      bytes[numBytes++] = static_cast<char>(0xE0 | (c >> 12));
+      bytes[numBytes++] = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+      bytes[numBytes++] = static_cast<char>(0x80 | (c & 0x3F));
+    }
+    else
+    {
+      bytes[numBytes++] = static_cast<char>(0xF0 | (c >> 18));
+      bytes[numBytes++] = static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+      bytes[numBytes++] = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+      bytes[numBytes++] = static_cast<char>(0x80 | (c & 0x3F));
+    }
+
+    for (size_t j = 0; j < numBytes; j++)
+    {
+      if (!utf8.Add(bytes[j]))
+      {
+        return false;
+      }
+    }
+  }
+
+  return utf8.Add('\0');
+}
+
+/// <summary>
+/// Replaces the contents with a null-terminated copy.
+/// Names are not required to be valid UTF-8, invalid sequences become U+FFFD.
+/// </summary>
+/// <returns>False if memory allocation failed</returns>
+static bool DecodeUtf8(const char* pUtf8, mj::ArrayList<wchar_t>& string)
+{
+  string.Clear();
+
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(pUtf8);
+  while (*p)
+  {
+    uint32_t c = *p++;
+    if (c >= 0x80)
+    {
+      const uint32_t numContinuation = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+      const uint32_t minimum         = numContinuation == 3 ? 0x10000 : numContinuation == 2 ? 0x800 : 0x80;
+      bool valid                     = numContinuation > 0 && c < 0xF8;
+
+      c &= 0x3F >> numContinuation;
+      for (uint32_t i = 0; i < numContinuation && valid; i++)
+      {
+        // Also stops at the terminator
+        valid = (*p & 0xC0) == 0x80;
+        if (valid)
+        {
+          c = (c << 6) | (*p++ & 0x3F);
+        }
+      }
+
+      // Overlong encodings, surrogates and anything beyond Unicode
+      if (!valid || c < minimum || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+      {
+        c = 0xFFFD;
+      }
+    }
+
+    if (!string.Add(static_cast<wchar_t>(c)))
+    {
+      return false;
+    }
+  }
+
+  return string.Add(L'\0');
+}
+
+DWORD mj::DirectoryIterator::Open(const StringView& folder, AllocatorBase* pAllocator)
+{
+  ZoneScoped;
+
+  this->pAllocator   = pAllocator;
+  this->bufferSize   = 0;
+  this->bufferOffset = 0;
+  this->name.Init(pAllocator);
+
+  // The kernel takes null-terminated UTF-8
+  ArrayList<char> path;
+  path.Init(pAllocator);
+  MJ_DEFER(path.Destroy());
+  if (!EncodeUtf8(folder, path))
+  {
+    return ENOMEM;
+  }
+
+  this->fd = ::open(path.Get(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (this->fd < 0)
+  {
+    return static_cast<DWORD>(errno);
+  }
+
+  this->pBuffer = static_cast<char*>(pAllocator->Allocate(GETDENTS_BUFFER_SIZE));
+  if (!this->pBuffer)
+  {
+    this->Close();
+    return ENOMEM;
+  }
+
+  return 0;
+}
+
+bool mj::DirectoryIterator::Next(DirectoryEntry* pEntry)
+{
+  while (true)
+  {
+    if (this->bufferOffset >= this->bufferSize)
+    {
+      if (this->fd < 0)
+      {
+        return false;
+      }
+
+      // Zero at the end of the folder. Errors halfway through end the listing as well.
+      const long numBytes = ::syscall(SYS_getdents64, this->fd, this->pBuffer, GETDENTS_BUFFER_SIZE);
+      if (numBytes <= 0)
+      {
+        return false;
+      }
+      this->bufferSize   = static_cast<size_t>(numBytes);
+      this->bufferOffset = 0;
+    }
+
+    const LinuxDirent64* pRecord = reinterpret_cast<const LinuxDirent64*>(this->pBuffer + this->bufferOffset);
+    this->bufferOffset += pRecord->d_reclen;
+
+    const char* pName = pRecord->d_name;
+    if (pName[0] == '.' && (pName[1] == '\0' || (pName[1] == '.' && pName[2] == '\0')))
+    {
+      continue;
+    }
+
+    // Links count as what they point to, like junctions on Windows. Some file systems do not fill in d_type.
+    // A link that points nowhere is listed as a file.
+    unsigned char type = pRecord->d_type;
+    DWORD attributes   = type == DT_LNK ? FILE_ATTRIBUTE_REPARSE_POINT : 0;
+    if (type == DT_LNK || type == DT_UNKNOWN)
+    {
+      MJ_UNINITIALIZED struct stat status;
+      type = ::fstatat(this->fd, pName, &status, 0) == 0 ? IFTODT(status.st_mode) : DT_REG;
+    }
+
+    if (type == DT_DIR)
+    {
+      attributes |= FILE_ATTRIBUTE_DIRECTORY;
+    }
+    else if (type != DT_REG)
+    {
+      // Devices, pipes and sockets cannot be opened like files
+      attributes |= FILE_ATTRIBUTE_SYSTEM;
+    }
+    if (pName[0] == '.')
+    {
+      attributes |= FILE_ATTRIBUTE_HIDDEN;
+    }
+    if (attributes == 0)
+    {
+      attributes = FILE_ATTRIBUTE_NORMAL;
+    }
+
+    if (!DecodeUtf8(pName, this->name))
+    {
+      // Out of memory, leave it out
+      continue;
+    }
+
+    pEntry->name.Init(this->name.Get(), this->name.Size() - 1);
+    pEntry->attributes    = attributes;
+    pEntry->size          = 0;
+    pEntry->lastWriteTime = 0;
+    pEntry->flags         = FlagsFromAttributes(attributes);
+    return true;
+  }
+}
+
+void mj::DirectoryIterator::Close()
+{
+  if (this->fd >= 0)
+  {
+    static_cast<void>(::close(this->fd));
+    this->fd = -1;
+  }
+  if (this->pBuffer)
+  {
+    this->pAllocator->Free(this->pBuffer);
+    this->pBuffer = nullptr;
+  }
+  this->name.Destroy();
+  this->bufferSize   = 0;
+  this->bufferOffset = 0;
+}
+#else
+DWORD mj::DirectoryIterator::Open(const StringView& folder, AllocatorBase* pAllocator)
+{
+  ZoneScoped;
+
+  this->hasData = false;
+
+  // FindFirstFileW takes a search pattern, not a folder
+  ArrayList<wchar_t> alPattern;
+  alPattern.Init(pAllocator);
+  MJ_DEFER(alPattern.Destroy());
+  StringBuilder sb;
+  sb.SetArrayList(&alPattern);
+  const StringView pattern = sb.Append(folder).Append(L"\\*").ToStringClosed();
+  if (pattern.len != folder.len + 2)
+  {
+    return ERROR_NOT_ENOUGH_MEMORY;
+  }
+
+  // Basic info leaves out the short name, which the file system may have to generate.
+  // Large fetch asks for bigger buffers per FindNextFileW system call.
+  this->hFind = ::FindFirstFileExW(pattern.ptr,               //
+                                   FindExInfoBasic,           //
+                                   &this->findData,           //
+                                   FindExSearchNameMatch,     //
+                                   nullptr,                   //
+                                   FIND_FIRST_EX_LARGE_FETCH);
+  if (this->hFind == INVALID_HANDLE_VALUE)
+  {
+    return ::GetLastError();
+  }
+
+  this->hasData = true;
+  return 0;
+}
+
+bool mj::DirectoryIterator::Next(DirectoryEntry* pEntry)
+{
+  while (true)
+  {
+    if (!this->hasData)
+    {
+      if (this->hFind == INVALID_HANDLE_VALUE || !::FindNextFileW(this->hFind, &this->findData))
+      {
+        return false;
+      }
+    }
+    this->hasData = false;
+
+    pEntry->name.Init(this->findData.cFileName);
+    if (pEntry->name.Equals(L".") || pEntry->name.Equals(L".."))
+    {
+      continue;
+    }
+
+    const DWORD attributes = this->findData.dwFileAttributes;
+    pEntry->attributes     = attributes;
+    pEntry->size           = (static_cast<uint64_t>(this->findData.nFileSizeHigh) << 32) | this->findData.nFileSizeLow;
+    pEntry->lastWriteTime  = (static_cast<uint64_t>(this->findData.ftLastWriteTime.dwHighDateTime) << 32) |
+                            this->findData.ftLastWriteTime.dwLowDateTime;
+    pEntry->flags          = FlagsFromAttributes(attributes);
+    return true;
+  }
+}
+
+void mj::DirectoryIterator::Close()
+{
+  if (this->hFind != INVALID_HANDLE_VALUE)
+  {
+    static_cast<void>(::FindClose(this->hFind));
+    this->hFind = INVALID_HANDLE_VALUE;
+  }
+  this->hasData = false;
+}
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+#include "mj_win32.h"
+#include "mj_string.h"
+
+namespace mj
+{
+  struct EDirectoryEntryFlags
+  {
+    enum Enum
+    {
+      Directory = 1 << 0,
+      Hidden    = 1 << 1,
+      System    = 1 << 2,
+    };
+  };
+
+  struct DirectoryEntry
+  {
+    /// <summary>
+    /// Null-terminated. Valid until the next call to Next or Close.
+    /// </summary>
+    StringView name;
+
+    /// <summary>
+    /// EDirectoryEntryFlags
+    /// </summary>
+    uint32_t flags;
+
+    // For metadata columns. Comes with the listing at no extra cost.
+    // On Linux, getdents64 has no size or time, so those are zero.
+    DWORD attributes;       // FILE_ATTRIBUTE_*
+    uint64_t size;          // In bytes, zero for folders
+    uint64_t lastWriteTime; // FILETIME, 100 ns intervals since 1601 (UTC)
+  };
+
+  /// <summary>
+  /// Lists the entries of a single folder, in the order the file system returns them.
+  /// This is the platform layer of folder listings: which entries to show is up to the caller.
+  /// Skips short (8.3) names, and fetches entries from the kernel in large batches.
+  ///
+  /// On Linux, entries come from getdents64 and are classified by d_type, with the same rules as on Windows:
+  /// dot files are hidden, and devices, pipes and sockets count as system entries.
+  /// Symbolic links are followed to tell folders from files, and carry FILE_ATTRIBUTE_REPARSE_POINT.
+  /// </summary>
+  class DirectoryIterator
+  {
+  private:
+#ifdef __linux__
+    int fd                    = -1;
+    AllocatorBase* pAllocator = nullptr;
+    char* pBuffer             = nullptr; // linux_dirent64 records
+    size_t bufferSize         = 0;       // Bytes returned by the last getdents64
+    size_t bufferOffset       = 0;       // Next record
+    ArrayList<wchar_t> name;             // The current name, decoded from UTF-8
+#else
+    HANDLE hFind = INVALID_HANDLE_VALUE;
+    bool hasData = false; // findData holds an entry that Next has not returned yet
+    MJ_UNINITIALIZED WIN32_FIND_DATAW findData;
+#endif
+
+  public:
+    /// <param name="folder">Does not need to be null-terminated</param>
+    /// <param name="pAllocator">
+    /// For a temporary copy of the path. On Linux also for the record buffer and the current name,
+    /// so it must outlive Close.
+    /// </param>
+    /// <returns>0 on success, otherwise a system error code (errno on Linux)</returns>
+    DWORD Open(const StringView& folder, AllocatorBase* pAllocator);
+
+    /// <summary>
+    /// Skips "." and "..".
+    /// </summary>
+    /// <returns>False when there are no more entries</returns>
+    bool Next(DirectoryEntry* pEntry);
+
+    /// <summary>
+    /// Safe to call if Open failed.
+    /// </summary>
+    void Close();
+  };
+} // namespace mj
@@ -0,0 +1,647 @@
+#include "mj_format.h"
+#include "mj_macro.h"
+#include <string.h>
+
+// The double conversion is Grisu2, based on:
+// Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers" (PLDI 2010)
+// and the implementation by Milo Yip in RapidJSON (MIT license).
+
+static const wchar_t s_DigitPairs[] = L"00010203040506070809"
+                                      L"10111213141516171819"
+                                      L"20212223242526272829"
+                                      L"30313233343536373839"
+                                      L"40414243444546474849"
+                                      L"50515253545556575859"
+                                      L"60616263646566676869"
+                                      L"70717273747576777879"
+                                      L"80818283848586878889"
+                                      L"90919293949596979899";
+
+static const uint64_t s_Pow10[] = { 1ull,
+                                    10ull,
+                                    100ull,
+                                    1000ull,
+                                    10000ull,
+                                    100000ull,
+                                    1000000ull,
+                                    10000000ull,
+                                    100000000ull,
+                                    1000000000ull,
+                                    10000000000ull,
+                                    100000000000ull,
+                                    1000000000000ull,
+                                    10000000000000ull,
+                                    100000000000000ull,
+                                    1000000000000000ull,
+                                    10000000000000000ull,
+                                    100000000000000000ull,
+                                    1000000000000000000ull,
+                                    10000000000000000000ull };
+
+size_t mj::fmt::CountDigits(uint64_t value)
+{
+  size_t numDigits = 1;
+  while (true)
+  {
+    // Four comparisons per division
+    if (value < 10)
+      return numDigits;
+    if (value < 100)
+      return numDigits + 1;
+    if (value < 1000)
+      return numDigits + 2;
+    if (value < 10000)
+      return numDigits + 3;
+    value /= 10000;
+    numDigits += 4;
+  }
+}
+
+void mj::fmt::WriteDigits(wchar_t* pDest, uint64_t value, size_t numDigits)
+{
+  // Fill it backwards
+  wchar_t* pHead = pDest + numDigits;
+
+  while (value >= 100)
+  {
+    size_t index = static_cast<size_t>(value % 100) * 2;
+    value /= 100;
+    pHead -= 2;
+    pHead[0] = s_DigitPairs[index];
+    pHead[1] = s_DigitPairs[index + 1];
+  }
+
+  if (value >= 10)
+  {
+    size_t index = static_cast<size_t>(value) * 2;
+    pHead -= 2;
+    pHead[0] = s_DigitPairs[index];
+    pHead[1] = s_DigitPairs[index + 1];
+  }
+  else
+  {
+    --pHead;
+    *pHead = static_cast<wchar_t>(L'0' + value);
+  }
+
+  // Zero padding
+  while (pHead > pDest)
+  {
+    --pHead;
+    *pHead = L'0';
+  }
+}
+
+size_t mj::fmt::FormatUInt64(wchar_t* pDest, uint64_t value)
+{
+  size_t numDigits = CountDigits(value);
+  WriteDigits(pDest, value, numDigits);
+  return numDigits;
+}
+
+size_t mj::fmt::FormatInt64(wchar_t* pDest, int64_t value)
+{
+  if (value < 0)
+  {
+    *pDest = L'-';
+    // Negate in unsigned space, so INT64_MIN does not overflow
+    return 1 + FormatUInt64(pDest + 1, 0 - static_cast<uint64_t>(value));
+  }
+
+  return FormatUInt64(pDest, static_cast<uint64_t>(value));
+}
+
+namespace mj
+{
+  namespace detail
+  {
+    /// <summary>
+    /// "Do-it-yourself floating point": 64-bit significand with a binary exponent.
+    /// </summary>
+    struct DiyFp
+    {
+      uint64_t f;
+      int e;
+
+      DiyFp Sub(const DiyFp& rhs) const
+      {
+        return DiyFp{ this->f - rhs.f, this->e };
+      }
+
+      /// <summary>
+      /// Upper 64 bits of the 128-bit product, rounded.
+      /// </summary>
+      DiyFp Mul(const DiyFp& rhs) const
+      {
+        const uint64_t M32 = 0xFFFFFFFF;
+        const uint64_t a   = this->f >> 32;
+        const uint64_t b   = this->f & M32;
+        const uint64_t c   = rhs.f >> 32;
+        const uint64_t d   = rhs.f & M32;
+        const uint64_t ac  = a * c;
+        const uint64_t bc  = b * c;
+        const uint64_t ad  = a * d;
+        const uint64_t bd  = b * d;
+        uint64_t tmp       = (bd >> 32) + (ad & M32) + (bc & M32);
+        tmp += 1u << 31; // Round
+        return DiyFp{ ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), this->e + rhs.e + 64 };
+      }
+
+      DiyFp Normalize() const
+      {
+        DiyFp res = *this;
+        while (!(res.f & (1ull << 63)))
+        {
+          res.f <<= 1;
+          res.e--;
+        }
+        return res;
+      }
+    };
+
+    /// <summary>
+    /// Decomposed IEEE-754 value, for either single or double precision.
+    /// </summary>
+    struct FloatBits
+    {
+      uint64_t significand; // Including hidden bit
+      int exponent;
+      int significandSize; // Excluding hidden bit
+    };
+
+    static void NormalizedBoundaries(const FloatBits& v, DiyFp* pMinus, DiyFp* pPlus)
+    {
+      const uint64_t hiddenBit = 1ull << v.significandSize;
+      const int shift          = 64 - v.significandSize - 2;
+
+      DiyFp pl = { (v.significand << 1) + 1, v.exponent - 1 };
+      while (!(pl.f & (hiddenBit << 1)))
+      {
+        pl.f <<= 1;
+        pl.e--;
+      }
+      pl.f <<= shift;
+      pl.e -= shift;
+
+      // The lower boundary is closer if the significand is a power of two
+      DiyFp mi = (v.significand == hiddenBit) ? DiyFp{ (v.significand << 2) - 1, v.exponent - 2 }
+                                               : DiyFp{ (v.significand << 1) - 1, v.exponent - 1 };
+      mi.f <<= mi.e - pl.e;
+      mi.e = pl.e;
+
+      *pMinus = mi;
+      *pPlus  = pl;
+    }
+
+    // 10^k for k = -348, -340, ..., 340
+    static const DiyFp s_CachedPowers[] = {
+  { 0xfa8fd5a0081c0288ull, -1220 },
+  { 0xbaaee17fa23ebf76ull, -1193 },
+  { 0x8b16fb203055ac76ull, -1166 },
+  { 0xcf42894a5dce35eaull, -1140 },
+  { 0x9a6bb0aa55653b2dull, -1113 },
+  { 0xe61acf033d1a45dfull, -1087 },
+  { 0xab70fe17c79ac6caull, -1060 },
+  { 0xff77b1fcbebcdc4full, -1034 },
+  { 0xbe5691ef416bd60cull, -1007 },
+  { 0x8dd01fad907ffc3cull, -980 },
+  { 0xd3515c2831559a83ull, -954 },
+  { 0x9d71ac8fada6c9b5ull, -927 },
+  { 0xea9c227723ee8bcbull, -901 },
+  { 0xaecc49914078536dull, -874 },
+  { 0x823c12795db6ce57ull, -847 },
+  { 0xc21094364dfb5637ull, -821 },
+  { 0x9096ea6f3848984full, -794 },
+  { 0xd77485cb25823ac7ull, -768 },
+  { 0xa086cfcd97bf97f4ull, -741 },
+  { 0xef340a98172aace5ull, -715 },
+  { 0xb23867fb2a35b28eull, -688 },
+  { 0x84c8d4dfd2c63f3bull, -661 },
+  { 0xc5dd44271ad3cdbaull, -635 },
+  { 0x936b9fcebb25c996ull, -608 },
+  { 0xdbac6c247d62a584ull, -582 },
+  { 0xa3ab66580d5fdaf6ull, -555 },
+  { 0xf3e2f893dec3f126ull, -529 },
+  { 0xb5b5ada8aaff80b8ull, -502 },
+  { 0x87625f056c7c4a8bull, -475 },
+  { 0xc9bcff6034c13053ull, -449 },
+  { 0x964e858c91ba2655ull, -422 },
+  { 0xdff9772470297ebdull, -396 },
+  { 0xa6dfbd9fb8e5b88full, -369 },
+  { 0xf8a95fcf88747d94ull, -343 },
+  { 0xb94470938fa89bcfull, -316 },
+  { 0x8a08f0f8bf0f156bull, -289 },
+  { 0xcdb02555653131b6ull, -263 },
+  { 0x993fe2c6d07b7facull, -236 },
+  { 0xe45c10c42a2b3b06ull, -210 },
+  { 0xaa242499697392d3ull, -183 },
+  { 0xfd87b5f28300ca0eull, -157 },
+  { 0xbce5086492111aebull, -130 },
+  { 0x8cbccc096f5088ccull, -103 },
+  { 0xd1b71758e219652cull, -77 },
+  { 0x9c40000000000000ull, -50 },
+  { 0xe8d4a51000000000ull, -24 },
+  { 0xad78ebc5ac620000ull, 3 },
+  { 0x813f3978f8940984ull, 30 },
+  { 0xc097ce7bc90715b3ull, 56 },
+  { 0x8f7e32ce7bea5c70ull, 83 },
+  { 0xd5d238a4abe98068ull, 109 },
+  { 0x9f4f2726179a2245ull, 136 },
+  { 0xed63a231d4c4fb27ull, 162 },
+  { 0xb0de65388cc8ada8ull, 189 },
+  { 0x83c7088e1aab65dbull, 216 },
+  { 0xc45d1df942711d9aull, 242 },
+  { 0x924d692ca61be758ull, 269 },
+  { 0xda01ee641a708deaull, 295 },
+  { 0xa26da3999aef774aull, 322 },
+  { 0xf209787bb47d6b85ull, 348 },
+  { 0xb454e4a179dd1877ull, 375 },
+  { 0x865b86925b9bc5c2ull, 402 },
+  { 0xc83553c5c8965d3dull, 428 },
+  { 0x952ab45cfa97a0b3ull, 455 },
+  { 0xde469fbd99a05fe3ull, 481 },
+  { 0xa59bc234db398c25ull, 508 },
+  { 0xf6c69a72a3989f5cull, 534 },
+  { 0xb7dcbf5354e9beceull, 561 },
+  { 0x88fcf317f22241e2ull, 588 },
+  { 0xcc20ce9bd35c78a5ull, 614 },
+  { 0x98165af37b2153dfull, 641 },
+  { 0xe2a0b5dc971f303aull, 667 },
+  { 0xa8d9d1535ce3b396ull, 694 },
+  { 0xfb9b7cd9a4a7443cull, 720 },
+  { 0xbb764c4ca7a44410ull, 747 },
+  { 0x8bab8eefb6409c1aull, 774 },
+  { 0xd01fef10a657842cull, 800 },
+  { 0x9b10a4e5e9913129ull, 827 },
+  { 0xe7109bfba19c0c9dull, 853 },
+  { 0xac2820d9623bf429ull, 880 },
+  { 0x80444b5e7aa7cf85ull, 907 },
+  { 0xbf21e44003acdd2dull, 933 },
+  { 0x8e679c2f5e44ff8full, 960 },
+  { 0xd433179d9c8cb841ull, 986 },
+  { 0x9e19db92b4e31ba9ull, 1013 },
+  { 0xeb96bf6ebadf77d9ull, 1039 },
+  { 0xaf87023b9bf0ee6bull, 1066 }
+    };
+
+    static DiyFp GetCachedPower(int e, int* pK)
+    {
+      // dk must be positive, so we can use ceiling in a fast way
+      double dk = (-61 - e) * 0.30102999566398114 + 347;
+      int k     = static_cast<int>(dk);
+      if (dk - k > 0.0)
+      {
+        k++;
+      }
+
+      unsigned index = static_cast<unsigned>((k >> 3) + 1);
+      *pK            = -(-348 + static_cast<int>(index << 3)); // Decimal exponent, no need for lookup table
+      return s_CachedPowers[index];
+    }
+
+    static void GrisuRound(wchar_t* pBuffer, int len, uint64_t delta, uint64_t rest, uint64_t tenKappa, uint64_t wpw)
+    {
+      while (rest < wpw && delta - rest >= tenKappa &&
+             (rest + tenKappa < wpw || // Closer
+              wpw - rest > rest + tenKappa - wpw))
+      {
+        pBuffer[len - 1]--;
+        rest += tenKappa;
+      }
+    }
+
+    static int CountDecimalDigit32(uint32_t n)
+    {
+      int numDigits = 1;
+      while (numDigits < 10 && n >= s_Pow10[numDigits])
+      {
+        numDigits++;
+      }
+      return numDigits;
+    }
+
+    static int DigitGen(const DiyFp& W, const DiyFp& Mp, uint64_t delta, wchar_t* pBuffer, int* pK)
+    {
+      const DiyFp one = { 1ull << -Mp.e, Mp.e };
+      const DiyFp wpw = Mp.Sub(W);
+      uint32_t p1     = static_cast<uint32_t>(Mp.f >> -one.e);
+      uint64_t p2     = Mp.f & (one.f - 1);
+      int kappa       = CountDecimalDigit32(p1); // kappa in [0, 9]
+      int len         = 0;
+
+      while (kappa > 0)
+      {
+        uint32_t div = static_cast<uint32_t>(s_Pow10[kappa - 1]);
+        uint32_t d   = p1 / div;
+        p1 %= div;
+        if (d || len)
+        {
+          pBuffer[len++] = static_cast<wchar_t>(L'0' + d);
+        }
+        kappa--;
+        uint64_t tmp = (static_cast<uint64_t>(p1) << -one.e) + p2;
+        if (tmp <= delta)
+        {
+          *pK += kappa;
+          GrisuRound(pBuffer, len, delta, tmp, s_Pow10[kappa] << -one.e, wpw.f);
+          return len;
+        }
+      }
+
+      // kappa = 0
+      while (true)
+      {
+        p2 *= 10;
+        delta *= 10;
+        wchar_t d = static_cast<wchar_t>(p2 >> -one.e);
+        if (d || len)
+        {
+          pBuffer[len++] = static_cast<wchar_t>(L'0' + d);
+        }
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta)
+        {
+          *pK += kappa;
+          int index = -kappa;
+          GrisuRound(pBuffer, len, delta, p2, one.f, wpw.f * (static_cast<size_t>(index) < MJ_COUNTOF(s_Pow10) ? s_Pow10[index] : 0));
+          return len;
+        }
+      }
+    }
+
+    /// <summary>
+    /// Writes the shortest digit string of a positive, finite value.
+    /// The value is digits * 10^K.
+    /// </summary>
+    /// <returns>Number of digits</returns>
+    static int Grisu2(const FloatBits& value, wchar_t* pBuffer, int* pK)
+    {
+      DiyFp v = { value.significand, value.exponent };
+      MJ_UNINITIALIZED DiyFp wm;
+      MJ_UNINITIALIZED DiyFp wp;
+      NormalizedBoundaries(value, &wm, &wp);
+
+      const DiyFp cmk = GetCachedPower(wp.e, pK);
+      const DiyFp W   = v.Normalize().Mul(cmk);
+      DiyFp Wp        = wp.Mul(cmk);
+      DiyFp Wm        = wm.Mul(cmk);
+      Wm.f++;
+      Wp.f--;
+      return DigitGen(W, Wp, Wp.f - Wm.f, pBuffer, pK);
+    }
+
+    static size_t WriteExponent(wchar_t* pDest, int k)
+    {
+      wchar_t* pHead = pDest;
+      *pHead++       = L'e';
+      if (k < 0)
+      {
+        *pHead++ = L'-';
+        k        = -k;
+      }
+      else
+      {
+        *pHead++ = L'+';
+      }
+      pHead += mj::fmt::FormatUInt64(pHead, static_cast<uint64_t>(k));
+      return pHead - pDest;
+    }
+
+    /// <summary>
+    /// Turns a digit string with decimal exponent into readable notation.
+    /// The digits are already at the start of pBuffer.
+    /// </summary>
+    static size_t Prettify(wchar_t* pBuffer, int length, int k)
+    {
+      const int kk = length + k; // 10^(kk-1) <= v < 10^kk
+
+      if (0 <= k && kk <= 21)
+      {
+        // 1234e7 -> 12340000000
+        for (int i = length; i < kk; i++)
+        {
+          pBuffer[i] = L'0';
+        }
+        return kk;
+      }
+      else if (0 < kk && kk <= 21)
+      {
+        // 1234e-2 -> 12.34
+        ::memmove(&pBuffer[kk + 1], &pBuffer[kk], static_cast<size_t>(length - kk) * sizeof(wchar_t));
+        pBuffer[kk] = L'.';
+        return length + 1;
+      }
+      else if (-6 < kk && kk <= 0)
+      {
+        // 1234e-6 -> 0.001234
+        const int offset = 2 - kk;
+        ::memmove(&pBuffer[offset], &pBuffer[0], static_cast<size_t>(length) * sizeof(wchar_t));
+        pBuffer[0] = L'0';
+        pBuffer[1] = L'.';
+        for (int i = 2; i < offset; i++)
+        {
+          pBuffer[i] = L'0';
+        }
+        return length + offset;
+      }
+      else if (length == 1)
+      {
+        // 1e30
+        return 1 + WriteExponent(&pBuffer[1], kk - 1);
+      }
+      else
+      {
+        // 1234e30 -> 1.234e33
+        ::memmove(&pBuffer[2], &pBuffer[1], static_cast<size_t>(length - 1) * sizeof(wchar_t));
+        pBuffer[1] = L'.';
+        return length + 1 + WriteExponent(&pBuffer[length + 1], kk - 1);
+      }
+    }
+
+    /// <summary>
+    /// Shared by FormatDouble and FormatFloat after the bits have been decomposed.
+    /// </summary>
+    static size_t FormatFloatBits(wchar_t* pDest, bool negative, bool special, const FloatBits& bits)
+    {
+      wchar_t* pHead = pDest;
+      if (negative)
+      {
+        *pHead++ = L'-';
+      }
+
+      if (special)
+      {
+        // Infinity or NaN (sign is ignored for NaN)
+        if (bits.significand != (1ull << bits.significandSize))
+        {
+          pDest[0] = L'n';
+          pDest[1] = L'a';
+          pDest[2] = L'n';
+          return 3;
+        }
+        pHead[0] = L'i';
+        pHead[1] = L'n';
+        pHead[2] = L'f';
+        return (pHead - pDest) + 3;
+      }
+
+      if (bits.significand == 0)
+      {
+        *pHead++ = L'0';
+        return pHead - pDest;
+      }
+
+      MJ_UNINITIALIZED int k;
+      int length = Grisu2(bits, pHead, &k);
+      return (pHead - pDest) + Prettify(pHead, length, k);
+    }
+  } // namespace detail
+} // namespace mj
+
+size_t mj::fmt::FormatDouble(wchar_t* pDest, double value)
+{
+  MJ_UNINITIALIZED uint64_t u;
+  static_assert(sizeof(u) == sizeof(value));
+  ::memcpy(&u, &value, sizeof(u));
+
+  const int biasedExponent = static_cast<int>((u >> 52) & 0x7FF);
+  const uint64_t fraction  = u & ((1ull << 52) - 1);
+
+  MJ_UNINITIALIZED detail::FloatBits bits;
+  bits.significandSize = 52;
+  if (biasedExponent == 0)
+  {
+    // Zero or denormal
+    bits.significand = fraction;
+    bits.exponent    = 1 - 1075;
+  }
+  else
+  {
+    bits.significand = fraction | (1ull << 52);
+    bits.exponent    = biasedExponent - 1075;
+  }
+
+  return detail::FormatFloatBits(pDest, (u >> 63) != 0, biasedExponent == 0x7FF, bits);
+}
+
+size_t mj::fmt::FormatFloat(wchar_t* pDest, float value)
+{
+  MJ_UNINITIALIZED uint32_t u;
+  static_assert(sizeof(u) == sizeof(value));
+  ::memcpy(&u, &value, sizeof(u));
+
+  const int biasedExponent = static_cast<int>((u >> 23) & 0xFF);
+  const uint32_t fraction  = u & ((1u << 23) - 1);
+
+  MJ_UNINITIALIZED detail::FloatBits bits;
+  bits.significandSize = 23;
+  if (biasedExponent == 0)
+  {
+    bits.significand = fraction;
+    bits.exponent    = 1 - 150;
+  }
+  else
+  {
+    bits.significand = fraction | (1u << 23);
+    bits.exponent    = biasedExponent - 150;
+  }
+
+  return detail::FormatFloatBits(pDest, (u >> 31) != 0, biasedExponent == 0xFF, bits);
+}
+
+size_t mj::fmt::FormatByteSize(wchar_t* pDest, uint64_t numBytes)
+{
+  static const wchar_t s_UnitPrefixes[] = { L'K', L'M', L'G', L'T', L'P', L'E' };
+
+  wchar_t* pHead = pDest;
+
+  if (numBytes < 1024)
+  {
+    pHead += FormatUInt64(pHead, numBytes);
+    *pHead++ = L' ';
+    *pHead++ = L'B';
+    return pHead - pDest;
+  }
+
+  // Find the largest unit that keeps the whole part at or above 1
+  uint32_t unit  = 0; // Index into s_UnitPrefixes
+  uint32_t shift = 10;
+  while (unit + 1 < MJ_COUNTOF(s_UnitPrefixes) && (numBytes >> (shift + 10)) > 0)
+  {
+    unit++;
+    shift += 10;
+  }
+
+  // One decimal, rounded to nearest. Cannot overflow: remainder < 2^60.
+  uint64_t whole     = numBytes >> shift;
+  uint64_t remainder = numBytes & ((1ull << shift) - 1);
+  uint64_t tenths    = (remainder * 10 + (1ull << (shift - 1))) >> shift;
+  if (tenths == 10)
+  {
+    whole++;
+    tenths = 0;
+  }
+  if (whole == 1024 && unit + 1 < MJ_COUNTOF(s_UnitPrefixes))
+  {
+    // 1023.96 KiB rounds up to 1.0 MiB
+    whole = 1;
+    unit++;
+  }
+
+  pHead += FormatUInt64(pHead, whole);
+  *pHead++ = L'.';
+  *pHead++ = static_cast<wchar_t>(L'0' + tenths);
+  *pHead++ = L' ';
+  *pHead++ = s_UnitPrefixes[unit];
+  *pHead++ = L'i';
+  *pHead++ = L'B';
+  return pHead - pDest;
+}
+
+size_t mj::fmt::FormatIsoDate(wchar_t* pDest, uint64_t fileTime)
+{
+  static constexpr uint64_t kTicksPerSecond = 10000000;
+  static constexpr uint64_t kSecondsPerDay  = 86400;
+  // Days from 0000-03-01 (proleptic Gregorian) to 1601-01-01
+  static constexpr int64_t kEpochShift = 584694;
+
+  uint64_t seconds   = fileTime / kTicksPerSecond;
+  uint64_t days      = seconds / kSecondsPerDay;
+  uint32_t dayTime   = static_cast<uint32_t>(seconds % kSecondsPerDay);
+  uint32_t hour      = dayTime / 3600;
+  uint32_t minute    = (dayTime / 60) % 60;
+  uint32_t second    = dayTime % 60;
+
+  // Civil from days, see http://howardhinnant.github.io/date_algorithms.html
+  // Shifted so that the year starts in March, which puts the leap day last.
+  int64_t z           = static_cast<int64_t>(days) + kEpochShift;
+  int64_t era         = z / 146097;
+  uint32_t dayOfEra   = static_cast<uint32_t>(z - era * 146097);                                   // [0, 146096]
+  uint32_t yearOfEra  = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365; // [0, 399]
+  uint32_t dayOfYear  = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);           // [0, 365]
+  uint32_t monthIndex = (5 * dayOfYear + 2) / 153;                                                 // [0, 11]
+  uint32_t day        = dayOfYear - (153 * monthIndex + 2) / 5 + 1;                                // [1, 31]
+  uint32_t month      = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;                         // [1, 12]
+  uint64_t year       = static_cast<uint64_t>(era * 400 + yearOfEra) + (month <= 2 ? 1 : 0);
+
+  // FILETIME tops out at year 30828, clamp to four digits
+  if (year > 9999)
+  {
+    year = 9999;
+  }
+
+  WriteDigits(pDest, year, 4);
+  pDest[4] = L'-';
+  WriteDigits(pDest + 5, month, 2);
+  pDest[7] = L'-';
+  WriteDigits(pDest + 8, day, 2);
+  pDest[10] = L' ';
+  WriteDigits(pDest + 11, hour, 2);
+  pDest[13] = L':';
+  WriteDigits(pDest + 14, minute, 2);
+  pDest[16] = L':';
+  WriteDigits(pDest + 17, second, 2);
+
+  return kMaxIsoDateChars;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+namespace mj
+{
+  /// <summary>
+  /// Low-level number formatting into wide character buffers.
+  /// None of these functions add a null terminator.
+  /// The StringBuilder wraps these, use that instead if you can.
+  /// </summary>
+  namespace fmt
+  {
+    // Upper bounds for destination buffers, in characters
+    static constexpr size_t kMaxUInt64Chars   = 20; // 18446744073709551615
+    static constexpr size_t kMaxInt64Chars    = 20; // -9223372036854775808
+    static constexpr size_t kMaxDoubleChars   = 32; // -2.2250738585072014e-308 plus decimal padding
+    static constexpr size_t kMaxByteSizeChars = 10; // 1023.9 KiB
+    static constexpr size_t kMaxIsoDateChars  = 19; // 2020-01-31 23:59:59
+
+    /// <summary>
+    /// Number of decimal digits of an unsigned integer. Zero has one digit.
+    /// </summary>
+    size_t CountDigits(uint64_t value);
+
+    /// <summary>
+    /// Writes exactly numDigits characters, zero-padded on the left.
+    /// numDigits must be at least CountDigits(value).
+    /// Uses a two-digit lookup table, so there are half as many divisions.
+    /// </summary>
+    void WriteDigits(wchar_t* pDest, uint64_t value, size_t numDigits);
+
+    /// <returns>Number of characters written, at most kMaxUInt64Chars</returns>
+    size_t FormatUInt64(wchar_t* pDest, uint64_t value);
+
+    /// <summary>
+    /// Handles INT64_MIN.
+    /// </summary>
+    /// <returns>Number of characters written, at most kMaxInt64Chars</returns>
+    size_t FormatInt64(wchar_t* pDest, int64_t value);
+
+    /// <summary>
+    /// Always parses back to the same value, and is the shortest such
+    /// representation for all but a fraction of a percent of inputs (Grisu2).
+    /// Integral values are printed without a fraction ("3", not "3.0").
+    /// Very large or small exponents switch to scientific notation ("1.5e+22").
+    /// </summary>
+    /// <returns>Number of characters written, at most kMaxDoubleChars</returns>
+    size_t FormatDouble(wchar_t* pDest, double value);
+
+    /// <summary>
+    /// Same as FormatDouble, but shortest with respect to single precision,
+    /// so 0.1f prints as "0.1" and not as "0.10000000149011612".
+    /// </summary>
+    /// <returns>Number of characters written, at most kMaxDoubleChars</returns>
+    size_t FormatFloat(wchar_t* pDest, float value);
+
+    /// <summary>
+    /// Human-readable size using binary (IEC) units with one decimal.
+    /// Examples: "0 B", "1023 B", "1.0 KiB", "1.4 GiB".
+    /// </summary>
+    /// <returns>Number of characters written, at most kMaxByteSizeChars</returns>
+    size_t FormatByteSize(wchar_t* pDest, uint64_t numBytes);
+
+    /// <summary>
+    /// Formats a FILETIME value (100-nanosecond intervals since January 1, 1601)
+    /// as "YYYY-MM-DD hh:mm:ss". No time zone conversion is done,
+    /// call FileTimeToLocalFileTime first if you want local time.
+    /// </summary>
+    /// <returns>Number of characters written, always kMaxIsoDateChars</returns>
+    size_t FormatIsoDate(wchar_t* pDest, uint64_t fileTime);
+  } // namespace fmt
+} // namespace mj
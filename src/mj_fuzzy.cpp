@@ -0,0 +1,686 @@
+#include "mj_fuzzy.h"
+#include <emmintrin.h>
+#include "../3rdparty/tracy/Tracy.hpp"
+
+// Scoring constants, see FuzzyScore
+static constexpr int32_t kScoreMatch       = 16;
+static constexpr int32_t kScoreGapStart    = -3;
+static constexpr int32_t kScoreGapExtend   = -1;
+static constexpr int32_t kBonusBoundary    = 8;
+static constexpr int32_t kBonusCamelCase   = 7;
+static constexpr int32_t kBonusConsecutive = 4;
+static constexpr int32_t kFirstCharFactor  = 2;
+static constexpr int32_t kScoreInvalid     = -(1 << 24);
+
+static wchar_t Fold(wchar_t c)
+{
+  return (c >= L'A' && c <= L'Z') ? static_cast<wchar_t>(c | 0x20) : c;
+}
+
+static bool IsLower(wchar_t c)
+{
+  return c >= L'a' && c <= L'z';
+}
+
+static bool IsUpper(wchar_t c)
+{
+  return c >= L'A' && c <= L'Z';
+}
+
+static bool IsDigit(wchar_t c)
+{
+  return c >= L'0' && c <= L'9';
+}
+
+static bool IsDelimiter(wchar_t c)
+{
+  return c == L' ' || c == L'_' || c == L'-' || c == L'.' || c == L'/' || c == L'\\';
+}
+
+static uint64_t CharBit(wchar_t c)
+{
+  c = Fold(c);
+  if (IsLower(c))
+  {
+    return 1ull << (c - L'a'); // Bits 0-25
+  }
+  else if (IsDigit(c))
+  {
+    return 1ull << (26 + (c - L'0')); // Bits 26-35
+  }
+  else
+  {
+    return 1ull << (36 + (c % 28)); // Bits 36-63
+  }
+}
+
+/// <summary>
+/// Bonus for matching the character at the given index of the candidate.
+/// </summary>
+static int32_t PositionBonus(const mj::StringView& candidate, size_t index)
+{
+  if (index == 0)
+  {
+    return kBonusBoundary;
+  }
+
+  wchar_t prev = candidate.ptr[index - 1];
+  wchar_t cur  = candidate.ptr[index];
+
+  if (IsDelimiter(prev))
+  {
+    return kBonusBoundary;
+  }
+  if ((IsLower(prev) && IsUpper(cur)) || (!IsDigit(prev) && IsDigit(cur)))
+  {
+    return kBonusCamelCase;
+  }
+  return 0;
+}
+
+/// <summary>
+/// Ordering for the top-K heap: higher scores first, ties are broken by original order.
+/// </summary>
+static bool IsBetter(const mj::FuzzyMatch& a, const mj::FuzzyMatch& b)
+{
+  return a.score > b.score || (a.score == b.score && a.index < b.index);
+}
+
+/// <summary>
+/// Restores the heap property below the given node. The worst match is at the root.
+/// </summary>
+static void SiftDown(mj::FuzzyMatch* pHeap, size_t size, size_t node)
+{
+  while (true)
+  {
+    size_t worst = node;
+    size_t left  = 2 * node + 1;
+    size_t right = left + 1;
+
+    if (left < size && IsBetter(pHeap[worst], pHeap[left]))
+    {
+      worst = left;
+    }
+    if (right < size && IsBetter(pHeap[worst], pHeap[right]))
+    {
+      worst = right;
+    }
+    if (worst == node)
+    {
+      break;
+    }
+
+    mj::swap(pHeap[node], pHeap[worst]);
+    node = worst;
+  }
+}
+
+static void SiftUp(mj::FuzzyMatch* pHeap, size_t node)
+{
+  while (node > 0)
+  {
+    size_t parent = (node - 1) / 2;
+    if (!IsBetter(pHeap[parent], pHeap[node]))
+    {
+      break;
+    }
+
+    mj::swap(pHeap[node], pHeap[parent]);
+    node = parent;
+  }
+}
+
+/// <summary>
+/// Sorts best-first, in place.
+/// </summary>
+static void HeapSort(mj::FuzzyMatch* pMatches, size_t size)
+{
+  for (size_t i = size / 2; i > 0; i--)
+  {
+    SiftDown(pMatches, size, i - 1);
+  }
+
+  // Move the worst match to the back, repeatedly
+  for (size_t end = size; end > 1; end--)
+  {
+    mj::swap(pMatches[0], pMatches[end - 1]);
+    SiftDown(pMatches, end - 1, 0);
+  }
+}
+
+uint64_t mj::FuzzyCharMask(const StringView& string)
+{
+  uint64_t mask = 0;
+  for (size_t i = 0; i < string.len; i++)
+  {
+    mask |= CharBit(string.ptr[i]);
+  }
+  return mask;
+}
+
+void mj::FuzzyQuery::Init(const StringView& query)
+{
+  this->len  = static_cast<uint32_t>(query.len < kMaxLength ? query.len : kMaxLength);
+  this->mask = 0;
+  for (uint32_t i = 0; i < this->len; i++)
+  {
+    this->chars[i] = Fold(query.ptr[i]);
+    this->mask |= CharBit(this->chars[i]);
+  }
+}
+
+bool mj::FuzzyQuery::Narrows(const FuzzyQuery& previous) const
+{
+  uint32_t j = 0;
+  for (uint32_t i = 0; i < this->len && j < previous.len; i++)
+  {
+    if (this->chars[i] == previous.chars[j])
+    {
+      j++;
+    }
+  }
+  return j == previous.len;
+}
+
+int32_t mj::FuzzyScore(const FuzzyQuery& query, const StringView& candidate)
+{
+  const uint32_t m = query.len;
+  if (m == 0)
+  {
+    return 0;
+  }
+
+  // Cheap rejection, and the range we need to look at:
+  // the first position of the first query character up to the last one of the last.
+  size_t first = candidate.len;
+  {
+    uint32_t i = 0;
+    for (size_t j = 0; j < candidate.len && i < m; j++)
+    {
+      if (Fold(candidate.ptr[j]) == query.chars[i])
+      {
+        if (i == 0)
+        {
+          first = j;
+        }
+        i++;
+      }
+    }
+    if (i < m)
+    {
+      return -1;
+    }
+  }
+  size_t last = candidate.len;
+  while (Fold(candidate.ptr[last - 1]) != query.chars[m - 1])
+  {
+    last--;
+  }
+
+  // One column of the DP matrix, updated in place for every candidate character.
+  // matched[i]: best score with query[i] matched at the current position.
+  // gapped[i]:  best score with query[i] matched earlier, and a gap since.
+  MJ_UNINITIALIZED int32_t matched[FuzzyQuery::kMaxLength];
+  MJ_UNINITIALIZED int32_t gapped[FuzzyQuery::kMaxLength];
+  for (uint32_t i = 0; i < m; i++)
+  {
+    matched[i] = kScoreInvalid;
+    gapped[i]  = kScoreInvalid;
+  }
+
+  int32_t best = kScoreInvalid;
+  for (size_t j = first; j < last; j++)
+  {
+    const wchar_t c = Fold(candidate.ptr[j]);
+    int32_t bonus   = -1; // Lazily computed
+
+    // Walk backwards so index i - 1 still holds the previous column
+    for (uint32_t i = m; i > 0; i--)
+    {
+      const uint32_t q = i - 1;
+
+      int32_t gap = matched[q] + kScoreGapStart;
+      if (gapped[q] + kScoreGapExtend > gap)
+      {
+        gap = gapped[q] + kScoreGapExtend;
+      }
+
+      int32_t match = kScoreInvalid;
+      if (query.chars[q] == c)
+      {
+        if (bonus < 0)
+        {
+          bonus = PositionBonus(candidate, j);
+        }
+
+        if (q == 0)
+        {
+          // Leading gaps are free
+          match = kScoreMatch + bonus * kFirstCharFactor;
+        }
+        else
+        {
+          int32_t prev = matched[q - 1] + kBonusConsecutive;
+          if (gapped[q - 1] > prev)
+          {
+            prev = gapped[q - 1];
+          }
+          if (prev > kScoreInvalid / 2)
+          {
+            match = prev + kScoreMatch + bonus;
+          }
+        }
+      }
+
+      matched[q] = match;
+      gapped[q]  = gap < kScoreInvalid ? kScoreInvalid : gap;
+    }
+
+    // Trailing gaps are free
+    if (matched[m - 1] > best)
+    {
+      best = matched[m - 1];
+    }
+  }
+
+  return best < 0 ? 0 : best;
+}
+
+void mj::FuzzyFilter::Init(AllocatorBase* pAllocator, IFuzzyFilterHandler* pHandler)
+{
+  this->pAllocator = pAllocator;
+  this->pHandler   = pHandler;
+  this->masks.Init(pAllocator);
+  this->candidates.Init(pAllocator);
+  this->candidateMasks.Init(pAllocator);
+  this->survivors.Init(pAllocator);
+  this->survivorMasks.Init(pAllocator);
+  this->chunkMatches.Init(pAllocator);
+  this->results.Init(pAllocator);
+}
+
+void mj::FuzzyFilter::Destroy()
+{
+  this->masks.Destroy();
+  this->candidates.Destroy();
+  this->candidateMasks.Destroy();
+  this->survivors.Destroy();
+  this->survivorMasks.Destroy();
+  this->chunkMatches.Destroy();
+  this->results.Destroy();
+  this->pNames           = nullptr;
+  this->numNames         = 0;
+  this->numMatches       = 0;
+  this->hasQueuedQuery   = false;
+  this->hasPreviousQuery = false;
+  this->hasQueuedNames   = false;
+}
+
+void mj::FuzzyFilter::SetNames(ArrayListView<const StringView> names)
+{
+  if (this->IsBusy())
+  {
+    // The chunk tasks are still reading the old names
+    this->pQueuedNames   = names.Get();
+    this->queuedNumNames = static_cast<uint32_t>(names.Size());
+    this->hasQueuedNames = true;
+  }
+  else
+  {
+    this->ApplyNames(names.Get(), static_cast<uint32_t>(names.Size()));
+  }
+}
+
+void mj::FuzzyFilter::ApplyNames(const StringView* pNames, uint32_t numNames)
+{
+  ZoneScoped;
+
+  this->pNames           = pNames;
+  this->numNames         = numNames;
+  this->hasPreviousQuery = false;
+  this->numMatches       = 0;
+  this->results.Clear();
+  this->masks.Clear();
+
+  if (numNames > 0)
+  {
+    uint64_t* pMasks = this->masks.Emplace(numNames);
+    if (!pMasks)
+    {
+      // Out of memory, behave as if the list is empty
+      this->numNames = 0;
+      return;
+    }
+
+    for (uint32_t i = 0; i < numNames; i++)
+    {
+      pMasks[i] = FuzzyCharMask(pNames[i]);
+    }
+  }
+}
+
+void mj::FuzzyFilter::SetQuery(const StringView& query, uint32_t maxResults)
+{
+  MJ_UNINITIALIZED FuzzyQuery fuzzyQuery;
+  fuzzyQuery.Init(query);
+
+  if (this->IsBusy())
+  {
+    this->queuedQuery      = fuzzyQuery;
+    this->queuedMaxResults = maxResults;
+    this->hasQueuedQuery   = true;
+  }
+  else
+  {
+    this->Start(fuzzyQuery, maxResults);
+  }
+}
+
+void mj::FuzzyFilter::Start(const FuzzyQuery& query, uint32_t maxResults)
+{
+  ZoneScoped;
+
+  const bool narrows = this->hasPreviousQuery && query.Narrows(this->query);
+
+  this->query      = query;
+  this->maxResults = maxResults;
+
+  if (query.len == 0)
+  {
+    // Everything matches, Finish takes care of it
+    this->Finish();
+    return;
+  }
+
+  // Gather the candidates
+  if (narrows)
+  {
+    // Compact the survivors of the previous query, and scan only those.
+    // Chunks are in order, so the destination never overtakes the source.
+    uint32_t numCandidates = 0;
+    for (uint32_t c = 0; c < this->numChunks; c++)
+    {
+      const Chunk& chunk = this->chunks[c];
+      for (uint32_t i = 0; i < chunk.numSurvivors; i++)
+      {
+        this->survivors[numCandidates]     = this->survivors[chunk.begin + i];
+        this->survivorMasks[numCandidates] = this->survivorMasks[chunk.begin + i];
+        numCandidates++;
+      }
+    }
+    this->survivors.Truncate(numCandidates);
+    this->survivorMasks.Truncate(numCandidates);
+    mj::swap(this->candidates, this->survivors);
+    mj::swap(this->candidateMasks, this->survivorMasks);
+  }
+  else
+  {
+    this->candidates.Clear();
+    this->candidateMasks.Clear();
+    if (this->numNames > 0)
+    {
+      uint32_t* pCandidates     = this->candidates.Emplace(this->numNames);
+      uint64_t* pCandidateMasks = this->candidateMasks.Emplace(this->numNames);
+      if (!pCandidates || !pCandidateMasks)
+      {
+        this->hasPreviousQuery = false;
+        this->numChunks        = 0;
+        this->Finish();
+        return;
+      }
+
+      for (uint32_t i = 0; i < this->numNames; i++)
+      {
+        pCandidates[i] = i;
+      }
+      static_cast<void>(memcpy(pCandidateMasks, this->masks.begin(), this->numNames * sizeof(uint64_t)));
+    }
+  }
+
+  this->numChunks = 0;
+
+  const uint32_t numCandidates = static_cast<uint32_t>(this->candidates.Size());
+
+  // Split into chunks
+  uint32_t numChunks = numCandidates / kMinChunkSize;
+  if (numChunks < 1)
+  {
+    numChunks = 1;
+  }
+  else if (numChunks > kMaxChunks)
+  {
+    numChunks = kMaxChunks;
+  }
+
+  // Output buffers. Survivors mirror the candidates, matches get maxResults slots per chunk.
+  this->survivors.Clear();
+  this->survivorMasks.Clear();
+  this->chunkMatches.Clear();
+  if (numCandidates > 0 &&
+      (!this->survivors.Reserve(numCandidates) || !this->survivorMasks.Reserve(numCandidates) ||
+       (maxResults > 0 && !this->chunkMatches.Reserve(numChunks * maxResults))))
+  {
+    this->hasPreviousQuery = false;
+    this->Finish();
+    return;
+  }
+  static_cast<void>(this->survivors.Emplace(numCandidates));
+  static_cast<void>(this->survivorMasks.Emplace(numCandidates));
+  static_cast<void>(this->chunkMatches.Emplace(numChunks * maxResults));
+
+  const uint32_t chunkSize = (numCandidates + numChunks - 1) / numChunks;
+  for (uint32_t c = 0; c < numChunks; c++)
+  {
+    Chunk& chunk       = this->chunks[c];
+    chunk.begin        = c * chunkSize;
+    chunk.end          = (c + 1) * chunkSize < numCandidates ? (c + 1) * chunkSize : numCandidates;
+    chunk.numSurvivors = 0;
+    chunk.numMatches   = 0;
+  }
+  this->numChunks = numChunks;
+
+  if (numChunks == 1)
+  {
+    // Not worth a round trip through the threadpool
+    this->ScanChunk(0);
+    this->Finish();
+  }
+  else
+  {
+    this->numChunksPending = numChunks;
+    for (uint32_t c = 0; c < numChunks; c++)
+    {
+      auto pTask        = ThreadpoolCreateTask<detail::FuzzyFilterChunkTask>();
+      pTask->pFilter    = this;
+      pTask->chunkIndex = c;
+      pTask->priority   = ETaskPriority::Interactive;
+      ThreadpoolSubmitTask(pTask);
+    }
+  }
+}
+
+void mj::FuzzyFilter::ScanChunk(uint32_t chunkIndex)
+{
+  ZoneScoped;
+
+  Chunk& chunk                = this->chunks[chunkIndex];
+  const uint32_t* pCandidates = this->candidates.begin();
+  const uint64_t* pMasks      = this->candidateMasks.begin();
+  uint32_t* pSurvivors        = this->survivors.begin() + chunk.begin;
+  uint64_t* pSurvivorMasks    = this->survivorMasks.begin() + chunk.begin;
+  FuzzyMatch* pHeap           = this->chunkMatches.begin() + static_cast<size_t>(chunkIndex) * this->maxResults;
+  const uint64_t queryMask    = this->query.mask;
+  const __m128i queryMask128  = _mm_set1_epi64x(static_cast<long long>(queryMask));
+  uint32_t numSurvivors       = 0;
+  uint32_t numHeap            = 0;
+
+  uint32_t i = chunk.begin;
+  while (i < chunk.end)
+  {
+    // Prefilter two masks at a time. A name survives if it contains every character class of the query.
+    // There is no 64-bit compare in SSE2, so both 32-bit halves have to compare equal.
+    uint32_t bits = 0;
+    uint32_t num  = 1;
+    if (i + 2 <= chunk.end)
+    {
+      __m128i m   = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pMasks + i));
+      __m128i eq  = _mm_cmpeq_epi32(_mm_and_si128(m, queryMask128), queryMask128);
+      int32_t res = _mm_movemask_ps(_mm_castsi128_ps(eq));
+      bits        = ((res & 0x3) == 0x3 ? 1 : 0) | ((res & 0xC) == 0xC ? 2 : 0);
+      num         = 2;
+    }
+    else
+    {
+      bits = (pMasks[i] & queryMask) == queryMask ? 1 : 0;
+    }
+
+    for (uint32_t k = 0; k < num; k++)
+    {
+      if (bits & (1 << k))
+      {
+        const uint32_t index = pCandidates[i + k];
+        const int32_t score  = FuzzyScore(this->query, this->pNames[index]);
+        if (score >= 0)
+        {
+          pSurvivors[numSurvivors]     = index;
+          pSurvivorMasks[numSurvivors] = pMasks[i + k];
+          numSurvivors++;
+
+          // Keep the best maxResults matches
+          const FuzzyMatch match = { index, score };
+          if (numHeap < this->maxResults)
+          {
+            pHeap[numHeap] = match;
+            SiftUp(pHeap, numHeap);
+            numHeap++;
+          }
+          else if (numHeap > 0 && IsBetter(match, pHeap[0]))
+          {
+            pHeap[0] = match;
+            SiftDown(pHeap, numHeap, 0);
+          }
+        }
+      }
+    }
+
+    i += num;
+  }
+
+  chunk.numSurvivors = numSurvivors;
+  chunk.numMatches   = numHeap;
+}
+
+void mj::FuzzyFilter::OnChunkDone()
+{
+  if (--this->numChunksPending == 0)
+  {
+    this->Finish();
+  }
+}
+
+void mj::FuzzyFilter::Finish()
+{
+  ZoneScoped;
+
+  this->results.Clear();
+  this->numMatches = 0;
+
+  if (this->query.len == 0)
+  {
+    // Everything matches, in the original order.
+    // There is nothing to narrow down from, so the next query scans all names.
+    this->hasPreviousQuery = false;
+    this->numMatches       = this->numNames;
+
+    const uint32_t numResults = this->numNames < this->maxResults ? this->numNames : this->maxResults;
+    FuzzyMatch* pResults      = this->results.Emplace(numResults);
+    if (pResults)
+    {
+      for (uint32_t i = 0; i < numResults; i++)
+      {
+        pResults[i] = { i, 0 };
+      }
+    }
+  }
+  else
+  {
+    // Merge the per-chunk heaps
+    size_t numResults = 0;
+    for (uint32_t c = 0; c < this->numChunks; c++)
+    {
+      this->numMatches += this->chunks[c].numSurvivors;
+      numResults += this->chunks[c].numMatches;
+    }
+
+    FuzzyMatch* pResults = this->results.Emplace(numResults);
+    if (pResults)
+    {
+      FuzzyMatch* pDst = pResults;
+      for (uint32_t c = 0; c < this->numChunks; c++)
+      {
+        const FuzzyMatch* pSrc = this->chunkMatches.begin() + static_cast<size_t>(c) * this->maxResults;
+        for (uint32_t i = 0; i < this->chunks[c].numMatches; i++)
+        {
+          *pDst++ = pSrc[i];
+        }
+      }
+
+      HeapSort(pResults, numResults);
+      if (numResults > this->maxResults)
+      {
+        this->results.Truncate(this->maxResults);
+      }
+    }
+
+    this->hasPreviousQuery = this->numChunks > 0;
+  }
+
+  if (this->hasQueuedNames)
+  {
+    // The names changed, so these results are stale. Run the query again unless there is a newer one.
+    this->hasQueuedNames = false;
+    this->ApplyNames(this->pQueuedNames, this->queuedNumNames);
+    if (!this->hasQueuedQuery)
+    {
+      this->queuedQuery      = this->query;
+      this->queuedMaxResults = this->maxResults;
+      this->hasQueuedQuery   = true;
+    }
+  }
+
+  if (this->hasQueuedQuery)
+  {
+    // These results are already stale, skip straight to the newest query
+    this->hasQueuedQuery = false;
+    this->Start(this->queuedQuery, this->queuedMaxResults);
+  }
+  else if (this->pHandler)
+  {
+    this->pHandler->OnFuzzyFilterDone(this);
+  }
+}
+
+bool mj::FuzzyFilter::IsBusy() const
+{
+  return this->numChunksPending > 0;
+}
+
+mj::ArrayListView<const mj::FuzzyMatch> mj::FuzzyFilter::Results() const
+{
+  return ArrayListView<const FuzzyMatch>(this->results.begin(), this->results.Size());
+}
+
+uint32_t mj::FuzzyFilter::NumMatches() const
+{
+  return this->numMatches;
+}
+
+void mj::detail::FuzzyFilterChunkTask::Execute()
+{
+  this->pFilter->ScanChunk(this->chunkIndex);
+}
+
+void mj::detail::FuzzyFilterChunkTask::OnDone()
+{
+  this->pFilter->OnChunkDone();
+}
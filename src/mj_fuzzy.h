@@ -0,0 +1,197 @@
+#pragma once
+#include "mj_common.h"
+#include "mj_string.h"
+#include "Threadpool.h"
+
+namespace mj
+{
+  /// <summary>
+  /// Folded query, ready for matching.
+  /// Matching is case-insensitive for ASCII letters.
+  /// </summary>
+  struct FuzzyQuery
+  {
+    static constexpr uint32_t kMaxLength = 64;
+
+    MJ_UNINITIALIZED wchar_t chars[kMaxLength];
+    MJ_UNINITIALIZED uint32_t len;
+
+    /// <summary>
+    /// Set of character classes that occur in the query, see FuzzyCharMask.
+    /// </summary>
+    MJ_UNINITIALIZED uint64_t mask;
+
+    /// <summary>
+    /// Characters beyond kMaxLength are ignored.
+    /// </summary>
+    void Init(const StringView& query);
+
+    /// <summary>
+    /// True if every name matching this query also matches the previous query,
+    /// which is the case if the previous query is a subsequence of this one.
+    /// </summary>
+    bool Narrows(const FuzzyQuery& previous) const;
+  };
+
+  struct FuzzyMatch
+  {
+    uint32_t index; // Index into the names array
+    int32_t score;
+  };
+
+  /// <summary>
+  /// 64-bit set of character classes: one bit per ASCII letter (case-insensitive) and digit,
+  /// the remaining bits are shared by all other characters.
+  /// A name can only match a query if its mask contains all bits of the query mask.
+  /// </summary>
+  uint64_t FuzzyCharMask(const StringView& string);
+
+  /// <summary>
+  /// Scores the best alignment of the query as a subsequence of the candidate,
+  /// Smith-Waterman style with affine gap penalties. Matches at word boundaries,
+  /// camelCase humps and consecutive runs score higher.
+  /// </summary>
+  /// <returns>Negative if the query is not a subsequence of the candidate.</returns>
+  int32_t FuzzyScore(const FuzzyQuery& query, const StringView& candidate);
+
+  class FuzzyFilter;
+
+  class IFuzzyFilterHandler
+  {
+  public:
+    /// <summary>
+    /// Called on the main thread when a query has finished. Results() is valid until the next query starts.
+    /// </summary>
+    virtual void OnFuzzyFilterDone(FuzzyFilter* pFilter) = 0;
+  };
+
+  namespace detail
+  {
+    struct FuzzyFilterChunkTask;
+  }
+
+  /// <summary>
+  /// Type-to-filter over a list of names.
+  /// Large lists are split into chunks that are scanned on the threadpool.
+  /// Each chunk is prefiltered with character masks (SSE2), survivors are scored
+  /// and the best matches are kept with a bounded heap.
+  /// If a query narrows the previous one (e.g. a character was typed at the end),
+  /// only the names that matched the previous query are scanned.
+  /// Only one query runs at a time. A query that arrives while busy is queued,
+  /// and only the most recent queued query is run.
+  /// Main thread only.
+  /// </summary>
+  class FuzzyFilter
+  {
+  private:
+    friend struct detail::FuzzyFilterChunkTask;
+
+    static constexpr uint32_t kMaxChunks = 16;
+
+    /// <summary>
+    /// Below this many candidates per chunk, the overhead of a task is not worth it.
+    /// </summary>
+    static constexpr uint32_t kMinChunkSize = 4096;
+
+    struct Chunk
+    {
+      uint32_t begin; // Range in candidates
+      uint32_t end;
+      uint32_t numSurvivors;
+      uint32_t numMatches;
+    };
+
+    AllocatorBase* pAllocator     = nullptr;
+    IFuzzyFilterHandler* pHandler = nullptr;
+
+    // Input
+    const StringView* pNames = nullptr;
+    uint32_t numNames        = 0;
+    ArrayList<uint64_t> masks;
+
+    // Names that can match the current query (indices and masks side by side)
+    ArrayList<uint32_t> candidates;
+    ArrayList<uint64_t> candidateMasks;
+
+    // Chunk output. Survivors are written to the same range as the input,
+    // so chunks never share memory.
+    ArrayList<uint32_t> survivors;
+    ArrayList<uint64_t> survivorMasks;
+    ArrayList<FuzzyMatch> chunkMatches;
+    Chunk chunks[kMaxChunks];
+    uint32_t numChunks        = 0;
+    uint32_t numChunksPending = 0;
+
+    // Results of the last finished query
+    ArrayList<FuzzyMatch> results;
+    uint32_t numMatches = 0;
+
+    MJ_UNINITIALIZED FuzzyQuery query;
+    MJ_UNINITIALIZED FuzzyQuery queuedQuery;
+    uint32_t maxResults            = 0;
+    uint32_t queuedMaxResults      = 0;
+    bool hasQueuedQuery            = false;
+    bool hasPreviousQuery          = false;
+    const StringView* pQueuedNames = nullptr;
+    uint32_t queuedNumNames        = 0;
+    bool hasQueuedNames            = false;
+
+    void ApplyNames(const StringView* pNames, uint32_t numNames);
+    void Start(const FuzzyQuery& query, uint32_t maxResults);
+    void ScanChunk(uint32_t chunkIndex);
+    void OnChunkDone();
+    void Finish();
+
+  public:
+    /// <summary>
+    /// Does no allocation on construction.
+    /// </summary>
+    void Init(AllocatorBase* pAllocator, IFuzzyFilterHandler* pHandler);
+
+    /// <summary>
+    /// Data is freed using the assigned allocator.
+    /// Do not call while busy.
+    /// </summary>
+    void Destroy();
+
+    /// <summary>
+    /// Replaces the list of names and forgets the previous query.
+    /// The names must stay valid and unchanged until the next call to SetNames,
+    /// or until IsBusy() returns false if the filter is busy.
+    /// </summary>
+    void SetNames(ArrayListView<const StringView> names);
+
+    /// <summary>
+    /// Starts filtering. Small lists finish synchronously, so the handler
+    /// can be called before this function returns.
+    /// </summary>
+    /// <param name="maxResults">Number of best matches to keep</param>
+    void SetQuery(const StringView& query, uint32_t maxResults);
+
+    bool IsBusy() const;
+
+    /// <summary>
+    /// Best matches of the last finished query, sorted by descending score.
+    /// An empty query matches everything, in the original order.
+    /// </summary>
+    ArrayListView<const FuzzyMatch> Results() const;
+
+    /// <summary>
+    /// Total number of names that matched the last finished query,
+    /// including the ones that did not make it into Results().
+    /// </summary>
+    uint32_t NumMatches() const;
+  };
+
+  namespace detail
+  {
+    struct FuzzyFilterChunkTask : public mj::Task
+    {
+      MJ_UNINITIALIZED FuzzyFilter* pFilter;
+      MJ_UNINITIALIZED uint32_t chunkIndex;
+
+      virtual void Execute() override;
+      virtual void OnDone() override;
+    };
+  } // namespace detail
+} // namespace mj
@@ -0,0 +1,468 @@
+#include "mj_glob.h"
+#include <emmintrin.h>
+
+/// <summary>
+/// Bits of a word that one pattern can use: one state per element, plus the start state.
+/// </summary>
+static constexpr uint32_t kMaxElements = 63;
+
+struct EGlobElement
+{
+  enum Enum
+  {
+    Literal,
+    Any,
+    Class,
+  };
+};
+
+struct GlobElement
+{
+  EGlobElement::Enum type;
+  wchar_t literal;
+  uint32_t firstRange; // Class only
+  uint32_t numRanges;  // Class only
+  bool negate;         // Class only
+};
+
+static wchar_t ToLower(wchar_t c)
+{
+  return (c >= L'A' && c <= L'Z') ? static_cast<wchar_t>(c | 0x20) : c;
+}
+
+static wchar_t ToUpper(wchar_t c)
+{
+  return (c >= L'a' && c <= L'z') ? static_cast<wchar_t>(c & ~0x20) : c;
+}
+
+static bool InRange(wchar_t c, wchar_t first, wchar_t last)
+{
+  return c >= first && c <= last;
+}
+
+static bool IsBlank(wchar_t c)
+{
+  return c == L' ' || c == L'\t';
+}
+
+void mj::Glob::Init(AllocatorBase* pAllocator)
+{
+  this->words.Init(pAllocator);
+  this->asciiStates.Init(pAllocator);
+  this->wideElements.Init(pAllocator);
+  this->ranges.Init(pAllocator);
+}
+
+void mj::Glob::Destroy()
+{
+  this->words.Destroy();
+  this->asciiStates.Destroy();
+  this->wideElements.Destroy();
+  this->ranges.Destroy();
+}
+
+void mj::Glob::Clear()
+{
+  this->words.Clear();
+  this->asciiStates.Clear();
+  this->wideElements.Clear();
+  this->ranges.Clear();
+}
+
+bool mj::Glob::IsEmpty() const
+{
+  return this->words.Size() == 0;
+}
+
+bool mj::Glob::Compile(const StringView& patterns)
+{
+  this->Clear();
+
+  uint32_t numStatesUsed = 0; // In the last word
+
+  const wchar_t* pIt  = patterns.ptr;
+  const wchar_t* pEnd = patterns.ptr + patterns.len;
+  while (pIt < pEnd)
+  {
+    // Next pattern, trimmed
+    const wchar_t* pBegin = pIt;
+    while (pIt < pEnd && *pIt != L';')
+    {
+      pIt++;
+    }
+    const wchar_t* pPatternEnd = pIt;
+    pIt++; // Skip the separator
+
+    while (pBegin < pPatternEnd && IsBlank(*pBegin))
+    {
+      pBegin++;
+    }
+    while (pPatternEnd > pBegin && IsBlank(pPatternEnd[-1]))
+    {
+      pPatternEnd--;
+    }
+    if (pBegin == pPatternEnd)
+    {
+      continue;
+    }
+
+    // Parse. Stars do not consume a character, they are self-loops on the state they follow.
+    MJ_UNINITIALIZED GlobElement elements[kMaxElements];
+    uint64_t localStar   = 0;
+    uint32_t numElements = 0;
+    for (const wchar_t* pChar = pBegin; pChar < pPatternEnd; pChar++)
+    {
+      if (*pChar == L'*')
+      {
+        localStar |= 1ull << numElements;
+        continue;
+      }
+
+      if (numElements == kMaxElements)
+      {
+        this->Clear();
+        return false;
+      }
+
+      GlobElement& element = elements[numElements];
+      element.type         = EGlobElement::Literal;
+      element.literal      = *pChar;
+      element.firstRange   = 0;
+      element.numRanges    = 0;
+      element.negate       = false;
+
+      if (*pChar == L'?')
+      {
+        element.type = EGlobElement::Any;
+      }
+      else if (*pChar == L'[')
+      {
+        // A "]" right after the (negated) opening bracket is part of the class.
+        // Without a closing bracket, "[" is an ordinary character.
+        const size_t rangesBefore = this->ranges.Size();
+        const wchar_t* pClass     = pChar + 1;
+        bool negate               = false;
+        if (pClass < pPatternEnd && (*pClass == L'!' || *pClass == L'^'))
+        {
+          negate = true;
+          pClass++;
+        }
+
+        bool first = true;
+        while (pClass < pPatternEnd && (*pClass != L']' || first))
+        {
+          Range* pRange = this->ranges.Emplace(1);
+          if (!pRange)
+          {
+            this->Clear();
+            return false;
+          }
+
+          pRange->first = *pClass;
+          pRange->last  = *pClass;
+          if (pClass + 2 < pPatternEnd && pClass[1] == L'-' && pClass[2] != L']')
+          {
+            pRange->last = pClass[2];
+            pClass += 2;
+          }
+          pClass++;
+          first = false;
+        }
+
+        if (pClass < pPatternEnd)
+        {
+          element.type       = EGlobElement::Class;
+          element.firstRange = static_cast<uint32_t>(rangesBefore);
+          element.numRanges  = static_cast<uint32_t>(this->ranges.Size() - rangesBefore);
+          element.negate     = negate;
+          pChar              = pClass; // Closing bracket
+        }
+        else
+        {
+          this->ranges.Truncate(rangesBefore);
+        }
+      }
+
+      numElements++;
+    }
+
+    // Find room for numElements + 1 states
+    if (this->words.Size() == 0 || numStatesUsed + numElements + 1 > 64)
+    {
+      Word* pWord      = this->words.Emplace(1);
+      uint64_t* pAscii = this->asciiStates.Emplace(kNumAsciiChars);
+      if (!pWord || !pAscii)
+      {
+        this->Clear();
+        return false;
+      }
+
+      *pWord                  = {};
+      pWord->firstWideElement = static_cast<uint32_t>(this->wideElements.Size());
+      static_cast<void>(memset(pAscii, 0, kNumAsciiChars * sizeof(uint64_t)));
+      numStatesUsed = 0;
+    }
+
+    Word& word          = this->words.end()[-1];
+    uint64_t* pAscii    = this->asciiStates.end() - kNumAsciiChars;
+    const uint32_t base = numStatesUsed;
+
+    word.initial |= 1ull << base;
+    word.star |= localStar << base;
+    word.final |= 1ull << (base + numElements);
+
+    // Element i moves from state base + i to state base + i + 1
+    for (uint32_t i = 0; i < numElements; i++)
+    {
+      const GlobElement& element = elements[i];
+      const uint64_t state       = 1ull << (base + i + 1);
+      const Range* pRanges       = this->ranges.begin() + element.firstRange;
+
+      // Table for ASCII
+      for (wchar_t c = 0; c < kNumAsciiChars; c++)
+      {
+        bool accept = false;
+        switch (element.type)
+        {
+        case EGlobElement::Literal:
+          accept = ToLower(c) == ToLower(element.literal);
+          break;
+        case EGlobElement::Any:
+          accept = true;
+          break;
+        case EGlobElement::Class:
+          for (uint32_t r = 0; r < element.numRanges && !accept; r++)
+          {
+            accept = InRange(c, pRanges[r].first, pRanges[r].last) ||          //
+                     InRange(ToLower(c), pRanges[r].first, pRanges[r].last) || //
+                     InRange(ToUpper(c), pRanges[r].first, pRanges[r].last);
+          }
+          accept = accept != element.negate;
+          break;
+        }
+
+        if (accept)
+        {
+          pAscii[c] |= state;
+        }
+      }
+
+      // Everything else
+      bool wideRanges = false;
+      if (element.type == EGlobElement::Literal)
+      {
+        wideRanges = element.literal >= kNumAsciiChars;
+      }
+      else if (element.type == EGlobElement::Class)
+      {
+        for (uint32_t r = 0; r < element.numRanges; r++)
+        {
+          wideRanges |= pRanges[r].last >= kNumAsciiChars;
+        }
+      }
+
+      if (element.type == EGlobElement::Any || (element.type == EGlobElement::Class && element.negate && !wideRanges))
+      {
+        word.anyWide |= state;
+      }
+      else if (wideRanges)
+      {
+        WideElement* pWide = this->wideElements.Emplace(1);
+        if (!pWide)
+        {
+          this->Clear();
+          return false;
+        }
+
+        pWide->state  = state;
+        pWide->negate = element.type == EGlobElement::Class && element.negate;
+        if (element.type == EGlobElement::Literal)
+        {
+          Range* pRange = this->ranges.Emplace(1);
+          if (!pRange)
+          {
+            this->Clear();
+            return false;
+          }
+
+          pRange->first     = element.literal;
+          pRange->last      = element.literal;
+          pWide->firstRange = static_cast<uint32_t>(this->ranges.Size() - 1);
+          pWide->numRanges  = 1;
+        }
+        else
+        {
+          pWide->firstRange = element.firstRange;
+          pWide->numRanges  = element.numRanges;
+        }
+        word.numWideElements++;
+      }
+    }
+
+    numStatesUsed += numElements + 1;
+  }
+
+  return true;
+}
+
+uint64_t mj::Glob::StatesOf(const Word& word, size_t wordIndex, wchar_t c) const
+{
+  if (c < kNumAsciiChars)
+  {
+    return this->asciiStates.begin()[wordIndex * kNumAsciiChars + c];
+  }
+
+  uint64_t states             = word.anyWide;
+  const WideElement* pWide    = this->wideElements.begin() + word.firstWideElement;
+  const WideElement* pWideEnd = pWide + word.numWideElements;
+  for (; pWide < pWideEnd; pWide++)
+  {
+    const Range* pRange    = this->ranges.begin() + pWide->firstRange;
+    const Range* pRangeEnd = pRange + pWide->numRanges;
+    bool inRange           = false;
+    for (; pRange < pRangeEnd && !inRange; pRange++)
+    {
+      inRange = InRange(c, pRange->first, pRange->last);
+    }
+
+    if (inRange != pWide->negate)
+    {
+      states |= pWide->state;
+    }
+  }
+
+  return states;
+}
+
+bool mj::Glob::MatchesWord(size_t wordIndex, const StringView& name) const
+{
+  const Word& word = this->words.begin()[wordIndex];
+  uint64_t active  = word.initial;
+
+  for (size_t i = 0; i < name.len; i++)
+  {
+    active = ((active << 1) & this->StatesOf(word, wordIndex, name.ptr[i])) | (active & word.star);
+    if (!active)
+    {
+      return false;
+    }
+  }
+
+  return (active & word.final) != 0;
+}
+
+bool mj::Glob::Matches(const StringView& name) const
+{
+  if (this->IsEmpty())
+  {
+    return true;
+  }
+
+  for (size_t i = 0; i < this->words.Size(); i++)
+  {
+    if (this->MatchesWord(i, name))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void mj::Glob::MatchPair(const StringView& a, const StringView& b, bool* pMatchA, bool* pMatchB) const
+{
+  // Only valid for a single word
+  const Word& word = this->words.begin()[0];
+
+  const __m128i star = _mm_set1_epi64x(static_cast<long long>(word.star));
+  __m128i active     = _mm_set1_epi64x(static_cast<long long>(word.initial));
+
+  // Both names in lockstep for as long as the shortest
+  const size_t common = a.len < b.len ? a.len : b.len;
+  for (size_t i = 0; i < common; i++)
+  {
+    const __m128i states = _mm_set_epi64x(static_cast<long long>(this->StatesOf(word, 0, b.ptr[i])),
+                                          static_cast<long long>(this->StatesOf(word, 0, a.ptr[i])));
+    active = _mm_or_si128(_mm_and_si128(_mm_slli_epi64(active, 1), states), _mm_and_si128(active, star));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(active, _mm_setzero_si128())) == 0xFFFF)
+    {
+      *pMatchA = false;
+      *pMatchB = false;
+      return;
+    }
+  }
+
+  MJ_UNINITIALIZED uint64_t lanes[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), active);
+
+  // Finish the longer name on its own
+  const StringView* pNames[2] = { &a, &b };
+  bool* pMatches[2]           = { pMatchA, pMatchB };
+  for (size_t lane = 0; lane < 2; lane++)
+  {
+    const StringView& name = *pNames[lane];
+    uint64_t state         = lanes[lane];
+    for (size_t i = common; i < name.len && state; i++)
+    {
+      state = ((state << 1) & this->StatesOf(word, 0, name.ptr[i])) | (state & word.star);
+    }
+    *pMatches[lane] = (state & word.final) != 0;
+  }
+}
+
+bool mj::Glob::Filter(ArrayListView<const StringView> names, ArrayList<uint32_t>& matches) const
+{
+  const size_t numNames = names.Size();
+  if (numNames == 0)
+  {
+    return true;
+  }
+  if (!matches.Reserve(numNames))
+  {
+    return false;
+  }
+
+  // Capacity is reserved, so these cannot fail
+  if (this->IsEmpty())
+  {
+    uint32_t* pMatches = matches.Emplace(numNames);
+    for (size_t i = 0; i < numNames; i++)
+    {
+      pMatches[i] = static_cast<uint32_t>(i);
+    }
+  }
+  else if (this->words.Size() == 1)
+  {
+    size_t i = 0;
+    for (; i + 2 <= numNames; i += 2)
+    {
+      MJ_UNINITIALIZED bool matchA;
+      MJ_UNINITIALIZED bool matchB;
+      this->MatchPair(names[i], names[i + 1], &matchA, &matchB);
+      if (matchA)
+      {
+        *matches.Emplace(1) = static_cast<uint32_t>(i);
+      }
+      if (matchB)
+      {
+        *matches.Emplace(1) = static_cast<uint32_t>(i + 1);
+      }
+    }
+    if (i < numNames && this->MatchesWord(0, names[i]))
+    {
+      *matches.Emplace(1) = static_cast<uint32_t>(i);
+    }
+  }
+  else
+  {
+    for (size_t i = 0; i < numNames; i++)
+    {
+      if (this->Matches(names[i]))
+      {
+        *matches.Emplace(1) = static_cast<uint32_t>(i);
+      }
+    }
+  }
+
+  return true;
+}
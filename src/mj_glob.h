@@ -0,0 +1,107 @@
+#pragma once
+#include "mj_common.h"
+#include "mj_string.h"
+
+namespace mj
+{
+  /// <summary>
+  /// Set of wildcard patterns, separated by semicolons: "*.cpp;*.h;img_??.png".
+  /// Supported syntax: "*" (any run of characters), "?" (any single character),
+  /// "[abc]", "[a-z]" and "[!a-z]" (or "[^a-z]") character classes.
+  /// Matching is case-insensitive for ASCII letters, and always covers the entire name.
+  ///
+  /// All patterns are compiled into one bit-parallel NFA (shift-and): every pattern position is a bit,
+  /// so up to 64 positions of all patterns combined advance with a handful of instructions per character.
+  /// Requires explicit initialization and destruction.
+  /// </summary>
+  class Glob
+  {
+  private:
+    /// <summary>
+    /// Up to 64 NFA states. Patterns never straddle words.
+    /// </summary>
+    struct Word
+    {
+      uint64_t initial; // Start state of each pattern
+      uint64_t star;    // States with a self-loop
+      uint64_t final;   // Accepting states
+      uint64_t anyWide; // States reachable on any non-ASCII character
+      uint32_t firstWideElement;
+      uint32_t numWideElements;
+    };
+
+    /// <summary>
+    /// Literal or character class that can match non-ASCII characters.
+    /// These are rare, so they are tested one by one instead of through a table.
+    /// </summary>
+    struct WideElement
+    {
+      uint64_t state; // State entered when this element matches
+      uint32_t firstRange;
+      uint32_t numRanges;
+      bool negate;
+    };
+
+    struct Range
+    {
+      wchar_t first; // Inclusive
+      wchar_t last;  // Inclusive
+    };
+
+    static constexpr uint32_t kNumAsciiChars = 128;
+
+    ArrayList<Word> words;
+
+    /// <summary>
+    /// For every word, for every ASCII character: the states that are entered
+    /// when that character is consumed.
+    /// </summary>
+    ArrayList<uint64_t> asciiStates;
+
+    ArrayList<WideElement> wideElements;
+    ArrayList<Range> ranges;
+
+    uint64_t StatesOf(const Word& word, size_t wordIndex, wchar_t c) const;
+    bool MatchesWord(size_t wordIndex, const StringView& name) const;
+    void MatchPair(const StringView& a, const StringView& b, bool* pMatchA, bool* pMatchB) const;
+
+  public:
+    /// <summary>
+    /// Does no allocation on construction.
+    /// </summary>
+    void Init(AllocatorBase* pAllocator);
+
+    /// <summary>
+    /// Data is freed using the assigned allocator.
+    /// </summary>
+    void Destroy();
+
+    /// <summary>
+    /// Replaces all patterns. Whitespace around each pattern is ignored, as are empty patterns.
+    /// </summary>
+    /// <returns>
+    /// False if memory allocation failed, or if a single pattern has more than 63 characters and classes.
+    /// The set is empty in that case.
+    /// </returns>
+    bool Compile(const StringView& patterns);
+
+    void Clear();
+
+    /// <summary>
+    /// True if there are no patterns.
+    /// </summary>
+    bool IsEmpty() const;
+
+    /// <summary>
+    /// True if the name matches at least one of the patterns, or if there are no patterns.
+    /// </summary>
+    bool Matches(const StringView& name) const;
+
+    /// <summary>
+    /// Matches a batch of names and appends the indices of the ones that match.
+    /// With a single word of states, two names are run side by side in SSE2 registers.
+    /// </summary>
+    /// <returns>False if memory allocation failed.</returns>
+    bool Filter(ArrayListView<const StringView> names, ArrayList<uint32_t>& matches) const;
+  };
+} // namespace mj
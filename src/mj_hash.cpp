@@ -0,0 +1,297 @@
+#include "mj_hash.h"
+#include <intrin.h>
+#include <immintrin.h>
+
+using namespace mj::detail::hash;
+
+namespace
+{
+  /// <summary>
+  /// Same results as ConstexprOps, but faster.
+  /// </summary>
+  struct RuntimeOps
+  {
+    static uint64_t Read16(const wchar_t* p)
+    {
+      return static_cast<uint16_t>(p[0]);
+    }
+
+    static uint64_t Read32(const wchar_t* p)
+    {
+      MJ_UNINITIALIZED uint32_t value;
+      static_cast<void>(memcpy(&value, p, sizeof(value)));
+      return value;
+    }
+
+    static uint64_t Read64(const wchar_t* p)
+    {
+      MJ_UNINITIALIZED uint64_t value;
+      static_cast<void>(memcpy(&value, p, sizeof(value)));
+      return value;
+    }
+
+    static void Mum(uint64_t& a, uint64_t& b)
+    {
+      a = _umul128(a, b, &b);
+    }
+  };
+} // namespace
+
+typedef void (*AccumulateStripesFn)(uint64_t* pAcc, const wchar_t* p, size_t numStripes, uint64_t firstStripe,
+                                    const uint64_t* pKey);
+
+static void AccumulateStripesSse2(uint64_t* pAcc, const wchar_t* p, size_t numStripes, uint64_t firstStripe,
+                                  const uint64_t* pKey)
+{
+  static constexpr size_t kNumRegisters = kNumLanes / 2;
+
+  MJ_UNINITIALIZED __m128i acc[kNumRegisters];
+  for (size_t j = 0; j < kNumRegisters; j++)
+  {
+    acc[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pAcc + 2 * j));
+  }
+
+  const __m128i prime = _mm_set1_epi32(static_cast<int>(kPrime32_1));
+  for (size_t i = 0; i < numStripes; i++)
+  {
+    const uint64_t stripe      = firstStripe + i;
+    const wchar_t* pData       = p + i * kStripeChars;
+    const uint64_t* pStripeKey = pKey + stripe % kStripesPerBlock;
+
+    for (size_t j = 0; j < kNumRegisters; j++)
+    {
+      const __m128i data    = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 8 * j));
+      const __m128i key     = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pStripeKey + 2 * j));
+      const __m128i dataKey = _mm_xor_si128(data, key);
+
+      // Low half times high half of each lane, and the data of the neighboring lane
+      const __m128i product = _mm_mul_epu32(dataKey, _mm_shuffle_epi32(dataKey, _MM_SHUFFLE(0, 3, 0, 1)));
+      const __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+      acc[j]                = _mm_add_epi64(acc[j], _mm_add_epi64(product, swapped));
+    }
+
+    if ((stripe + 1) % kStripesPerBlock == 0)
+    {
+      for (size_t j = 0; j < kNumRegisters; j++)
+      {
+        const __m128i key = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pKey + kScrambleKey + 2 * j));
+        __m128i value     = _mm_xor_si128(acc[j], _mm_srli_epi64(acc[j], 47));
+        value             = _mm_xor_si128(value, key);
+
+        // 64x32-bit multiplication, from two 32x32-bit multiplications
+        const __m128i lo = _mm_mul_epu32(value, prime);
+        const __m128i hi = _mm_mul_epu32(_mm_srli_epi64(value, 32), prime);
+        acc[j]           = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+      }
+    }
+  }
+
+  for (size_t j = 0; j < kNumRegisters; j++)
+  {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pAcc + 2 * j), acc[j]);
+  }
+}
+
+static void AccumulateStripesAvx2(uint64_t* pAcc, const wchar_t* p, size_t numStripes, uint64_t firstStripe,
+                                  const uint64_t* pKey)
+{
+  static constexpr size_t kNumRegisters = kNumLanes / 4;
+
+  MJ_UNINITIALIZED __m256i acc[kNumRegisters];
+  for (size_t j = 0; j < kNumRegisters; j++)
+  {
+    acc[j] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pAcc + 4 * j));
+  }
+
+  const __m256i prime = _mm256_set1_epi32(static_cast<int>(kPrime32_1));
+  for (size_t i = 0; i < numStripes; i++)
+  {
+    const uint64_t stripe      = firstStripe + i;
+    const wchar_t* pData       = p + i * kStripeChars;
+    const uint64_t* pStripeKey = pKey + stripe % kStripesPerBlock;
+
+    for (size_t j = 0; j < kNumRegisters; j++)
+    {
+      const __m256i data    = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pData + 16 * j));
+      const __m256i key     = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pStripeKey + 4 * j));
+      const __m256i dataKey = _mm256_xor_si256(data, key);
+
+      const __m256i product = _mm256_mul_epu32(dataKey, _mm256_shuffle_epi32(dataKey, _MM_SHUFFLE(0, 3, 0, 1)));
+      const __m256i swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+      acc[j]                = _mm256_add_epi64(acc[j], _mm256_add_epi64(product, swapped));
+    }
+
+    if ((stripe + 1) % kStripesPerBlock == 0)
+    {
+      for (size_t j = 0; j < kNumRegisters; j++)
+      {
+        const __m256i key = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pKey + kScrambleKey + 4 * j));
+        __m256i value     = _mm256_xor_si256(acc[j], _mm256_srli_epi64(acc[j], 47));
+        value             = _mm256_xor_si256(value, key);
+
+        const __m256i lo = _mm256_mul_epu32(value, prime);
+        const __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(value, 32), prime);
+        acc[j]           = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+      }
+    }
+  }
+
+  for (size_t j = 0; j < kNumRegisters; j++)
+  {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(pAcc + 4 * j), acc[j]);
+  }
+}
+
+static bool SupportsAvx2()
+{
+  MJ_UNINITIALIZED int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+  {
+    return false;
+  }
+
+  // The OS has to save the YMM registers on context switches
+  __cpuid(info, 1);
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  const bool avx     = (info[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+  {
+    return false;
+  }
+
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+}
+
+/// <summary>
+/// Picks the widest implementation on first use. Races are harmless,
+/// as every thread would store the same pointer.
+/// </summary>
+static AccumulateStripesFn GetAccumulateStripes()
+{
+  static AccumulateStripesFn s_pAccumulateStripes = nullptr;
+
+  AccumulateStripesFn pFn = s_pAccumulateStripes;
+  if (!pFn)
+  {
+    pFn                  = SupportsAvx2() ? AccumulateStripesAvx2 : AccumulateStripesSse2;
+    s_pAccumulateStripes = pFn;
+  }
+
+  return pFn;
+}
+
+uint64_t mj::Hash(const StringView& string, uint64_t seed)
+{
+  return mj::Hash(string.ptr, string.len, seed);
+}
+
+uint64_t mj::Hash(const wchar_t* pString, size_t numChars, uint64_t seed)
+{
+  if (numChars <= kMaxShortChars)
+  {
+    return HashShort<RuntimeOps>(pString, numChars, seed);
+  }
+
+  MJ_UNINITIALIZED uint64_t acc[kNumLanes];
+  MJ_UNINITIALIZED uint64_t key[kKeySize];
+  InitAccumulators(acc);
+  InitKey(key, seed);
+
+  const size_t numStripes = (numChars - 1) / kStripeChars;
+  GetAccumulateStripes()(acc, pString, numStripes, 0, key);
+  AccumulateStripe<RuntimeOps>(acc, pString + numChars - kStripeChars, key + kLastStripeKey);
+
+  return MergeAccumulators<RuntimeOps>(acc, key, numChars);
+}
+
+uint64_t mj::HashPointer(const void* ptr)
+{
+  return Mix<RuntimeOps>(reinterpret_cast<uintptr_t>(ptr) ^ kWy0, kWy1);
+}
+
+void mj::Hasher::Init(uint64_t seed)
+{
+  this->seed       = seed;
+  this->numChars   = 0;
+  this->numStripes = 0;
+  this->bufferSize = 0;
+  InitAccumulators(this->acc);
+  InitKey(this->key, seed);
+}
+
+void mj::Hasher::Update(const StringView& string)
+{
+  this->Update(string.ptr, string.len);
+}
+
+void mj::Hasher::Update(const wchar_t* pString, size_t numChars)
+{
+  this->numChars += numChars;
+
+  while (numChars > 0)
+  {
+    if (this->bufferSize == kBufferChars)
+    {
+      // More data arrived, so none of these stripes is the last one
+      GetAccumulateStripes()(this->acc, this->buffer, kBufferChars / kStripeChars, this->numStripes, this->key);
+      this->numStripes += kBufferChars / kStripeChars;
+      this->bufferSize = 0;
+    }
+
+    if (this->bufferSize == 0 && numChars > kBufferChars)
+    {
+      // Consume whole buffers straight from the input, keeping at least one character back
+      const size_t numBuffers = (numChars - 1) / kBufferChars;
+      const size_t numSkipped = numBuffers * kBufferChars;
+      GetAccumulateStripes()(this->acc, pString, numSkipped / kStripeChars, this->numStripes, this->key);
+      this->numStripes += numSkipped / kStripeChars;
+      pString += numSkipped;
+      numChars -= numSkipped;
+
+      // The buffer must end with the consumed data, in case the last stripe needs it
+      static_cast<void>(memcpy(this->buffer, pString - kBufferChars, sizeof(this->buffer)));
+    }
+
+    const size_t space = kBufferChars - this->bufferSize;
+    const size_t num   = numChars < space ? numChars : space;
+    static_cast<void>(memcpy(this->buffer + this->bufferSize, pString, num * sizeof(wchar_t)));
+    this->bufferSize += num;
+    pString += num;
+    numChars -= num;
+  }
+}
+
+uint64_t mj::Hasher::Digest() const
+{
+  if (this->numChars <= kMaxShortChars)
+  {
+    // Nothing was consumed yet
+    return HashShort<RuntimeOps>(this->buffer, this->numChars, this->seed);
+  }
+
+  MJ_UNINITIALIZED uint64_t accCopy[kNumLanes];
+  static_cast<void>(memcpy(accCopy, this->acc, sizeof(accCopy)));
+
+  const size_t numStripes = (this->bufferSize - 1) / kStripeChars;
+  AccumulateStripes<RuntimeOps>(accCopy, this->buffer, numStripes, this->numStripes, this->key);
+
+  // The last stripe can start in data that was already consumed.
+  // That data is still at the end of the buffer, as consuming does not clear it.
+  MJ_UNINITIALIZED wchar_t lastStripe[kStripeChars];
+  const wchar_t* pLastStripe = lastStripe;
+  if (this->bufferSize >= kStripeChars)
+  {
+    pLastStripe = this->buffer + this->bufferSize - kStripeChars;
+  }
+  else
+  {
+    const size_t numOld = kStripeChars - this->bufferSize;
+    static_cast<void>(memcpy(lastStripe, this->buffer + kBufferChars - numOld, numOld * sizeof(wchar_t)));
+    static_cast<void>(memcpy(lastStripe + numOld, this->buffer, this->bufferSize * sizeof(wchar_t)));
+  }
+  AccumulateStripe<RuntimeOps>(accCopy, pLastStripe, this->key + kLastStripeKey);
+
+  return MergeAccumulators<RuntimeOps>(accCopy, this->key, this->numChars);
+}
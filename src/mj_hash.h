@@ -0,0 +1,328 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "mj_string.h"
+
+namespace mj
+{
+  namespace detail
+  {
+    // Internals shared by the run-time and compile-time hash functions.
+    // Strings are hashed as UTF-16 code units in little-endian order, which is what they look like in memory.
+    namespace hash
+    {
+      static constexpr uint64_t kWy0 = 0xa0761d6478bd642full;
+      static constexpr uint64_t kWy1 = 0xe7037ed1a0b428dbull;
+      static constexpr uint64_t kWy2 = 0x8ebc6af09c88c6e3ull;
+      static constexpr uint64_t kWy3 = 0x589965cc75374cc3ull;
+
+      static constexpr uint64_t kPrime32_1 = 0x9E3779B1ull;
+      static constexpr uint64_t kPrime32_2 = 0x85EBCA77ull;
+      static constexpr uint64_t kPrime32_3 = 0xC2B2AE3Dull;
+      static constexpr uint64_t kPrime64_1 = 0x9E3779B185EBCA87ull;
+      static constexpr uint64_t kPrime64_2 = 0xC2B2AE3D27D4EB4Full;
+      static constexpr uint64_t kPrime64_3 = 0x165667B19E3779F9ull;
+      static constexpr uint64_t kPrime64_4 = 0x85EBCA77C2B2AE63ull;
+      static constexpr uint64_t kPrime64_5 = 0x27D4EB2F165667C5ull;
+
+      // Strings up to this many characters take the short path (wyhash),
+      // longer strings are hashed in stripes (xxh3-style accumulators).
+      static constexpr size_t kMaxShortChars = 128;
+
+      static constexpr size_t kNumLanes        = 8;  // 64-bit accumulators
+      static constexpr size_t kStripeChars     = 32; // 64 bytes, one lane per 8 bytes
+      static constexpr size_t kStripesPerBlock = 16; // Accumulators are scrambled after every block
+      static constexpr size_t kKeySize         = 24; // Stripe keys slide over the first 16 entries
+      static constexpr size_t kScrambleKey     = 16; // Offset of the scramble key
+      static constexpr size_t kLastStripeKey   = 9;  // Offset of the key for the last stripe
+      static constexpr size_t kBufferChars     = 4 * kStripeChars;
+
+      static constexpr uint64_t kSecret[kKeySize] = {
+        0xe220a8397b1dcdafull, 0x6e789e6aa1b965f4ull, 0x06c45d188009454full, 0xf88bb8a8724c81ecull,
+        0x1b39896a51a8749bull, 0x53cb9f0c747ea2eaull, 0x2c829abe1f4532e1ull, 0xc584133ac916ab3cull,
+        0x3ee5789041c98ac3ull, 0xf3b8488c368cb0a6ull, 0x657eecdd3cb13d09ull, 0xc2d326e0055bdef6ull,
+        0x8621a03fe0bbdb7bull, 0x8e1f7555983aa92full, 0xb54e0f1600cc4d19ull, 0x84bb3f97971d80abull,
+        0x7d29825c75521255ull, 0xc3cf17102b7f7f86ull, 0x3466e9a083914f64ull, 0xd81a8d2b5a4485acull,
+        0xdb01602b100b9ed7ull, 0xa9038a921825f10dull, 0xedf5f1d90dca2f6aull, 0x54496ad67bd2634cull,
+      };
+
+      /// <summary>
+      /// Operations that can run at compile time.
+      /// The run-time equivalents use unaligned loads and _umul128 instead.
+      /// </summary>
+      struct ConstexprOps
+      {
+        static constexpr uint64_t Read16(const wchar_t* p)
+        {
+          return static_cast<uint16_t>(p[0]);
+        }
+
+        static constexpr uint64_t Read32(const wchar_t* p)
+        {
+          return Read16(p) | (Read16(p + 1) << 16);
+        }
+
+        static constexpr uint64_t Read64(const wchar_t* p)
+        {
+          return Read32(p) | (Read32(p + 2) << 32);
+        }
+
+        /// <summary>
+        /// 64x64 to 128-bit multiplication. a receives the low half, b the high half.
+        /// </summary>
+        static constexpr void Mum(uint64_t& a, uint64_t& b)
+        {
+          const uint64_t ha  = a >> 32;
+          const uint64_t hb  = b >> 32;
+          const uint64_t la  = static_cast<uint32_t>(a);
+          const uint64_t lb  = static_cast<uint32_t>(b);
+          const uint64_t rh  = ha * hb;
+          const uint64_t rm0 = ha * lb;
+          const uint64_t rm1 = hb * la;
+          const uint64_t rl  = la * lb;
+          const uint64_t t   = rl + (rm0 << 32);
+          uint64_t carry     = t < rl;
+          const uint64_t lo  = t + (rm1 << 32);
+          carry += lo < t;
+          a = lo;
+          b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+        }
+      };
+
+      template <typename Ops>
+      constexpr uint64_t Mix(uint64_t a, uint64_t b)
+      {
+        Ops::Mum(a, b);
+        return a ^ b;
+      }
+
+      /// <summary>
+      /// wyhash over numChars * 2 bytes. All reads are at even byte offsets,
+      /// so they can be expressed in whole characters.
+      /// </summary>
+      template <typename Ops>
+      constexpr uint64_t HashShort(const wchar_t* p, size_t numChars, uint64_t seed)
+      {
+        const uint64_t numBytes = numChars * sizeof(wchar_t);
+        seed ^= Mix<Ops>(seed ^ kWy0, kWy1);
+
+        uint64_t a = 0;
+        uint64_t b = 0;
+        if (numChars <= 8)
+        {
+          if (numChars >= 2)
+          {
+            const size_t offset = numChars >> 2 << 1;
+            a                   = (Ops::Read32(p) << 32) | Ops::Read32(p + offset);
+            b                   = (Ops::Read32(p + numChars - 2) << 32) | Ops::Read32(p + numChars - 2 - offset);
+          }
+          else if (numChars == 1)
+          {
+            a = Ops::Read16(p);
+          }
+        }
+        else
+        {
+          size_t i = numChars;
+          if (i > 24)
+          {
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
+            do
+            {
+              seed = Mix<Ops>(Ops::Read64(p) ^ kWy1, Ops::Read64(p + 4) ^ seed);
+              see1 = Mix<Ops>(Ops::Read64(p + 8) ^ kWy2, Ops::Read64(p + 12) ^ see1);
+              see2 = Mix<Ops>(Ops::Read64(p + 16) ^ kWy3, Ops::Read64(p + 20) ^ see2);
+              p += 24;
+              i -= 24;
+            } while (i > 24);
+            seed ^= see1 ^ see2;
+          }
+          while (i > 8)
+          {
+            seed = Mix<Ops>(Ops::Read64(p) ^ kWy1, Ops::Read64(p + 4) ^ seed);
+            p += 8;
+            i -= 8;
+          }
+          // Overlaps with data that was already consumed if i < 8
+          a = Ops::Read64(p + i - 8);
+          b = Ops::Read64(p + i - 4);
+        }
+
+        a ^= kWy1;
+        b ^= seed;
+        Ops::Mum(a, b);
+        return Mix<Ops>(a ^ kWy0 ^ numBytes, b ^ kWy1);
+      }
+
+      constexpr void InitAccumulators(uint64_t* pAcc)
+      {
+        pAcc[0] = kPrime32_3;
+        pAcc[1] = kPrime64_1;
+        pAcc[2] = kPrime64_2;
+        pAcc[3] = kPrime64_3;
+        pAcc[4] = kPrime64_4;
+        pAcc[5] = kPrime32_2;
+        pAcc[6] = kPrime64_5;
+        pAcc[7] = kPrime32_1;
+      }
+
+      constexpr void InitKey(uint64_t* pKey, uint64_t seed)
+      {
+        for (size_t i = 0; i < kKeySize; i++)
+        {
+          pKey[i] = (i & 1) ? kSecret[i] - seed : kSecret[i] + seed;
+        }
+      }
+
+      /// <summary>
+      /// Each lane adds the product of the low and high halves of (data ^ key) to itself,
+      /// and the raw data to its neighbor, so no input bits are lost to the multiplication.
+      /// The SIMD versions compute exactly the same values.
+      /// </summary>
+      template <typename Ops>
+      constexpr void AccumulateStripe(uint64_t* pAcc, const wchar_t* p, const uint64_t* pKey)
+      {
+        for (size_t i = 0; i < kNumLanes; i++)
+        {
+          const uint64_t data    = Ops::Read64(p + 4 * i);
+          const uint64_t dataKey = data ^ pKey[i];
+          pAcc[i ^ 1] += data;
+          pAcc[i] += (dataKey & 0xFFFFFFFF) * (dataKey >> 32);
+        }
+      }
+
+      constexpr void ScrambleAccumulators(uint64_t* pAcc, const uint64_t* pKey)
+      {
+        for (size_t i = 0; i < kNumLanes; i++)
+        {
+          uint64_t acc = pAcc[i];
+          acc ^= acc >> 47;
+          acc ^= pKey[kScrambleKey + i];
+          pAcc[i] = acc * kPrime32_1;
+        }
+      }
+
+      /// <summary>
+      /// Processes numStripes whole stripes. Stripe index n (counting from the start of the string)
+      /// uses the key at offset n % kStripesPerBlock, and the accumulators are scrambled after every block.
+      /// </summary>
+      template <typename Ops>
+      constexpr void AccumulateStripes(uint64_t* pAcc, const wchar_t* p, size_t numStripes, uint64_t firstStripe,
+                                       const uint64_t* pKey)
+      {
+        for (size_t i = 0; i < numStripes; i++)
+        {
+          const uint64_t stripe = firstStripe + i;
+          AccumulateStripe<Ops>(pAcc, p + i * kStripeChars, pKey + stripe % kStripesPerBlock);
+          if ((stripe + 1) % kStripesPerBlock == 0)
+          {
+            ScrambleAccumulators(pAcc, pKey);
+          }
+        }
+      }
+
+      template <typename Ops>
+      constexpr uint64_t MergeAccumulators(const uint64_t* pAcc, const uint64_t* pKey, uint64_t numChars)
+      {
+        uint64_t result = numChars * sizeof(wchar_t) * kPrime64_1;
+        for (size_t i = 0; i < kNumLanes; i += 2)
+        {
+          result += Mix<Ops>(pAcc[i] ^ pKey[i + 1], pAcc[i + 1] ^ pKey[i + 2]);
+        }
+
+        // Avalanche
+        result ^= result >> 37;
+        result *= 0x165667919E3779F9ull;
+        result ^= result >> 32;
+        return result;
+      }
+
+      /// <summary>
+      /// Scalar version of the long path. The run-time version dispatches to SSE2 or AVX2.
+      /// </summary>
+      template <typename Ops>
+      constexpr uint64_t HashLong(const wchar_t* p, size_t numChars, uint64_t seed)
+      {
+        uint64_t acc[kNumLanes] = {};
+        uint64_t key[kKeySize]  = {};
+        InitAccumulators(acc);
+        InitKey(key, seed);
+
+        // The last stripe is always handled separately, even if it is whole
+        const size_t numStripes = (numChars - 1) / kStripeChars;
+        AccumulateStripes<Ops>(acc, p, numStripes, 0, key);
+        AccumulateStripe<Ops>(acc, p + numChars - kStripeChars, key + kLastStripeKey);
+
+        return MergeAccumulators<Ops>(acc, key, numChars);
+      }
+
+      template <typename Ops>
+      constexpr uint64_t Hash(const wchar_t* p, size_t numChars, uint64_t seed)
+      {
+        if (numChars <= kMaxShortChars)
+        {
+          return HashShort<Ops>(p, numChars, seed);
+        }
+        else
+        {
+          return HashLong<Ops>(p, numChars, seed);
+        }
+      }
+    } // namespace hash
+  }   // namespace detail
+
+  /// <summary>
+  /// 64-bit hash of a UTF-16 string: wyhash for short strings,
+  /// xxh3-style accumulators with SSE2 or AVX2 for long strings.
+  /// Every instruction set gives the same result, and so does HashLiteral.
+  /// Use a random seed for tables that store names from untrusted sources.
+  /// </summary>
+  uint64_t Hash(const StringView& string, uint64_t seed = 0);
+
+  uint64_t Hash(const wchar_t* pString, size_t numChars, uint64_t seed = 0);
+
+  /// <summary>
+  /// Compile-time version of Hash, for string literals used as keys:
+  /// static constexpr uint64_t kKey = mj::HashLiteral(L"Name");
+  /// The null terminator is not hashed.
+  /// </summary>
+  template <size_t Size>
+  constexpr uint64_t HashLiteral(const wchar_t (&literal)[Size], uint64_t seed = 0)
+  {
+    return detail::hash::Hash<detail::hash::ConstexprOps>(literal, Size - 1, seed);
+  }
+
+  /// <summary>
+  /// Mixes all bits of a pointer, so the low bits can be used for bucket selection.
+  /// </summary>
+  uint64_t HashPointer(const void* ptr);
+
+  /// <summary>
+  /// Incremental version of Hash, for strings that are built piecewise.
+  /// Feeding a string in any number of parts gives the same result as Hash over the concatenation.
+  /// </summary>
+  class Hasher
+  {
+  private:
+    MJ_UNINITIALIZED uint64_t acc[detail::hash::kNumLanes];
+    MJ_UNINITIALIZED uint64_t key[detail::hash::kKeySize];
+
+    /// <summary>
+    /// Holds the string while it is short, and the unconsumed tail after that.
+    /// Only consumed when more data arrives, so the last stripe is always available.
+    /// </summary>
+    MJ_UNINITIALIZED wchar_t buffer[detail::hash::kBufferChars];
+
+    uint64_t seed       = 0;
+    uint64_t numChars   = 0;
+    uint64_t numStripes = 0;
+    size_t bufferSize   = 0;
+
+  public:
+    void Init(uint64_t seed = 0);
+    void Update(const StringView& string);
+    void Update(const wchar_t* pString, size_t numChars);
+    uint64_t Digest() const;
+  };
+} // namespace mj
@@ -1,6 +1,7 @@
 #pragma once
 #include "mj_allocator.h"
 #include "mj_common.h"
+#include "mj_hash.h"
 
 namespace mj
 {
@@ -43,7 +44,7 @@ namespace mj
 
     void Insert(const void* ptr)
     {
-      size_t index = reinterpret_cast<uintptr_t>(ptr) % this->numBuckets;
+      size_t index = mj::HashPointer(ptr) % this->numBuckets;
       if (!this->pBuckets[index].Contains(ptr))
       {
         this->pBuckets[index].Add(ptr);
@@ -52,7 +53,7 @@ namespace mj
 
     void Remove(const void* ptr)
     {
-      size_t index = reinterpret_cast<uintptr_t>(ptr) % this->numBuckets;
+      size_t index = mj::HashPointer(ptr) % this->numBuckets;
       this->pBuckets[index].RemoveAll(ptr);
     }
 
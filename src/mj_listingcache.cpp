@@ -0,0 +1,469 @@
+#include "mj_listingcache.h"
+#include "mj_arena.h"
+#include "ErrorExit.h"
+#include "../3rdparty/tracy/Tracy.hpp"
+#include "../3rdparty/tracy/common/TracySystem.hpp"
+
+/// <summary>
+/// Watched folders, with or without a listing. Each one keeps a directory handle open.
+/// </summary>
+static constexpr size_t MAX_CACHE_ENTRIES = 256;
+
+/// <summary>
+/// Any notification invalidates the listing, so the details do not matter.
+/// If they do not fit, the read still completes, it just reports nothing.
+/// </summary>
+static constexpr DWORD NOTIFY_BUFFER_SIZE = 64;
+
+/// <summary>
+/// Changes that affect the names in a listing. Hidden and system entries depend on the attributes.
+/// </summary>
+static constexpr DWORD NOTIFY_FILTER =
+    FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_ATTRIBUTES;
+
+namespace mj
+{
+  namespace detail
+  {
+    /// <summary>
+    /// Has exactly one read in flight, which ends the watch when it completes.
+    /// The path is stored right after this struct.
+    /// </summary>
+    struct ListingCacheEntry
+    {
+      OVERLAPPED overlapped; // Completions point here
+      HANDLE hDirectory;
+      ListingSnapshot* pSnapshot; // nullptr until the listing is published
+      uint64_t generation;        // Tells handles to an older entry at the same address apart
+      uint32_t numListings;       // In flight, between ListingCacheWatch and ListingCacheUnwatch
+      uint64_t lastUse;
+      StringView path;
+      DWORD notifyBuffer[NOTIFY_BUFFER_SIZE / sizeof(DWORD)];
+    };
+  } // namespace detail
+} // namespace mj
+
+static SRWLOCK s_ListingCacheLock = SRWLOCK_INIT;
+static mj::detail::ListingCacheEntry* s_pEntries[MAX_CACHE_ENTRIES];
+static size_t s_NumEntries;
+static size_t s_NumBytes; // Of published listings
+static size_t s_MaxBytes;
+static uint64_t s_UseCounter;
+static uint64_t s_Generation;
+static HANDLE s_hCompletionPort;
+static HANDLE s_hWatcherThread;
+static volatile LONG s_NumWatches; // Entries the watcher thread has not freed yet, in the table or not
+static volatile LONG s_Quit;
+
+mj::ListingSnapshot* mj::ListingSnapshotCreate()
+{
+  mj::ArenaAllocator* pArena = mj::ArenaAllocator::Create();
+  if (!pArena)
+  {
+    return nullptr;
+  }
+
+  auto* pSnapshot = static_cast<mj::ListingSnapshot*>(pArena->Allocate(sizeof(mj::ListingSnapshot)));
+  if (!pSnapshot)
+  {
+    pArena->Destroy();
+    return nullptr;
+  }
+
+  pSnapshot->pFolders   = nullptr;
+  pSnapshot->pFiles     = nullptr;
+  pSnapshot->numFolders = 0;
+  pSnapshot->numFiles   = 0;
+  pSnapshot->refCount   = 1;
+  pSnapshot->numBytes   = sizeof(mj::ListingSnapshot);
+  pSnapshot->pArena     = pArena;
+
+  return pSnapshot;
+}
+
+mj::StringView* mj::ListingSnapshotAddName(mj::ListingSnapshot* pSnapshot, const mj::StringView& name)
+{
+  const size_t numBytes = (name.len + 1) * sizeof(wchar_t);
+
+  auto* pName      = static_cast<mj::StringView*>(pSnapshot->pArena->Allocate(sizeof(mj::StringView)));
+  wchar_t* pBuffer = static_cast<wchar_t*>(pSnapshot->pArena->Allocate(numBytes));
+  if (!pName || !pBuffer)
+  {
+    return nullptr;
+  }
+
+  static_cast<void>(::memcpy(pBuffer, name.ptr, name.len * sizeof(wchar_t)));
+  pBuffer[name.len] = L'\0';
+  pName->Init(pBuffer, name.len);
+  pSnapshot->numBytes += sizeof(mj::StringView) + numBytes;
+
+  return pName;
+}
+
+bool mj::ListingSnapshotFinish(mj::ListingSnapshot* pSnapshot, size_t numFolders, size_t numFiles)
+{
+  const size_t numBytes = (numFolders + numFiles) * sizeof(mj::StringView);
+  if (numBytes > 0)
+  {
+    auto* pRows = static_cast<mj::StringView*>(pSnapshot->pArena->Allocate(numBytes));
+    if (!pRows)
+    {
+      return false;
+    }
+    pSnapshot->pFolders = pRows;
+    pSnapshot->pFiles   = pRows + numFolders;
+    pSnapshot->numBytes += numBytes;
+  }
+
+  pSnapshot->numFolders = numFolders;
+  pSnapshot->numFiles   = numFiles;
+  return true;
+}
+
+void mj::ListingSnapshotAddRef(mj::ListingSnapshot* pSnapshot)
+{
+  static_cast<void>(::InterlockedIncrement(&pSnapshot->refCount));
+}
+
+void mj::ListingSnapshotRelease(mj::ListingSnapshot* pSnapshot)
+{
+  if (::InterlockedDecrement(&pSnapshot->refCount) == 0)
+  {
+    // Frees the snapshot as well
+    pSnapshot->pArena->Destroy();
+  }
+}
+
+/// <returns>The entry the handle was given out for, if it is still in the table</returns>
+static mj::detail::ListingCacheEntry* FindHandleLocked(const mj::ListingCacheHandle& handle, size_t* pIndex)
+{
+  for (size_t i = 0; i < s_NumEntries; i++)
+  {
+    if (s_pEntries[i] == handle.pEntry && s_pEntries[i]->generation == handle.generation)
+    {
+      *pIndex = i;
+      return s_pEntries[i];
+    }
+  }
+
+  return nullptr;
+}
+
+static mj::detail::ListingCacheEntry* FindEntryLocked(const mj::StringView& path, size_t* pIndex)
+{
+  for (size_t i = 0; i < s_NumEntries; i++)
+  {
+    mj::detail::ListingCacheEntry* pEntry = s_pEntries[i];
+    if (pEntry->path.len == path.len &&
+        ::CompareStringOrdinal(pEntry->path.ptr, static_cast<int>(path.len), path.ptr, static_cast<int>(path.len),
+                               TRUE) == CSTR_EQUAL)
+    {
+      *pIndex = i;
+      return pEntry;
+    }
+  }
+
+  return nullptr;
+}
+
+/// <summary>
+/// Takes an entry out of the table, and drops its listing.
+/// Closing the handle aborts the read, and the watcher thread frees the entry once that completes.
+/// </summary>
+static void RemoveEntryLocked(size_t index)
+{
+  mj::detail::ListingCacheEntry* pEntry = s_pEntries[index];
+  s_pEntries[index]                     = s_pEntries[--s_NumEntries];
+
+  if (pEntry->pSnapshot)
+  {
+    s_NumBytes -= pEntry->pSnapshot->numBytes;
+    mj::ListingSnapshotRelease(pEntry->pSnapshot);
+    pEntry->pSnapshot = nullptr;
+  }
+
+  static_cast<void>(::CloseHandle(pEntry->hDirectory));
+  pEntry->hDirectory = INVALID_HANDLE_VALUE;
+}
+
+/// <param name="pKeep">Not evicted</param>
+/// <param name="withSnapshot">Only consider entries with a listing</param>
+/// <returns>False if there is nothing to evict</returns>
+static bool EvictLeastRecentlyUsedLocked(const mj::detail::ListingCacheEntry* pKeep, bool withSnapshot)
+{
+  size_t lru = s_NumEntries;
+  for (size_t i = 0; i < s_NumEntries; i++)
+  {
+    const mj::detail::ListingCacheEntry* pEntry = s_pEntries[i];
+    if (pEntry != pKeep && (pEntry->pSnapshot || !withSnapshot) &&
+        (lru == s_NumEntries || pEntry->lastUse < s_pEntries[lru]->lastUse))
+    {
+      lru = i;
+    }
+  }
+
+  if (lru == s_NumEntries)
+  {
+    return false;
+  }
+
+  RemoveEntryLocked(lru);
+  return true;
+}
+
+static DWORD WINAPI WatcherThreadMain(LPVOID lpThreadParameter)
+{
+  static_cast<void>(lpThreadParameter);
+#ifdef TRACY_ENABLE
+  tracy::SetThreadName("Listing cache watcher");
+#endif
+
+  while (true)
+  {
+    MJ_UNINITIALIZED DWORD numBytes;
+    MJ_UNINITIALIZED ULONG_PTR key;
+    LPOVERLAPPED pOverlapped = nullptr;
+    const BOOL ok            = ::GetQueuedCompletionStatus(s_hCompletionPort, &numBytes, &key, &pOverlapped, INFINITE);
+    if (!pOverlapped)
+    {
+      // Woken up by ListingCacheDestroy
+      if (!ok || (::ReadAcquire(&s_Quit) && ::ReadAcquire(&s_NumWatches) == 0))
+      {
+        break;
+      }
+      continue;
+    }
+
+    ZoneScopedN("Folder changed");
+
+    // A change, an overflow, an error or ListingCacheDestroy: either way the watch is over
+    auto* pEntry = reinterpret_cast<mj::detail::ListingCacheEntry*>(pOverlapped);
+
+    ::AcquireSRWLockExclusive(&s_ListingCacheLock);
+    for (size_t i = 0; i < s_NumEntries; i++)
+    {
+      if (s_pEntries[i] == pEntry)
+      {
+        RemoveEntryLocked(i);
+        break;
+      }
+    }
+    ::ReleaseSRWLockExclusive(&s_ListingCacheLock);
+
+    static_cast<void>(::HeapFree(::GetProcessHeap(), 0, pEntry));
+    if (::InterlockedDecrement(&s_NumWatches) == 0 && ::ReadAcquire(&s_Quit))
+    {
+      break;
+    }
+  }
+
+  return 0;
+}
+
+void mj::ListingCacheInit(size_t maxBytes)
+{
+  ZoneScoped;
+
+  s_MaxBytes = maxBytes;
+  ::WriteRelease(&s_Quit, 0);
+  MJ_ERR_IF(s_hCompletionPort = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1), nullptr);
+  MJ_ERR_IF(s_hWatcherThread = ::CreateThread(nullptr, 0, WatcherThreadMain, nullptr, 0, nullptr), nullptr);
+}
+
+void mj::ListingCacheDestroy()
+{
+  ZoneScoped;
+
+  ::AcquireSRWLockExclusive(&s_ListingCacheLock);
+  ::WriteRelease(&s_Quit, 1);
+  while (s_NumEntries > 0)
+  {
+    RemoveEntryLocked(s_NumEntries - 1);
+  }
+  ::ReleaseSRWLockExclusive(&s_ListingCacheLock);
+
+  // The watcher exits once the aborted reads are in. This wakes it if there were none.
+  MJ_ERR_ZERO(::PostQueuedCompletionStatus(s_hCompletionPort, 0, 0, nullptr));
+  static_cast<void>(::WaitForSingleObject(s_hWatcherThread, INFINITE));
+  static_cast<void>(::CloseHandle(s_hWatcherThread));
+  s_hWatcherThread = nullptr;
+
+  // Watches that start from now on see s_Quit under the lock, and never touch the port
+  ::AcquireSRWLockExclusive(&s_ListingCacheLock);
+  static_cast<void>(::CloseHandle(s_hCompletionPort));
+  s_hCompletionPort = nullptr;
+  ::ReleaseSRWLockExclusive(&s_ListingCacheLock);
+}
+
+mj::ListingSnapshot* mj::ListingCacheLookup(const mj::StringView& path)
+{
+  ZoneScoped;
+
+  mj::ListingSnapshot* pSnapshot = nullptr;
+
+  ::AcquireSRWLockExclusive(&s_ListingCacheLock);
+  MJ_UNINITIALIZED size_t index;
+  mj::detail::ListingCacheEntry* pEntry = FindEntryLocked(path, &index);
+  if (pEntry && pEntry->pSnapshot)
+  {
+    pSnapshot = pEntry->pSnapshot;
+    mj::ListingSnapshotAddRef(pSnapshot);
+    pEntry->lastUse = ++s_UseCounter;
+  }
+  ::ReleaseSRWLockExclusive(&s_ListingCacheLock);
+
+  return pSnapshot;
+}
+
+/// <summary>
+/// Counts another listing of a watched folder.
+/// </summary>
+static mj::ListingCacheHandle AddListingLocked(mj::detail::ListingCacheEntry* pEntry)
+{
+  pEntry->numListings++;
+  return { pEntry, pEntry->generation };
+}
+
+mj::ListingCacheHandle mj::ListingCacheWatch(const mj::StringView& path)
+{
+  ZoneScoped;
+
+  // Already watched, e.g. by a listing in another panel
+  ::AcquireSRWLockExclusive(&s_ListingCacheLock);
+  MJ_UNINITIALIZED size_t index;
+  mj::detail::ListingCacheEntry* pExisting = FindEntryLocked(path, &index);
+  const mj::ListingCacheHandle existing    = pExisting ? AddListingLocked(pExisting) : mj::ListingCacheHandle{};
+  ::ReleaseSRWLockExclusive(&s_ListingCacheLock);
+  if (pExisting)
+  {
+    return existing;
+  }
+
+  const size_t numBytes = sizeof(mj::detail::ListingCacheEntry) + (path.len + 1) * sizeof(wchar_t);
+  auto* pEntry =
+      static_cast<mj::detail::ListingCacheEntry*>(::HeapAlloc(::GetProcessHeap(), HEAP_ZERO_MEMORY, numBytes));
+  if (!pEntry)
+  {
+    return {};
+  }
+
+  // CreateFileW needs a null terminator
+  wchar_t* pPath = reinterpret_cast<wchar_t*>(pEntry + 1);
+  static_cast<void>(::memcpy(pPath, path.ptr, path.len * sizeof(wchar_t)));
+  pPath[path.len] = L'\0';
+  pEntry->path.Init(pPath, path.len);
+
+  {
+    ZoneScopedN("CreateFileW");
+    pEntry->hDirectory = ::CreateFileW(pPath,                                                  //
+                                       FILE_LIST_DIRECTORY,                                    //
+                                       FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, //
+                                       nullptr,                                                //
+                                       OPEN_EXISTING,                                          //
+                                       FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,      //
+                                       nullptr);
+  }
+  if (pEntry->hDirectory == INVALID_HANDLE_VALUE)
+  {
+    static_cast<void>(::HeapFree(::GetProcessHeap(), 0, pEntry));
+    return {};
+  }
+
+  mj::ListingCacheHandle handle = {};
+  bool watching                 = false;
+
+  ::AcquireSRWLockExclusive(&s_ListingCacheLock);
+
+  // Another listing may have started watching while we opened the folder.
+  // The port is only valid while s_Quit is not set, which ListingCacheDestroy sets under this lock.
+  // Issue the read while holding the lock, so the watcher cannot see it complete before the entry is in the table.
+  pExisting = FindEntryLocked(path, &index);
+  if (pExisting)
+  {
+    handle = AddListingLocked(pExisting);
+  }
+  else if (!::ReadAcquire(&s_Quit) && s_hCompletionPort &&
+           ::CreateIoCompletionPort(pEntry->hDirectory, s_hCompletionPort, 0, 0) &&
+           ::ReadDirectoryChangesW(pEntry->hDirectory,           //
+                                   pEntry->notifyBuffer,         //
+                                   sizeof(pEntry->notifyBuffer), //
+                                   FALSE,                        // Just this folder
+                                   NOTIFY_FILTER,                //
+                                   nullptr,                      //
+                                   &pEntry->overlapped,          //
+                                   nullptr))
+  {
+    watching = true;
+    static_cast<void>(::InterlockedIncrement(&s_NumWatches));
+
+    if (s_NumEntries == MAX_CACHE_ENTRIES)
+    {
+      static_cast<void>(EvictLeastRecentlyUsedLocked(nullptr, false));
+    }
+    pEntry->generation         = ++s_Generation;
+    pEntry->lastUse            = ++s_UseCounter;
+    s_pEntries[s_NumEntries++] = pEntry;
+    handle                     = AddListingLocked(pEntry);
+  }
+
+  ::ReleaseSRWLockExclusive(&s_ListingCacheLock);
+
+  if (!watching)
+  {
+    // Not every file system supports change notifications
+    static_cast<void>(::CloseHandle(pEntry->hDirectory));
+    static_cast<void>(::HeapFree(::GetProcessHeap(), 0, pEntry));
+  }
+
+  return handle;
+}
+
+void mj::ListingCachePublish(const mj::ListingCacheHandle& handle, mj::ListingSnapshot* pSnapshot)
+{
+  ZoneScoped;
+
+  ::AcquireSRWLockExclusive(&s_ListingCacheLock);
+
+  // The entry is gone if the folder changed during the listing, even if a newer one watches it by now.
+  // If it has a listing already, another panel published first.
+  MJ_UNINITIALIZED size_t index;
+  mj::detail::ListingCacheEntry* pEntry = FindHandleLocked(handle, &index);
+  if (pEntry && !pEntry->pSnapshot)
+  {
+    mj::ListingSnapshotAddRef(pSnapshot);
+    pEntry->pSnapshot = pSnapshot;
+    pEntry->lastUse   = ++s_UseCounter;
+    s_NumBytes += pSnapshot->numBytes;
+
+    // Least recently used listings go first, but not this one
+    while (s_NumBytes > s_MaxBytes)
+    {
+      if (!EvictLeastRecentlyUsedLocked(pEntry, true))
+      {
+        break;
+      }
+    }
+  }
+
+  ::ReleaseSRWLockExclusive(&s_ListingCacheLock);
+}
+
+void mj::ListingCacheUnwatch(const mj::ListingCacheHandle& handle)
+{
+  if (!handle.pEntry)
+  {
+    return;
+  }
+
+  ::AcquireSRWLockExclusive(&s_ListingCacheLock);
+
+  MJ_UNINITIALIZED size_t index;
+  mj::detail::ListingCacheEntry* pEntry = FindHandleLocked(handle, &index);
+  if (pEntry && --pEntry->numListings == 0 && !pEntry->pSnapshot)
+  {
+    // Cancelled, failed or out of memory. There is nothing to invalidate.
+    RemoveEntryLocked(index);
+  }
+
+  ::ReleaseSRWLockExclusive(&s_ListingCacheLock);
+}
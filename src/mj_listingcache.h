@@ -0,0 +1,94 @@
+#pragma once
+#include "mj_win32.h"
+#include "mj_string.h"
+
+namespace mj
+{
+  class ArenaAllocator;
+
+  namespace detail
+  {
+    struct ListingCacheEntry;
+  } // namespace detail
+
+  /// <summary>
+  /// Names in one folder, in listing order. Immutable once finished, and shared by every panel showing the folder.
+  /// Reference counted: release every snapshot you create or look up.
+  /// </summary>
+  struct ListingSnapshot
+  {
+    StringView* pFolders; // Contiguous, so they can be matched in batches
+    StringView* pFiles;
+    size_t numFolders;
+    size_t numFiles;
+
+    // (Internal)
+    volatile LONG refCount;
+    size_t numBytes;
+    ArenaAllocator* pArena; // Holds this snapshot as well
+  };
+
+  /// <returns>An empty snapshot with one reference, or nullptr if we are out of memory</returns>
+  ListingSnapshot* ListingSnapshotCreate();
+
+  /// <summary>
+  /// Copies a name into the snapshot. Only while it is not finished.
+  /// </summary>
+  /// <returns>The copy, which lives as long as the snapshot. nullptr if we are out of memory.</returns>
+  StringView* ListingSnapshotAddName(ListingSnapshot* pSnapshot, const StringView& name);
+
+  /// <summary>
+  /// Allocates the rows. Fill them in with copies of the names added to this snapshot, before sharing it.
+  /// </summary>
+  /// <returns>False if we are out of memory</returns>
+  bool ListingSnapshotFinish(ListingSnapshot* pSnapshot, size_t numFolders, size_t numFiles);
+
+  void ListingSnapshotAddRef(ListingSnapshot* pSnapshot);
+  void ListingSnapshotRelease(ListingSnapshot* pSnapshot);
+
+  /// <summary>
+  /// One watch of a folder, as seen by one listing. A zero-initialized handle watches nothing.
+  /// The entry is only compared against the table, never dereferenced, so the handle may outlive it.
+  /// </summary>
+  struct ListingCacheHandle
+  {
+    detail::ListingCacheEntry* pEntry;
+    uint64_t generation;
+  };
+
+  /// <summary>
+  /// Starts the thread that receives change notifications.
+  /// </summary>
+  /// <param name="maxBytes">Least recently used listings are evicted above this size</param>
+  void ListingCacheInit(size_t maxBytes);
+  void ListingCacheDestroy();
+
+  /// <summary>
+  /// Does no I/O, so it is safe to call from the main thread.
+  /// </summary>
+  /// <param name="path">As passed to ListingCacheWatch. Compared without regard to case.</param>
+  /// <returns>A reference to the cached listing, or nullptr</returns>
+  ListingSnapshot* ListingCacheLookup(const StringView& path);
+
+  /// <summary>
+  /// Starts watching a folder for changes. Call this before listing it, so changes made during the listing are seen.
+  /// Opens the folder, so call it from an I/O task. Folders that cannot be watched are never cached.
+  /// Every call must be paired with ListingCacheUnwatch.
+  /// </summary>
+  /// <param name="path">Normalized, e.g. from Path::ToOsPath</param>
+  /// <returns>A zero handle if the folder cannot be watched</returns>
+  ListingCacheHandle ListingCacheWatch(const StringView& path);
+
+  /// <summary>
+  /// Adds a finished listing, unless the folder changed since ListingCacheWatch returned the handle.
+  /// Takes its own reference to the snapshot.
+  /// </summary>
+  void ListingCachePublish(const ListingCacheHandle& handle, ListingSnapshot* pSnapshot);
+
+  /// <summary>
+  /// Call when the listing ends, whether it was published or not.
+  /// A folder without a listing stops being watched once no listing of it is in flight,
+  /// so it does not keep a directory handle open.
+  /// </summary>
+  void ListingCacheUnwatch(const ListingCacheHandle& handle);
+} // namespace mj
@@ -0,0 +1,157 @@
+#include "mj_parallel.h"
+#include "ErrorExit.h"
+#include "../3rdparty/tracy/Tracy.hpp"
+
+using mj::detail::ParallelForState;
+
+static void Release(ParallelForState* pState)
+{
+  if (::InterlockedDecrement(&pState->refCount) == 0)
+  {
+    static_cast<void>(::HeapFree(::GetProcessHeap(), 0, pState));
+  }
+}
+
+/// <summary>
+/// Guided self-scheduling: every claim takes a share of what is left, but at least one grain.
+/// </summary>
+/// <returns>False if the range is exhausted.</returns>
+static bool ClaimChunk(ParallelForState* pState, size_t* pBegin, size_t* pEnd)
+{
+  LONG64 begin = ::ReadAcquire64(&pState->next);
+  while (true)
+  {
+    if (static_cast<size_t>(begin) >= pState->end)
+    {
+      return false;
+    }
+
+    const size_t remaining = pState->end - static_cast<size_t>(begin);
+    size_t size            = remaining / (2 * pState->numParticipants);
+    if (size < pState->grain)
+    {
+      size = pState->grain;
+    }
+    if (size > remaining)
+    {
+      size = remaining;
+    }
+
+    const LONG64 previous =
+        ::InterlockedCompareExchange64(&pState->next, begin + static_cast<LONG64>(size), begin);
+    if (previous == begin)
+    {
+      *pBegin = static_cast<size_t>(begin);
+      *pEnd   = static_cast<size_t>(begin) + size;
+      return true;
+    }
+    begin = previous;
+  }
+}
+
+static void RunChunks(ParallelForState* pState)
+{
+  size_t numProcessed = 0;
+
+  MJ_UNINITIALIZED size_t begin;
+  MJ_UNINITIALIZED size_t end;
+  while (ClaimChunk(pState, &begin, &end))
+  {
+    pState->pRangeFn(pState->pContext, begin, end);
+    numProcessed += end - begin;
+  }
+
+  if (numProcessed > 0)
+  {
+    // Only now may the caller return, and take the callback with it
+    static_cast<void>(::InterlockedExchangeAdd64(&pState->numDone, static_cast<LONG64>(numProcessed)));
+    ::WakeByAddressAll(const_cast<LONG64*>(&pState->numDone));
+  }
+}
+
+namespace mj
+{
+  namespace detail
+  {
+    struct ParallelForTask : public Task
+    {
+      MJ_UNINITIALIZED ParallelForState* pState;
+
+      virtual void Execute() override
+      {
+        ZoneScoped;
+        RunChunks(this->pState);
+      }
+
+      virtual void Destroy() override
+      {
+        Release(this->pState);
+      }
+    };
+  } // namespace detail
+} // namespace mj
+
+void mj::detail::ParallelFor(size_t begin, size_t end, size_t grain, ParallelForState::RangeFn pRangeFn,
+                             void* pContext)
+{
+  ZoneScoped;
+
+  if (begin >= end)
+  {
+    return;
+  }
+
+  if (grain == 0)
+  {
+    grain = 1;
+  }
+
+  // No point in helpers for fewer chunks than threads
+  const size_t numItems  = end - begin;
+  const size_t numChunks = (numItems + grain - 1) / grain;
+  size_t numHelpers      = ThreadpoolGetNumThreads();
+  if (numHelpers > numChunks - 1)
+  {
+    numHelpers = numChunks - 1;
+  }
+
+  if (numHelpers == 0)
+  {
+    pRangeFn(pContext, begin, end);
+    return;
+  }
+
+  ParallelForState* pState =
+      static_cast<ParallelForState*>(::HeapAlloc(::GetProcessHeap(), 0, sizeof(ParallelForState)));
+  MJ_EXIT_NULL(pState);
+  pState->pRangeFn        = pRangeFn;
+  pState->pContext        = pContext;
+  pState->next            = static_cast<LONG64>(begin);
+  pState->end             = end;
+  pState->grain           = grain;
+  pState->numParticipants = numHelpers + 1;
+  pState->numDone         = 0;
+  pState->refCount        = static_cast<LONG>(numHelpers + 1);
+
+  for (size_t i = 0; i < numHelpers; i++)
+  {
+    auto pTask      = ThreadpoolCreateTask<ParallelForTask>();
+    pTask->pState   = pState;
+    pTask->priority = ETaskPriority::Interactive; // Someone is waiting
+    ThreadpoolSubmitTask(pTask);
+  }
+
+  // Help out, then wait for chunks that are still in progress elsewhere.
+  // Helpers that have not started yet do not hold us up, they will find nothing left.
+  RunChunks(pState);
+
+  LONG64 numDone = ::ReadAcquire64(&pState->numDone);
+  while (static_cast<size_t>(numDone) != numItems)
+  {
+    ZoneScopedN("Wait");
+    static_cast<void>(::WaitOnAddress(&pState->numDone, &numDone, sizeof(numDone), INFINITE));
+    numDone = ::ReadAcquire64(&pState->numDone);
+  }
+
+  Release(pState);
+}
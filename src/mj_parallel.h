@@ -0,0 +1,76 @@
+#pragma once
+#include "mj_common.h"
+#include "Threadpool.h"
+
+namespace mj
+{
+  namespace detail
+  {
+    /// <summary>
+    /// Shared by the calling thread and its helper tasks.
+    /// Helpers only touch the range callback after claiming a chunk, which means the caller is still waiting.
+    /// The state itself is reference counted, as helpers may start after the caller has returned.
+    /// </summary>
+    struct ParallelForState
+    {
+      typedef void (*RangeFn)(void* pContext, size_t begin, size_t end);
+
+      RangeFn pRangeFn;
+      void* pContext;
+
+      volatile LONG64 next; // First unclaimed index
+      size_t end;
+      size_t grain;
+      size_t numParticipants;
+
+      volatile LONG64 numDone; // Items processed, published when a participant runs out of work
+      volatile LONG refCount;
+    };
+
+    void ParallelFor(size_t begin, size_t end, size_t grain, ParallelForState::RangeFn pRangeFn, void* pContext);
+  } // namespace detail
+
+  /// <summary>
+  /// Calls fn(begin, end) for consecutive subranges of [begin, end), on threadpool threads and the calling thread.
+  /// Returns once all subranges are done.
+  /// Subranges start large and shrink as the range runs out, down to grain items,
+  /// so threads that finish early pick up the remaining work.
+  /// </summary>
+  /// <param name="grain">Smallest subrange worth the overhead of claiming it</param>
+  template <typename Fn>
+  void ParallelFor(size_t begin, size_t end, size_t grain, const Fn& fn)
+  {
+    struct Thunk
+    {
+      static void Call(void* pContext, size_t b, size_t e)
+      {
+        (*static_cast<const Fn*>(pContext))(b, e);
+      }
+    };
+
+    detail::ParallelFor(begin, end, grain, Thunk::Call, const_cast<Fn*>(&fn));
+  }
+
+  /// <summary>
+  /// Computes fn(begin, end) for subranges of [begin, end) in parallel, and folds the results with combine.
+  /// combine must be associative; subranges are not combined in order.
+  /// </summary>
+  /// <param name="identity">Result of an empty range</param>
+  template <typename T, typename Fn, typename Combine>
+  T ParallelReduce(size_t begin, size_t end, size_t grain, const T& identity, const Fn& fn, const Combine& combine)
+  {
+    SRWLOCK lock = SRWLOCK_INIT;
+    T result     = identity;
+
+    ParallelFor(begin, end, grain, [&](size_t b, size_t e) {
+      T partial = fn(b, e);
+
+      // Few subranges, so a lock is cheap enough
+      ::AcquireSRWLockExclusive(&lock);
+      result = combine(result, partial);
+      ::ReleaseSRWLockExclusive(&lock);
+    });
+
+    return result;
+  }
+} // namespace mj
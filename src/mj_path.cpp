@@ -0,0 +1,226 @@
+#include "mj_path.h"
+
+static bool IsSeparator(wchar_t c)
+{
+  return c == L'\\' || c == L'/';
+}
+
+static bool IsDot(const mj::StringView& component)
+{
+  return component.len == 1 && component.ptr[0] == L'.';
+}
+
+static bool IsDotDot(const mj::StringView& component)
+{
+  return component.len == 2 && component.ptr[0] == L'.' && component.ptr[1] == L'.';
+}
+
+/// <summary>
+/// ArrayList::Reserve grows to the exact size, which would reallocate on every Append.
+/// </summary>
+template <typename T>
+static bool ReserveGeometric(mj::ArrayList<T>& list, size_t num)
+{
+  if (list.Size() + num <= list.Capacity())
+  {
+    return true;
+  }
+
+  size_t grow = list.Capacity() > num ? list.Capacity() : num;
+  return list.Reserve(grow);
+}
+
+void mj::Path::Init(AllocatorBase* pAllocator)
+{
+  this->buffer.Init(pAllocator);
+  this->componentEnds.Init(pAllocator);
+  this->isUnc = false;
+}
+
+void mj::Path::Destroy()
+{
+  this->buffer.Destroy();
+  this->componentEnds.Destroy();
+  this->isUnc = false;
+}
+
+bool mj::Path::Assign(const StringView& path)
+{
+  this->Clear();
+
+  const wchar_t* pIt  = path.ptr;
+  const wchar_t* pEnd = path.ptr + path.len;
+
+  if (path.len >= 4 && pIt[0] == L'\\' && pIt[1] == L'\\' && pIt[2] == L'?' && pIt[3] == L'\\')
+  {
+    // Long path prefix
+    pIt += 4;
+    if (pEnd - pIt >= 4 && (pIt[0] | 0x20) == L'u' && (pIt[1] | 0x20) == L'n' && (pIt[2] | 0x20) == L'c' &&
+        pIt[3] == L'\\')
+    {
+      pIt += 4;
+      this->isUnc = true;
+    }
+  }
+  else if (path.len >= 2 && IsSeparator(pIt[0]) && IsSeparator(pIt[1]))
+  {
+    // \\server\share
+    pIt += 2;
+    this->isUnc = true;
+  }
+
+  // Single allocation for the common case
+  if (pEnd > pIt && !this->buffer.Reserve(pEnd - pIt))
+  {
+    this->Clear();
+    return false;
+  }
+
+  while (pIt < pEnd)
+  {
+    while (pIt < pEnd && IsSeparator(*pIt))
+    {
+      ++pIt;
+    }
+
+    const wchar_t* pBegin = pIt;
+    while (pIt < pEnd && !IsSeparator(*pIt))
+    {
+      ++pIt;
+    }
+
+    if (pIt > pBegin)
+    {
+      MJ_UNINITIALIZED StringView component;
+      component.Init(pBegin, pIt - pBegin);
+      if (!this->Append(component))
+      {
+        this->Clear();
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool mj::Path::Copy(const Path& other)
+{
+  this->isUnc = other.isUnc;
+  return this->buffer.Copy(other.buffer) && this->componentEnds.Copy(other.componentEnds);
+}
+
+bool mj::Path::Append(const StringView& component)
+{
+  if (component.len == 0 || IsDot(component))
+  {
+    return true;
+  }
+
+  if (IsDotDot(component))
+  {
+    static_cast<void>(this->Pop());
+    return true;
+  }
+
+  size_t numSeparators = this->buffer.Size() > 0 ? 1 : 0;
+  if (!ReserveGeometric(this->componentEnds, 1) || !ReserveGeometric(this->buffer, component.len + numSeparators))
+  {
+    return false;
+  }
+
+  // Both succeed after reserving
+  wchar_t* pDest = this->buffer.Emplace(component.len + numSeparators);
+  if (numSeparators)
+  {
+    *pDest++ = L'\\';
+  }
+  ::memcpy(pDest, component.ptr, component.len * sizeof(wchar_t));
+
+  *this->componentEnds.Emplace(1) = static_cast<uint32_t>(this->buffer.Size());
+  return true;
+}
+
+bool mj::Path::Pop()
+{
+  size_t numComponents = this->componentEnds.Size();
+  if (numComponents == 0)
+  {
+    return false;
+  }
+
+  this->Truncate(numComponents - 1);
+  return true;
+}
+
+void mj::Path::Truncate(size_t numComponents)
+{
+  if (numComponents < this->componentEnds.Size())
+  {
+    this->buffer.Truncate(numComponents > 0 ? this->componentEnds[numComponents - 1] : 0);
+    this->componentEnds.Truncate(numComponents);
+  }
+}
+
+void mj::Path::Clear()
+{
+  this->buffer.Clear();
+  this->componentEnds.Clear();
+  this->isUnc = false;
+}
+
+size_t mj::Path::NumComponents() const
+{
+  return this->componentEnds.Size();
+}
+
+mj::StringView mj::Path::Component(size_t index) const
+{
+  MJ_UNINITIALIZED StringView string;
+  if (index < this->componentEnds.Size())
+  {
+    const uint32_t* pEnds = this->componentEnds.begin();
+    uint32_t begin        = index > 0 ? pEnds[index - 1] + 1 : 0;
+    string.Init(this->buffer.begin() + begin, pEnds[index] - begin);
+  }
+  else
+  {
+    string.Init(this->buffer.end(), 0);
+  }
+  return string;
+}
+
+mj::StringView mj::Path::Prefix(size_t numComponents) const
+{
+  if (numComponents > this->componentEnds.Size())
+  {
+    numComponents = this->componentEnds.Size();
+  }
+
+  MJ_UNINITIALIZED StringView string;
+  string.Init(this->buffer.begin(), numComponents > 0 ? this->componentEnds.begin()[numComponents - 1] : 0);
+  return string;
+}
+
+mj::StringView mj::Path::Parent() const
+{
+  size_t numComponents = this->componentEnds.Size();
+  return this->Prefix(numComponents > 0 ? numComponents - 1 : 0);
+}
+
+mj::StringView mj::Path::ToStringView() const
+{
+  MJ_UNINITIALIZED StringView string;
+  string.Init(this->buffer.begin(), this->buffer.Size());
+  return string;
+}
+
+void mj::Path::ToOsPath(StringBuilder& sb) const
+{
+  sb.Append(L"\\\\?\\");
+  if (this->isUnc)
+  {
+    sb.Append(L"UNC\\");
+  }
+  sb.Append(this->ToStringView());
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include "mj_common.h"
+#include "mj_string.h"
+
+namespace mj
+{
+  /// <summary>
+  /// Absolute path stored as a single contiguous buffer ("C:\Users\Public"),
+  /// plus the end offset of every component.
+  /// Ancestors are prefixes of the buffer, so parent and component access is O(1),
+  /// and Append/Pop never rescan the string.
+  /// Requires explicit initialization and destruction.
+  /// </summary>
+  class Path
+  {
+  private:
+    /// <summary>
+    /// Components joined by backslashes.
+    /// No trailing separator, no null terminator, no "\\?\" prefix.
+    /// For UNC paths, this starts with the server name.
+    /// </summary>
+    ArrayList<wchar_t> buffer;
+
+    /// <summary>
+    /// For each component: offset into the buffer, one past its last character.
+    /// The separator (if any) lives at this offset.
+    /// </summary>
+    ArrayList<uint32_t> componentEnds;
+
+    bool isUnc = false;
+
+  public:
+    /// <summary>
+    /// Does no allocation on construction.
+    /// </summary>
+    void Init(AllocatorBase* pAllocator);
+
+    /// <summary>
+    /// Data is freed using the assigned allocator.
+    /// </summary>
+    void Destroy();
+
+    /// <summary>
+    /// Parses an absolute path. Accepts both separators, duplicate separators,
+    /// a trailing separator and the "\\?\" and "\\?\UNC\" prefixes.
+    /// "." and ".." components are resolved.
+    /// </summary>
+    /// <returns>False if memory allocation failed. The path is cleared in that case.</returns>
+    bool Assign(const StringView& path);
+
+    bool Copy(const Path& other);
+
+    /// <summary>
+    /// Adds a single component. Separators in the component are not interpreted.
+    /// "." is ignored, ".." is the same as Pop().
+    /// </summary>
+    /// <returns>False if memory allocation failed, the path is unchanged in that case.</returns>
+    bool Append(const StringView& component);
+
+    /// <summary>
+    /// Removes the last component.
+    /// </summary>
+    /// <returns>False if the path was already empty.</returns>
+    bool Pop();
+
+    /// <summary>
+    /// Keeps the first numComponents components. Equivalent to numerous calls to Pop().
+    /// </summary>
+    void Truncate(size_t numComponents);
+
+    void Clear();
+
+    size_t NumComponents() const;
+
+    /// <summary>
+    /// Not null-terminated. Invalidated when this path grows.
+    /// </summary>
+    StringView Component(size_t index) const;
+
+    /// <summary>
+    /// Path of the ancestor with the given number of components, e.g.
+    /// Prefix(1) is "C:" for "C:\Users\Public".
+    /// Not null-terminated. Invalidated when this path grows.
+    /// </summary>
+    StringView Prefix(size_t numComponents) const;
+
+    /// <summary>
+    /// Path without the last component. Empty if there is at most one component.
+    /// </summary>
+    StringView Parent() const;
+
+    /// <summary>
+    /// Entire path in display form, e.g. "C:\Users". Not null-terminated.
+    /// </summary>
+    StringView ToStringView() const;
+
+    /// <summary>
+    /// Appends the path in the form expected by the wide Win32 file functions,
+    /// using the "\\?\" prefix so MAX_PATH does not apply.
+    /// Examples: "\\?\C:\Users" and "\\?\UNC\server\share".
+    /// No trailing separator is added. Note that a bare drive ("\\?\C:") names the volume device,
+    /// so append a separator or a wildcard before using it as a directory.
+    /// </summary>
+    void ToOsPath(StringBuilder& sb) const;
+  };
+} // namespace mj
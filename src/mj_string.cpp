@@ -1,4 +1,5 @@
 #include "mj_string.h"
+#include "mj_format.h"
 #include "ErrorExit.h"
 #define STRSAFE_NO_CB_FUNCTIONS
 #include <strsafe.h>
@@ -98,38 +99,84 @@ void mj::StringBuilder::Clear()
 
 mj::StringBuilder& mj::StringBuilder::Append(int32_t integer)
 {
-  // TODO: Do we actually ever print a null terminator?
-  wchar_t buf[12]; // E.g. ['-', '2', '1', '4', '7', '4', '8', '3', '6', '4', '8', '\0']
-  wchar_t* pEnd   = buf + MJ_COUNTOF(buf);
-  wchar_t* pHead  = pEnd;
-  bool isNegative = integer < 0;
+  return this->Append(static_cast<int64_t>(integer));
+}
+
+mj::StringBuilder& mj::StringBuilder::Append(uint32_t integer)
+{
+  return this->Append(static_cast<uint64_t>(integer));
+}
+
+mj::StringBuilder& mj::StringBuilder::Append(int64_t integer)
+{
+  // Negate in unsigned space, so the minimum value does not overflow
+  bool isNegative    = integer < 0;
+  uint64_t magnitude = isNegative ? 0 - static_cast<uint64_t>(integer) : static_cast<uint64_t>(integer);
+  size_t numDigits   = mj::fmt::CountDigits(magnitude);
 
-  if (isNegative)
+  wchar_t* pDest = this->pArrayList->Emplace(numDigits + (isNegative ? 1 : 0));
+  if (pDest)
   {
-    integer = -integer;
+    if (isNegative)
+    {
+      *pDest++ = L'-';
+    }
+    mj::fmt::WriteDigits(pDest, magnitude, numDigits);
   }
 
-  do
-  {
-    int32_t div = integer / 10;                      // Calculate next value
-    --pHead;                                         // fill it backwards
-    *pHead  = s_IntToWideChar[integer - (div * 10)]; // Calculate rest value
-    integer = div;                                   // Decimal 10 conversion
-  } while (integer);
-
-  // Add sign
-  if (isNegative)
+  return *this;
+}
+
+mj::StringBuilder& mj::StringBuilder::Append(uint64_t integer)
+{
+  size_t numDigits = mj::fmt::CountDigits(integer);
+
+  wchar_t* pDest = this->pArrayList->Emplace(numDigits);
+  if (pDest)
   {
-    --pHead;
-    *pHead = '-';
+    mj::fmt::WriteDigits(pDest, integer, numDigits);
   }
 
-  ptrdiff_t numChars = pEnd - pHead;
+  return *this;
+}
+
+mj::StringBuilder& mj::StringBuilder::Append(double value)
+{
+  // The length is only known after conversion, so go through the stack
+  wchar_t buf[mj::fmt::kMaxDoubleChars];
   MJ_UNINITIALIZED StringView string;
-  string.Init(pHead, numChars);
+  string.Init(buf, mj::fmt::FormatDouble(buf, value));
+  return this->Append(string);
+}
+
+mj::StringBuilder& mj::StringBuilder::Append(float value)
+{
+  wchar_t buf[mj::fmt::kMaxDoubleChars];
+  MJ_UNINITIALIZED StringView string;
+  string.Init(buf, mj::fmt::FormatFloat(buf, value));
+  return this->Append(string);
+}
+
+mj::StringBuilder& mj::StringBuilder::AppendByteSize(uint64_t numBytes)
+{
+  wchar_t buf[mj::fmt::kMaxByteSizeChars];
+  MJ_UNINITIALIZED StringView string;
+  string.Init(buf, mj::fmt::FormatByteSize(buf, numBytes));
   return this->Append(string);
 }
 
+mj::StringBuilder& mj::StringBuilder::AppendIsoDate(uint64_t fileTime)
+{
+  // Fixed width, so we can write in-place
+  wchar_t* pDest = this->pArrayList->Emplace(mj::fmt::kMaxIsoDateChars);
+  if (pDest)
+  {
+    static_cast<void>(mj::fmt::FormatIsoDate(pDest, fileTime));
+  }
+
+  return *this;
+}
+
 mj::StringBuilder& mj::StringBuilder::AppendHex32(uint32_t dw)
 {
   wchar_t buf[8]; // E.g. ['-', '2', '1', '4', '7', '4', '8', '3', '6', '4', '8', '\0']
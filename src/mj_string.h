@@ -30,7 +30,31 @@ namespace mj
     StringBuilder& Append(const StringView& string);
     StringBuilder& Append(const wchar_t* pStringLiteral);
     StringBuilder& Append(int32_t integer);
+    StringBuilder& Append(uint32_t integer);
+    StringBuilder& Append(int64_t integer);
+    StringBuilder& Append(uint64_t integer);
+
+    /// <summary>
+    /// Shortest round-trip representation, see mj::fmt::FormatDouble.
+    /// </summary>
+    StringBuilder& Append(double value);
+
+    /// <summary>
+    /// Shortest round-trip representation, see mj::fmt::FormatFloat.
+    /// </summary>
+    StringBuilder& Append(float value);
+
     StringBuilder& AppendHex32(uint32_t dw);
+
+    /// <summary>
+    /// Appends a human-readable size, e.g. "1.4 GiB".
+    /// </summary>
+    StringBuilder& AppendByteSize(uint64_t numBytes);
+
+    /// <summary>
+    /// Appends a FILETIME value as "YYYY-MM-DD hh:mm:ss".
+    /// </summary>
+    StringBuilder& AppendIsoDate(uint64_t fileTime);
     StringBuilder& Indent(uint32_t numSpaces);
 
     /// <summary>
@@ -0,0 +1,154 @@
+#include "mj_topology.h"
+#include "../3rdparty/tracy/Tracy.hpp"
+
+/// <summary>
+/// Sets a field of every processor in the group mask.
+/// </summary>
+static void SetField(const GROUP_AFFINITY& groupMask, mj::CpuTopology* pTopology,
+                     uint16_t mj::LogicalProcessor::*pField, uint16_t value)
+{
+  for (uint32_t i = 0; i < pTopology->numLogicalProcessors; i++)
+  {
+    mj::LogicalProcessor& processor = pTopology->processors[i];
+    if (processor.number.Group == groupMask.Group &&
+        (groupMask.Mask & (static_cast<KAFFINITY>(1) << processor.number.Number)))
+    {
+      processor.*pField = value;
+    }
+  }
+}
+
+static bool IsPlacedBefore(const mj::LogicalProcessor& a, const mj::LogicalProcessor& b)
+{
+  if (a.smtIndex != b.smtIndex)
+  {
+    return a.smtIndex < b.smtIndex;
+  }
+  if (a.numaNode != b.numaNode)
+  {
+    return a.numaNode < b.numaNode;
+  }
+  if (a.l3Domain != b.l3Domain)
+  {
+    return a.l3Domain < b.l3Domain;
+  }
+  return a.core < b.core;
+}
+
+bool mj::QueryCpuTopology(CpuTopology* pTopology)
+{
+  ZoneScoped;
+
+  pTopology->numLogicalProcessors = 0;
+  pTopology->numCores             = 0;
+  pTopology->numNumaNodes         = 0;
+  pTopology->numL3Domains         = 0;
+
+  DWORD numBytes = 0;
+  if (::GetLogicalProcessorInformationEx(RelationAll, nullptr, &numBytes) ||
+      ::GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+  {
+    return false;
+  }
+
+  char* pBuffer = static_cast<char*>(::HeapAlloc(::GetProcessHeap(), 0, numBytes));
+  if (!pBuffer)
+  {
+    return false;
+  }
+  MJ_DEFER(::HeapFree(::GetProcessHeap(), 0, pBuffer));
+
+  auto* pInfos = reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(pBuffer);
+  if (!::GetLogicalProcessorInformationEx(RelationAll, pInfos, &numBytes))
+  {
+    return false;
+  }
+
+  // Records are of different sizes, and cores are not guaranteed to come first.
+  // Collect the processors, then tag them with their node and cache.
+  for (DWORD offset = 0; offset < numBytes;)
+  {
+    const auto* pInfo = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(pBuffer + offset);
+    if (pInfo->Relationship == RelationProcessorCore)
+    {
+      uint16_t smtIndex = 0;
+      for (WORD i = 0; i < pInfo->Processor.GroupCount; i++)
+      {
+        const GROUP_AFFINITY& groupMask = pInfo->Processor.GroupMask[i];
+        for (BYTE bit = 0; bit < sizeof(KAFFINITY) * 8; bit++)
+        {
+          if ((groupMask.Mask & (static_cast<KAFFINITY>(1) << bit)) &&
+              pTopology->numLogicalProcessors < CpuTopology::MAX_LOGICAL_PROCESSORS)
+          {
+            LogicalProcessor& processor = pTopology->processors[pTopology->numLogicalProcessors++];
+            processor.number.Group      = groupMask.Group;
+            processor.number.Number     = bit;
+            processor.number.Reserved   = 0;
+            processor.core              = static_cast<uint16_t>(pTopology->numCores);
+            processor.smtIndex          = smtIndex++;
+            processor.numaNode          = 0;
+            processor.l3Domain          = 0;
+          }
+        }
+      }
+      pTopology->numCores++;
+    }
+    offset += pInfo->Size;
+  }
+
+  if (pTopology->numLogicalProcessors == 0)
+  {
+    return false;
+  }
+
+  for (DWORD offset = 0; offset < numBytes;)
+  {
+    const auto* pInfo = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(pBuffer + offset);
+    if (pInfo->Relationship == RelationNumaNode)
+    {
+      // Older systems only fill in GroupMask, newer ones may report several groups
+      const WORD groupCount = pInfo->NumaNode.GroupCount > 0 ? pInfo->NumaNode.GroupCount : 1;
+      for (WORD i = 0; i < groupCount; i++)
+      {
+        SetField(pInfo->NumaNode.GroupMasks[i], pTopology, &LogicalProcessor::numaNode,
+                 static_cast<uint16_t>(pTopology->numNumaNodes));
+      }
+      pTopology->numNumaNodes++;
+    }
+    else if (pInfo->Relationship == RelationCache && pInfo->Cache.Level == 3)
+    {
+      const WORD groupCount = pInfo->Cache.GroupCount > 0 ? pInfo->Cache.GroupCount : 1;
+      for (WORD i = 0; i < groupCount; i++)
+      {
+        SetField(pInfo->Cache.GroupMasks[i], pTopology, &LogicalProcessor::l3Domain,
+                 static_cast<uint16_t>(pTopology->numL3Domains));
+      }
+      pTopology->numL3Domains++;
+    }
+    offset += pInfo->Size;
+  }
+
+  if (pTopology->numNumaNodes == 0)
+  {
+    pTopology->numNumaNodes = 1;
+  }
+  if (pTopology->numL3Domains == 0)
+  {
+    pTopology->numL3Domains = 1;
+  }
+
+  // Insertion sort, there are only a few hundred at most
+  for (uint32_t i = 1; i < pTopology->numLogicalProcessors; i++)
+  {
+    const LogicalProcessor processor = pTopology->processors[i];
+    uint32_t j                       = i;
+    while (j > 0 && IsPlacedBefore(processor, pTopology->processors[j - 1]))
+    {
+      pTopology->processors[j] = pTopology->processors[j - 1];
+      j--;
+    }
+    pTopology->processors[j] = processor;
+  }
+
+  return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "mj_win32.h"
+#include <stdint.h>
+
+namespace mj
+{
+  struct LogicalProcessor
+  {
+    PROCESSOR_NUMBER number; // Processor group, and number within the group
+    uint16_t core;           // Physical core
+    uint16_t smtIndex;       // Zero for the first hardware thread of a core
+    uint16_t numaNode;       // Dense index, not the system node number
+    uint16_t l3Domain;       // Processors with the same index share an L3 cache
+  };
+
+  struct CpuTopology
+  {
+    static constexpr uint32_t MAX_LOGICAL_PROCESSORS = 256;
+
+    uint32_t numLogicalProcessors;
+    uint32_t numCores;
+    uint32_t numNumaNodes;
+    uint32_t numL3Domains;
+
+    /// <summary>
+    /// In placement order: the first hardware thread of every core, then their SMT siblings.
+    /// Within each of those, processors are grouped by NUMA node and L3 domain.
+    /// </summary>
+    LogicalProcessor processors[MAX_LOGICAL_PROCESSORS];
+  };
+
+  /// <summary>
+  /// Queries cores, SMT siblings, NUMA nodes and L3 caches of all processor groups.
+  /// Processors beyond MAX_LOGICAL_PROCESSORS are left out.
+  /// </summary>
+  /// <returns>False if the system does not report its topology</returns>
+  bool QueryCpuTopology(CpuTopology* pTopology);
+} // namespace mj